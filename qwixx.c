@@ -0,0 +1,752 @@
+// libqwixx implementation. See qwixx.h for the API, qwixx_format.h for the
+// qwixx.bin header and the state space sizes, and single_player_opt.c for how
+// the states and the table are laid out; the code here follows the
+// checker/sim side of that program, with the tables in a context instead of
+// globals, and status codes instead of exit().
+#include "qwixx.h"
+#include "qwixx_format.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum {RED, YELLOW, GREEN, BLUE};
+enum {UP, DOWN};
+
+static const int colorDirection[QWIXX_NUM_COLORS] = {UP, UP, DOWN, DOWN};
+
+static const int rowScores[13] = ROW_SCORES;
+
+// The actions are numbered as QAction in single_player_opt.c: groups of 5, one
+// action that doesn't use the white sum as a color followed by its 4 "white as
+// color" versions.
+#define PENALTY         0
+#define WHITE_AS_RED    1
+#define LOW_RED_ONLY    5
+#define HI_GREEN_ONLY  15
+#define HI_RED_ONLY    25
+#define LOW_GREEN_ONLY 35
+
+struct qwixx_ctx
+{
+  // Same as the globals of the same names in single_player_opt.c
+  unsigned short c1c2ToCombined[NUM_SINGLE_COLOR_STATES][NUM_SINGLE_COLOR_STATES];
+  signed char    colorNext62   [2][NUM_ROW_STATES][13];
+  unsigned short colorLegalSums[2][NUM_ROW_STATES];
+  signed char    color62ToBox  [NUM_ROW_STATES];
+  signed char    color62ToMarks[NUM_ROW_STATES];
+  short          color62Points [NUM_ROW_STATES];
+  signed char    boxMarksTo62  [13][12];
+  // Points a clipped (56) color state is short of states 57-61
+  float          clippedStateOffset[NUM_ROW_STATES - FIRST_LOCKED_ROW_STATE];
+
+  // The mapped table; exactly one of W and Wfixed is non-NULL
+  const float   *W;
+  const int16_t *Wfixed;
+  void          *map;
+  size_t         mapSize;
+};
+
+static void initLookupTables(qwixx_ctx *ctx)
+{
+  int c1, c2, c12;
+  int ix, box, marks, sum, direction;
+
+  memset(ctx->boxMarksTo62, 0, sizeof(ctx->boxMarksTo62));
+  ctx->color62ToBox  [0] = 0;
+  ctx->color62ToMarks[0] = 0;
+  ix = 1;
+  for (box = 2; box <= 12; box++)
+  {
+    for (marks = 1; marks < box; marks++)
+    {
+      if (box == 12 && marks <= LOCK_MIN_MARKS)
+      {
+        continue;
+      }
+      ctx->color62ToBox  [ix]         = box;
+      ctx->color62ToMarks[ix]         = marks;
+      ctx->boxMarksTo62  [box][marks] = ix;
+      ix++;
+    }
+  }
+  for (ix = 0; ix < NUM_ROW_STATES; ix++)
+  {
+    ctx->color62Points[ix] = rowScores[ctx->color62ToMarks[ix] + (ctx->color62ToBox[ix] == 12 ? 1 : 0)];
+  }
+  for (ix = FIRST_LOCKED_ROW_STATE + 1; ix < NUM_ROW_STATES; ix++)
+  {
+    ctx->clippedStateOffset[ix - FIRST_LOCKED_ROW_STATE - 1] =
+      ctx->color62Points[ix] - ctx->color62Points[FIRST_LOCKED_ROW_STATE];
+  }
+
+  memset(ctx->colorNext62,    -1, sizeof(ctx->colorNext62));
+  memset(ctx->colorLegalSums,  0, sizeof(ctx->colorLegalSums));
+  for (ix = 0; ix < NUM_ROW_STATES; ix++)
+  {
+    for (sum = 2; sum <= 12; sum++)
+    {
+      if (sum > ctx->color62ToBox[ix] && (sum < 12 || ctx->color62ToMarks[ix] >= LOCK_MIN_MARKS))
+      {
+        for (direction = UP; direction <= DOWN; direction++)
+        {
+          int diceSum = (direction == UP) ? sum : 14 - sum;
+          ctx->colorNext62   [direction][ix][diceSum] = ctx->boxMarksTo62[sum][ctx->color62ToMarks[ix] + 1];
+          ctx->colorLegalSums[direction][ix]         |= 1 << diceSum;
+        }
+      }
+    }
+  }
+
+  c12 = 0;
+  for (c1 = 0; c1 < NUM_SINGLE_COLOR_STATES; c1++)
+  {
+    for (c2 = c1; c2 < NUM_SINGLE_COLOR_STATES; c2++)
+    {
+      ctx->c1c2ToCombined[c1][c2] = c12++;
+    }
+  }
+}
+
+// Same checks as loadQwixxBin() in single_player_opt.c
+static qwixx_status mapTable(qwixx_ctx *ctx, const char *filename, int verifyChecksum)
+{
+  struct stat           st;
+  const unsigned char  *map;
+  const QwixxBinHeader *header;
+  size_t                valueSize;
+  int                   fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+  {
+    return QWIXX_ERR_IO;
+  }
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return QWIXX_ERR_IO;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED)
+  {
+    return QWIXX_ERR_IO;
+  }
+  ctx->map     = (void *) map;
+  ctx->mapSize = st.st_size;
+
+  header = (const QwixxBinHeader *) map;
+  if (st.st_size == (off_t) (sizeof(float) * NUM_MARKOV_STATES))
+  {
+    // Legacy file: just the floats, which are for the standard rules
+    if (! STANDARD_RULES || rowScoresId() != 0)
+    {
+      return QWIXX_ERR_FORMAT;
+    }
+    ctx->W = (const float *) map;
+    return QWIXX_OK;
+  }
+
+  if (st.st_size < (off_t) sizeof(QwixxBinHeader) ||
+      memcmp(header->magic, QWIXX_BIN_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version           != QWIXX_BIN_VERSION    ||
+      header->numMarkovStates   != NUM_MARKOV_STATES    ||
+      (header->valueType        != QWIXX_BIN_VALUES_FLOAT32 &&
+       (header->valueType       != QWIXX_BIN_VALUES_FIXED16 || header->fixedScale != WVEC_FIXED16_SCALE)) ||
+      header->numColors         != QWIXX_NUM_COLORS     ||
+      header->lockMinMarks      != LOCK_MIN_MARKS       ||
+      header->numPenaltiesToEnd != NUM_PENALTIES_TO_END ||
+      header->penaltyPoints     != PENALTY_POINTS       ||
+      header->numLocksToEnd     != NUM_LOCKS_TO_END     ||
+      header->rowScoresId       != rowScoresId()        ||
+      header->headerSize % sizeof(float) != 0)
+  {
+    return QWIXX_ERR_FORMAT;
+  }
+
+  valueSize = (header->valueType == QWIXX_BIN_VALUES_FIXED16) ? sizeof(int16_t) : sizeof(float);
+  if (st.st_size != (off_t) (header->headerSize + valueSize * NUM_MARKOV_STATES))
+  {
+    return QWIXX_ERR_FORMAT;
+  }
+  if (verifyChecksum &&
+      fnv1a64(map + header->headerSize, valueSize * NUM_MARKOV_STATES) != header->checksum)
+  {
+    return QWIXX_ERR_CHECKSUM;
+  }
+
+  if (header->valueType == QWIXX_BIN_VALUES_FIXED16)
+  {
+    ctx->Wfixed = (const int16_t *) (map + header->headerSize);
+  }
+  else
+  {
+    ctx->W = (const float *) (map + header->headerSize);
+  }
+  return QWIXX_OK;
+}
+
+qwixx_status qwixx_open(const char *filename, int verify_checksum, qwixx_ctx **ctx)
+{
+  qwixx_ctx   *newCtx;
+  qwixx_status status;
+
+  if (filename == NULL || ctx == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  *ctx = NULL;
+
+  newCtx = calloc(1, sizeof(*newCtx));
+  if (newCtx == NULL)
+  {
+    return QWIXX_ERR_NOMEM;
+  }
+  initLookupTables(newCtx);
+
+  status = mapTable(newCtx, filename, verify_checksum);
+  if (status != QWIXX_OK)
+  {
+    qwixx_close(newCtx);
+    return status;
+  }
+
+  *ctx = newCtx;
+  return QWIXX_OK;
+}
+
+void qwixx_close(qwixx_ctx *ctx)
+{
+  if (ctx)
+  {
+    if (ctx->map)
+    {
+      munmap(ctx->map, ctx->mapSize);
+    }
+    free(ctx);
+  }
+}
+
+const char *qwixx_strerror(qwixx_status status)
+{
+  switch (status)
+  {
+    case QWIXX_OK:            return "no error";
+    case QWIXX_ERR_ARG:       return "invalid argument";
+    case QWIXX_ERR_NOMEM:     return "out of memory";
+    case QWIXX_ERR_IO:        return "can't open or map the table";
+    case QWIXX_ERR_FORMAT:    return "not a qwixx.bin for these rules";
+    case QWIXX_ERR_CHECKSUM:  return "bad table checksum";
+    case QWIXX_ERR_GAME_OVER: return "the game is over";
+    case QWIXX_ERR_TABLE:     return "the table has no value for this state";
+  }
+  return "unknown error";
+}
+
+const char *qwixx_action_name(int action)
+{
+  static const char *const names[QWIXX_NUM_ACTIONS] =
+  {
+    "PENALTY",        "WHITE_AS_RED",               "WHITE_AS_YELLOW",               "WHITE_AS_GREEN",               "WHITE_AS_BLUE",
+    "LOW_RED_ONLY",   "WHITE_AS_RED_THEN_LOW_RED",    "WHITE_AS_YELLOW_THEN_LOW_RED",    "WHITE_AS_GREEN_THEN_LOW_RED",    "WHITE_AS_BLUE_THEN_LOW_RED",
+    "LOW_YELLOW_ONLY","WHITE_AS_RED_THEN_LOW_YELLOW", "WHITE_AS_YELLOW_THEN_LOW_YELLOW", "WHITE_AS_GREEN_THEN_LOW_YELLOW", "WHITE_AS_BLUE_THEN_LOW_YELLOW",
+    "HI_GREEN_ONLY",  "WHITE_AS_RED_THEN_HI_GREEN",   "WHITE_AS_YELLOW_THEN_HI_GREEN",   "WHITE_AS_GREEN_THEN_HI_GREEN",   "WHITE_AS_BLUE_THEN_HI_GREEN",
+    "HI_BLUE_ONLY",   "WHITE_AS_RED_THEN_HI_BLUE",    "WHITE_AS_YELLOW_THEN_HI_BLUE",    "WHITE_AS_GREEN_THEN_HI_BLUE",    "WHITE_AS_BLUE_THEN_HI_BLUE",
+    "HI_RED_ONLY",    "WHITE_AS_RED_THEN_HI_RED",     "WHITE_AS_YELLOW_THEN_HI_RED",     "WHITE_AS_GREEN_THEN_HI_RED",     "WHITE_AS_BLUE_THEN_HI_RED",
+    "HI_YELLOW_ONLY", "WHITE_AS_RED_THEN_HI_YELLOW",  "WHITE_AS_YELLOW_THEN_HI_YELLOW",  "WHITE_AS_GREEN_THEN_HI_YELLOW",  "WHITE_AS_BLUE_THEN_HI_YELLOW",
+    "LOW_GREEN_ONLY", "WHITE_AS_RED_THEN_LOW_GREEN",  "WHITE_AS_YELLOW_THEN_LOW_GREEN",  "WHITE_AS_GREEN_THEN_LOW_GREEN",  "WHITE_AS_BLUE_THEN_LOW_GREEN",
+    "LOW_BLUE_ONLY",  "WHITE_AS_RED_THEN_LOW_BLUE",   "WHITE_AS_YELLOW_THEN_LOW_BLUE",   "WHITE_AS_GREEN_THEN_LOW_BLUE",   "WHITE_AS_BLUE_THEN_LOW_BLUE"
+  };
+
+  return (action >= 0 && action < QWIXX_NUM_ACTIONS) ? names[action] : "INVALID";
+}
+
+//
+// Score sheets
+//
+
+// Box of the last mark of a row, counting UP (see colorDirection[])
+static inline int upBox(const qwixx_sheet *sheet, int color)
+{
+  int box = sheet->last_mark[color];
+  return (colorDirection[color] == DOWN && box > 0) ? 14 - box : box;
+}
+
+void qwixx_sheet_init(qwixx_sheet *sheet)
+{
+  memset(sheet, 0, sizeof(*sheet));
+}
+
+int qwixx_is_game_over(const qwixx_sheet *sheet)
+{
+  int numLocked = 0;
+  int c;
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    numLocked += (upBox(sheet, c) == 12);
+  }
+  return sheet->num_penalties >= NUM_PENALTIES_TO_END || numLocked >= NUM_LOCKS_TO_END;
+}
+
+int qwixx_score(const qwixx_sheet *sheet)
+{
+  int score = -PENALTY_POINTS * sheet->num_penalties;
+  int c;
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    score += rowScores[sheet->num_marks[c] + (upBox(sheet, c) == 12)];
+  }
+  return score;
+}
+
+// Convert a sheet to 0-61 color states. Returns QWIXX_ERR_ARG if the sheet
+// can't happen.
+static qwixx_status sheetTo62States(const qwixx_ctx *ctx, const qwixx_sheet *sheet, int colorStates[])
+{
+  int c;
+
+  if (sheet->num_penalties < 0 || sheet->num_penalties > NUM_PENALTIES_TO_END)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    int box   = upBox(sheet, c);
+    int marks = sheet->num_marks[c];
+    int ix;
+
+    if (box < 0 || box > 12 || marks < 0 || marks > 11)
+    {
+      return QWIXX_ERR_ARG;
+    }
+    ix = ctx->boxMarksTo62[box][marks];
+    if (ctx->color62ToBox[ix] != box || ctx->color62ToMarks[ix] != marks)
+    {
+      return QWIXX_ERR_ARG;
+    }
+    colorStates[c] = ix;
+  }
+  return QWIXX_OK;
+}
+
+static void sheetFrom62States(const qwixx_ctx *ctx, const int colorStates[], int numPenalties, qwixx_sheet *sheet)
+{
+  int c;
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    int box = ctx->color62ToBox[colorStates[c]];
+    sheet->num_marks[c] = ctx->color62ToMarks[colorStates[c]];
+    sheet->last_mark[c] = (colorDirection[c] == DOWN && box > 0) ? 14 - box : box;
+  }
+  sheet->num_penalties = numPenalties;
+}
+
+static inline int isGameOverIx(const int colorStates[], int numPenalties)
+{
+  return numPenalties >= NUM_PENALTIES_TO_END ||
+         (int)(colorStates[RED   ] >= 56) +
+         (int)(colorStates[YELLOW] >= 56) +
+         (int)(colorStates[GREEN ] >= 56) +
+         (int)(colorStates[BLUE  ] >= 56) >= NUM_LOCKS_TO_END;
+}
+
+static inline int getScoreFromIx(const qwixx_ctx *ctx, const int colorStates[], int numPenalties)
+{
+  return ctx->color62Points[colorStates[RED   ]] +
+         ctx->color62Points[colorStates[YELLOW]] +
+         ctx->color62Points[colorStates[GREEN ]] +
+         ctx->color62Points[colorStates[BLUE  ]] - PENALTY_POINTS * numPenalties;
+}
+
+// Same as convertClipped5tupleToIx() in single_player_opt.c
+static inline int markovIx(const qwixx_ctx *ctx, int redIx, int yellowIx, int greenIx, int blueIx, int numPenalties)
+{
+  int tmp, ry, gb;
+
+#define SORT_PAIR(a, b) if (a > b) { tmp = a; a = b; b = tmp; }
+  SORT_PAIR(redIx, yellowIx)
+  SORT_PAIR(greenIx, blueIx)
+  ry = ctx->c1c2ToCombined[redIx][yellowIx];
+  gb = ctx->c1c2ToCombined[greenIx][blueIx];
+  SORT_PAIR(ry, gb)
+#undef SORT_PAIR
+
+  // Same as c12c34ToCombined() in single_player_opt.c
+  return numPenalties * NUM_FOUR_COLOR_STATES + ry * (2 * NUM_DUAL_COLOR_STATES + 1 - ry) / 2 + gb - ry;
+}
+
+// Expected final score of 0-61 color states, the same value (bit for bit) as
+// getWforIx() in single_player_opt.c. Returns 0 if the table has no value.
+static int lookupW(const qwixx_ctx *ctx, const int colorStates[], int numPenalties, float *W)
+{
+  int   clipped[QWIXX_NUM_COLORS];
+  float offset = 0.0f;
+  int   c, ix;
+
+  if (isGameOverIx(colorStates, numPenalties))
+  {
+    *W = (float) getScoreFromIx(ctx, colorStates, numPenalties);
+    return 1;
+  }
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    clipped[c] = (colorStates[c] > 56) ? 56 : colorStates[c];
+  }
+  ix = markovIx(ctx, clipped[RED], clipped[YELLOW], clipped[GREEN], clipped[BLUE], numPenalties);
+
+  if (ctx->Wfixed)
+  {
+    if (ctx->Wfixed[ix] == WVEC_FIXED16_END_OF_GAME)
+    {
+      return 0;
+    }
+    *W = (float) getScoreFromIx(ctx, colorStates, numPenalties) + (float) ctx->Wfixed[ix] * (1.0f / WVEC_FIXED16_SCALE);
+    return 1;
+  }
+
+  if (ctx->W[ix] == (float) -1e100) // WVEC_END_OF_GAME
+  {
+    return 0;
+  }
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    offset += (colorStates[c] > 56) ? ctx->clippedStateOffset[colorStates[c] - 57] : 0.0f;
+  }
+  *W = ctx->W[ix] + offset;
+  return 1;
+}
+
+qwixx_status qwixx_expected_score(const qwixx_ctx *ctx, const qwixx_sheet *sheet, float *score)
+{
+  int          colorStates[QWIXX_NUM_COLORS];
+  qwixx_status status;
+
+  if (ctx == NULL || sheet == NULL || score == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  status = sheetTo62States(ctx, sheet, colorStates);
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+  return lookupW(ctx, colorStates, sheet->num_penalties, score) ? QWIXX_OK : QWIXX_ERR_TABLE;
+}
+
+//
+// Actions
+//
+
+// Mark color with diceSum in place. Returns 0 if that isn't allowed.
+static inline int markColor(const qwixx_ctx *ctx, int colorStates[], int color, int diceSum)
+{
+  int direction = colorDirection[color];
+
+  if (! ((ctx->colorLegalSums[direction][colorStates[color]] >> diceSum) & 1))
+  {
+    return 0;
+  }
+  colorStates[color] = ctx->colorNext62[direction][colorStates[color]][diceSum];
+  return 1;
+}
+
+// Same as applyActionIx() in single_player_opt.c, for white dice w1 <= w2
+static int applyActionIx(const qwixx_ctx *ctx, int colorStates[], int *numPenalties, int action,
+                         int w1, int w2, const int dice[])
+{
+  // Color of each group's die (-1: no die), and whether it tries the w1 sum first
+  static const int groupColor   [QWIXX_NUM_ACTIONS / 5] = {-1, RED, YELLOW, GREEN, BLUE, RED, YELLOW, GREEN, BLUE};
+  static const int groupLowFirst[QWIXX_NUM_ACTIONS / 5] = { 0,   1,      1,     0,    0,   0,      0,     1,    1};
+  int group    = action / 5;
+  int wasColor = action % 5 - 1;
+  int c;
+
+  if (action == PENALTY)
+  {
+    (*numPenalties)++;
+    return 1;
+  }
+  if (wasColor >= 0 && ! markColor(ctx, colorStates, wasColor, w1 + w2))
+  {
+    return 0;
+  }
+  if (group > 0)
+  {
+    c = groupColor[group];
+    if (! markColor(ctx, colorStates, c, (groupLowFirst[group] ? w1 : w2) + dice[c]) &&
+        ! markColor(ctx, colorStates, c, (groupLowFirst[group] ? w2 : w1) + dice[c]))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Check the arguments of a roll query and convert them
+static qwixx_status prepareRoll(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                int colorStates[], int *w1, int *w2, int colorDice[])
+{
+  const int   *d;
+  qwixx_status status;
+  int          i;
+
+  if (ctx == NULL || sheet == NULL || dice == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  d = &dice->white1;
+  for (i = 0; i < 6; i++)
+  {
+    if (d[i] < 1 || d[i] > 6)
+    {
+      return QWIXX_ERR_ARG;
+    }
+  }
+  status = sheetTo62States(ctx, sheet, colorStates);
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+  if (isGameOverIx(colorStates, sheet->num_penalties))
+  {
+    return QWIXX_ERR_GAME_OVER;
+  }
+
+  *w1 = (dice->white1 < dice->white2) ? dice->white1 : dice->white2;
+  *w2 = (dice->white1 < dice->white2) ? dice->white2 : dice->white1;
+  colorDice[RED   ] = dice->red;
+  colorDice[YELLOW] = dice->yellow;
+  colorDice[GREEN ] = dice->green;
+  colorDice[BLUE  ] = dice->blue;
+  return QWIXX_OK;
+}
+
+// The action values of analyzeMarkovState() for a single roll: only the lock
+// groups of dice that might lock their color are considered, and marking a
+// die after a "white as" mark that ended the game is not allowed.
+static qwixx_status actionValues(const qwixx_ctx *ctx, const int colorStates[], int p,
+                                 int w1, int w2, const int dice[], float values[])
+{
+  int wasStates[QWIXX_NUM_COLORS][QWIXX_NUM_COLORS];
+  int canTakeWas[QWIXX_NUM_COLORS];
+  int c, k, i, g;
+
+  for (i = 0; i < QWIXX_NUM_ACTIONS; i++)
+  {
+    values[i] = QWIXX_ACTION_ILLEGAL;
+  }
+
+  if (! lookupW(ctx, colorStates, p + 1, &values[PENALTY]))
+  {
+    return QWIXX_ERR_TABLE;
+  }
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    memcpy(wasStates[c], colorStates, sizeof(wasStates[c]));
+    canTakeWas[c] = 0;
+    if (markColor(ctx, wasStates[c], c, w1 + w2))
+    {
+      if (! lookupW(ctx, wasStates[c], p, &values[WHITE_AS_RED + c]))
+      {
+        return QWIXX_ERR_TABLE;
+      }
+      canTakeWas[c] = ! isGameOverIx(wasStates[c], p);
+    }
+  }
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    int isUp       = (colorDirection[c] == UP);
+    int groupStart = isUp ? LOW_RED_ONLY + 5*c : HI_GREEN_ONLY  + 5*(c - GREEN);
+    int lockStart  = isUp ? HI_RED_ONLY  + 5*c : LOW_GREEN_ONLY + 5*(c - GREEN);
+    int mayLock    = isUp ? (dice[c] == 6 && w2 == 6) : (dice[c] == 1 && w1 == 1);
+
+    for (g = 0; g < 1 + mayLock; g++)
+    {
+      int start = (g == 0) ? groupStart : lockStart;
+      for (k = 0; k < 5; k++)
+      {
+        int newStates[QWIXX_NUM_COLORS];
+        int newP = p;
+
+        if (k > 0 && ! canTakeWas[k - 1])
+        {
+          continue;
+        }
+        memcpy(newStates, colorStates, sizeof(newStates));
+        if (applyActionIx(ctx, newStates, &newP, start + k, w1, w2, dice) &&
+            ! lookupW(ctx, newStates, newP, &values[start + k]))
+        {
+          return QWIXX_ERR_TABLE;
+        }
+      }
+    }
+  }
+
+  return QWIXX_OK;
+}
+
+qwixx_status qwixx_action_values(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                 float values[QWIXX_NUM_ACTIONS])
+{
+  int          colorStates[QWIXX_NUM_COLORS];
+  int          colorDice[QWIXX_NUM_COLORS];
+  int          w1, w2;
+  qwixx_status status;
+
+  if (values == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  status = prepareRoll(ctx, sheet, dice, colorStates, &w1, &w2, colorDice);
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+  return actionValues(ctx, colorStates, sheet->num_penalties, w1, w2, colorDice, values);
+}
+
+// Best action of the group starting at start; ties go to the first one
+static inline int bestInGroup(const float values[], int start)
+{
+  int best = start;
+  int i;
+
+  for (i = start + 1; i < start + 5; i++)
+  {
+    if (values[i] > values[best])
+    {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// The white-only group, then each colored die in turn (see qwixx_decide() in
+// single_player_opt.c). A die only replaces the best action so far if it is
+// strictly better.
+static int pickBestAction(const float values[], int w1, int w2, const int colorDice[])
+{
+  int best = bestInGroup(values, PENALTY);
+  int c;
+
+  for (c = 0; c < QWIXX_NUM_COLORS; c++)
+  {
+    int isUp    = (colorDirection[c] == UP);
+    int dieBest = bestInGroup(values, isUp ? LOW_RED_ONLY + 5*c : HI_GREEN_ONLY + 5*(c - GREEN));
+    int mayLock = isUp ? (colorDice[c] == 6 && w2 == 6) : (colorDice[c] == 1 && w1 == 1);
+
+    if (mayLock)
+    {
+      int lockBest = bestInGroup(values, isUp ? HI_RED_ONLY + 5*c : LOW_GREEN_ONLY + 5*(c - GREEN));
+      if (values[lockBest] > values[dieBest])
+      {
+        dieBest = lockBest;
+      }
+    }
+    if (values[dieBest] > values[best])
+    {
+      best = dieBest;
+    }
+  }
+  return best;
+}
+
+qwixx_status qwixx_best_action(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                               int *action, float *value, qwixx_sheet *next)
+{
+  int          colorStates[QWIXX_NUM_COLORS];
+  int          colorDice[QWIXX_NUM_COLORS];
+  float        values[QWIXX_NUM_ACTIONS];
+  int          w1, w2, best, p;
+  qwixx_status status;
+
+  if (action == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  status = prepareRoll(ctx, sheet, dice, colorStates, &w1, &w2, colorDice);
+  if (status == QWIXX_OK)
+  {
+    status = actionValues(ctx, colorStates, sheet->num_penalties, w1, w2, colorDice, values);
+  }
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+
+  best    = pickBestAction(values, w1, w2, colorDice);
+  *action = best;
+  if (value)
+  {
+    *value = values[best];
+  }
+  if (next)
+  {
+    p = sheet->num_penalties;
+    applyActionIx(ctx, colorStates, &p, best, w1, w2, colorDice);
+    sheetFrom62States(ctx, colorStates, p, next);
+  }
+  return QWIXX_OK;
+}
+
+qwixx_status qwixx_evaluate_roll(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                 float values[QWIXX_NUM_ACTIONS], int *action)
+{
+  int          colorStates[QWIXX_NUM_COLORS];
+  int          colorDice[QWIXX_NUM_COLORS];
+  int          w1, w2;
+  qwixx_status status;
+
+  if (values == NULL || action == NULL)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  status = prepareRoll(ctx, sheet, dice, colorStates, &w1, &w2, colorDice);
+  if (status == QWIXX_OK)
+  {
+    status = actionValues(ctx, colorStates, sheet->num_penalties, w1, w2, colorDice, values);
+  }
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+
+  *action = pickBestAction(values, w1, w2, colorDice);
+  return QWIXX_OK;
+}
+
+qwixx_status qwixx_apply_action(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                int action, qwixx_sheet *next)
+{
+  int          colorStates[QWIXX_NUM_COLORS];
+  int          colorDice[QWIXX_NUM_COLORS];
+  int          w1, w2, p;
+  qwixx_status status;
+
+  if (next == NULL || action < 0 || action >= QWIXX_NUM_ACTIONS)
+  {
+    return QWIXX_ERR_ARG;
+  }
+  status = prepareRoll(ctx, sheet, dice, colorStates, &w1, &w2, colorDice);
+  if (status != QWIXX_OK)
+  {
+    return status;
+  }
+
+  p = sheet->num_penalties;
+  if (! applyActionIx(ctx, colorStates, &p, action, w1, w2, colorDice))
+  {
+    return QWIXX_ERR_ARG;
+  }
+  sheetFrom62States(ctx, colorStates, p, next);
+  return QWIXX_OK;
+}
@@ -0,0 +1,89 @@
+// libqwixx: optimal single player Qwixx decisions from a qwixx.bin table.
+//
+// qwixx.bin is written by the generate mode of single_player_opt. A
+// qwixx_ctx holds everything needed to query it: the state index tables and a
+// read-only mapping of the table. Nothing in the library is global, and a
+// context is never modified after qwixx_open(), so any number of threads can
+// query the same context at once. No function prints anything or exits; they
+// all report problems through qwixx_status.
+#ifndef QWIXX_H
+#define QWIXX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct qwixx_ctx qwixx_ctx;
+
+typedef enum
+{
+  QWIXX_OK = 0,
+  QWIXX_ERR_ARG,       // NULL pointer, dice out of range or impossible score sheet
+  QWIXX_ERR_NOMEM,     // out of memory
+  QWIXX_ERR_IO,        // the table couldn't be opened or mapped
+  QWIXX_ERR_FORMAT,    // not a qwixx.bin, or one for other rules or another version
+  QWIXX_ERR_CHECKSUM,  // the table's checksum doesn't match
+  QWIXX_ERR_GAME_OVER, // the game on this score sheet is already over
+  QWIXX_ERR_TABLE      // the table has no value for a state (e.g. a cut short generate run)
+} qwixx_status;
+
+#define QWIXX_NUM_COLORS  4  // red, yellow, green, blue
+#define QWIXX_NUM_ACTIONS 45 // same numbering as QAction in single_player_opt.c
+
+// Value of an action the dice don't allow
+#define QWIXX_ACTION_ILLEGAL (-1e9f)
+
+// A score sheet. Colors are in the order red, yellow, green, blue.
+typedef struct
+{
+  int num_marks[QWIXX_NUM_COLORS];  // marks in the row, not counting the lock
+  int last_mark[QWIXX_NUM_COLORS];  // box of the last mark (2-12), 0 if the row is empty
+  int num_penalties;                // 0-4 (NUM_PENALTIES_TO_END in qwixx_rules.h)
+} qwixx_sheet;
+
+typedef struct
+{
+  int white1, white2;
+  int red, yellow, green, blue;
+} qwixx_dice;
+
+// Map the table in filename (see qwixx.bin in README.md) and build the index
+// tables. With verify_checksum, the whole table is read to check it.
+qwixx_status qwixx_open(const char *filename, int verify_checksum, qwixx_ctx **ctx);
+void         qwixx_close(qwixx_ctx *ctx);
+
+const char  *qwixx_strerror(qwixx_status status);
+const char  *qwixx_action_name(int action);
+
+// Score sheets. These don't need a context.
+void         qwixx_sheet_init(qwixx_sheet *sheet);
+int          qwixx_is_game_over(const qwixx_sheet *sheet);
+int          qwixx_score(const qwixx_sheet *sheet);
+
+// Expected final score of a sheet, before the next roll
+qwixx_status qwixx_expected_score(const qwixx_ctx *ctx, const qwixx_sheet *sheet, float *score);
+
+// Expected final score after each action for one roll, QWIXX_ACTION_ILLEGAL
+// for the actions the dice don't allow
+qwixx_status qwixx_action_values(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                 float values[QWIXX_NUM_ACTIONS]);
+
+// Best action for one roll, with the same tie breaking as single_player_opt.
+// value and next may be NULL; next may be sheet.
+qwixx_status qwixx_best_action(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                               int *action, float *value, qwixx_sheet *next);
+
+// qwixx_action_values() and the action qwixx_best_action() would pick, in one
+// call
+qwixx_status qwixx_evaluate_roll(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                 float values[QWIXX_NUM_ACTIONS], int *action);
+
+// Take action for one roll. Returns QWIXX_ERR_ARG if the dice don't allow it.
+qwixx_status qwixx_apply_action(const qwixx_ctx *ctx, const qwixx_sheet *sheet, const qwixx_dice *dice,
+                                int action, qwixx_sheet *next);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QWIXX_H
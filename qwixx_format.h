@@ -0,0 +1,91 @@
+// qwixx.bin format and Markov state space sizes, shared by single_player_opt.c
+// (which writes and reads qwixx.bin) and libqwixx (which reads it), so that
+// the two can't drift apart. How the states are numbered and laid out is
+// described in single_player_opt.c.
+#ifndef QWIXX_FORMAT_H
+#define QWIXX_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qwixx_rules.h"
+
+// Courtesy u/chaotic_iak:
+// While there are 62 states the row can be in, states 58-62 are all identical
+// to state 57, except they are offset by a constant number of points, so we
+// only need to actually track 57 states.
+#define NUM_SINGLE_COLOR_STATES (FIRST_LOCKED_ROW_STATE + 1)
+
+// Courtesy u/chaotic_iak:
+// From a Markov probability perspective, red and yellow are essentially
+// equivalent.  That is - "3 red marks, last red 6; 4 yellow marks, last yellow
+// 9" is equivalent to "4 red marks, last red 9; 3 yellow marks, last yellow
+// 6". So treat them as the same Markov state. The same applies to green and
+// blue, respectively. Note that as a result, we are only populating the upper
+// triangular portion of c1c2ToCombined[][].
+#define NUM_DUAL_COLOR_STATES   (NUM_SINGLE_COLOR_STATES*(NUM_SINGLE_COLOR_STATES+1)/2) //    1653
+
+// Same logic as above, but it is for the *combination* of RY/GB.  Only the
+// upper triangle (c12 <= c34) is used, see c12c34ToCombined().
+#define NUM_FOUR_COLOR_STATES   (NUM_DUAL_COLOR_STATES*(NUM_DUAL_COLOR_STATES+1)/2)     // 1367031
+
+// 4 possible penalty values before game ends (0, 1, 2, or 3; in general
+// NUM_PENALTIES_TO_END of them). Add one state for the end game state. This
+// is the total number of states that we'll track in the Markov matrix. Note
+// that this is only ~7.4% of the total number of "game" states.
+#define NUM_MARKOV_STATES       (NUM_FOUR_COLOR_STATES * NUM_PENALTIES_TO_END + 1)      // 5468125
+
+// qwixx.bin starts with a 64 byte QwixxBinHeader, followed by the
+// NUM_MARKOV_STATES values, as floats or as 16-bit fixed point numbers.
+#define QWIXX_BIN_MAGIC   "QWIXXBIN"
+#define QWIXX_BIN_VERSION 1
+
+#define QWIXX_BIN_VALUES_FLOAT32 0 // Wvec[] is stored as floats
+#define QWIXX_BIN_VALUES_FIXED16 1 // WvecFixed[] is stored as int16_t
+
+// A fixed16 value is the expected number of points still to come, in units of
+// 1/WVEC_FIXED16_SCALE, on top of the score the state already has. End of game
+// entries are WVEC_FIXED16_END_OF_GAME.
+#define WVEC_FIXED16_SCALE       128
+#define WVEC_FIXED16_END_OF_GAME INT16_MIN
+
+typedef struct
+{
+  char     magic[8];          // QWIXX_BIN_MAGIC (without the terminating 0)
+  uint32_t version;           // QWIXX_BIN_VERSION
+  uint32_t headerSize;        // sizeof(QwixxBinHeader); Wvec[] starts here
+  uint32_t numMarkovStates;   // NUM_MARKOV_STATES
+  uint32_t valueType;         // QWIXX_BIN_VALUES_*
+
+  // Rules the file was generated for
+  uint32_t numColors;         // 4
+  uint32_t lockMinMarks;      // LOCK_MIN_MARKS
+  uint32_t numPenaltiesToEnd; // NUM_PENALTIES_TO_END
+  uint32_t penaltyPoints;     // PENALTY_POINTS
+  uint32_t numLocksToEnd;     // NUM_LOCKS_TO_END
+
+  uint32_t fixedScale;        // WVEC_FIXED16_SCALE for QWIXX_BIN_VALUES_FIXED16, else 0
+  uint64_t checksum;          // fnv1a64() of the Wvec[] bytes
+  uint32_t rowScoresId;       // rowScoresId() (0 for the standard ROW_SCORES)
+  char     pad[4];
+} QwixxBinHeader;
+
+typedef char QwixxBinHeaderIs64Bytes[(sizeof(QwixxBinHeader) == 64) ? 1 : -1];
+
+// 64-bit FNV-1a hash of len bytes
+static inline uint64_t fnv1a64(const void *data, size_t len)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+  uint64_t             hash  = 0xcbf29ce484222325ULL;
+  size_t               i;
+
+  for (i = 0; i < len; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+#endif // QWIXX_FORMAT_H
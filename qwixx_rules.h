@@ -0,0 +1,96 @@
+// Qwixx rules, shared by single_player_opt.c and libqwixx.
+//
+// The rules are compile time constants, so the state space is sized for them
+// and every loop bound and legality check in the kernels is folded into the
+// code. A house rule or variant sheet is a separate build, e.g.
+//
+//   gcc -O3 -DLOCK_MIN_MARKS=4 -DNUM_PENALTIES_TO_END=3 single_player_opt.c -o qwixx_variant -lpthread -lm
+//
+// and runs exactly as fast as the standard game. qwixx.bin records the rules
+// it was generated for, and only a build with the same rules loads it, so the
+// library and qwixx_server have to be built with the same flags too.
+//
+// The 4 colors, their directions (red and yellow UP, green and blue DOWN) and
+// the 2-12 rows are not rules here: the 45 actions and the red/yellow and
+// green/blue symmetries of the Markov states are built on them.
+#ifndef QWIXX_RULES_H
+#define QWIXX_RULES_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Number of marks a row needs before its last box can be marked (which locks it)
+#ifndef LOCK_MIN_MARKS
+#define LOCK_MIN_MARKS 5
+#endif
+
+// The game ends with this many penalties
+#ifndef NUM_PENALTIES_TO_END
+#define NUM_PENALTIES_TO_END 4
+#endif
+
+// Points lost per penalty
+#ifndef PENALTY_POINTS
+#define PENALTY_POINTS 5
+#endif
+
+// The game ends once this many colors are locked
+#ifndef NUM_LOCKS_TO_END
+#define NUM_LOCKS_TO_END 2
+#endif
+
+// Points for a row with 0-12 marks (the lock counts as a mark), and the
+// largest of them
+#ifndef ROW_SCORES
+#define ROW_SCORES     {0,1,3,6,10,15,21,28,36,45,55,66,78}
+#define ROW_MAX_POINTS 78
+#endif
+
+#if LOCK_MIN_MARKS < 1 || LOCK_MIN_MARKS > 10
+#error "LOCK_MIN_MARKS must be 1-10"
+#endif
+#if NUM_PENALTIES_TO_END < 1 || NUM_PENALTIES_TO_END > 8
+#error "NUM_PENALTIES_TO_END must be 1-8"
+#endif
+#if NUM_LOCKS_TO_END < 1 || NUM_LOCKS_TO_END > 4
+#error "NUM_LOCKS_TO_END must be 1-4"
+#endif
+#ifndef ROW_MAX_POINTS
+#error "ROW_SCORES needs ROW_MAX_POINTS (its largest entry) as well"
+#endif
+
+// Whether these are the standard rules (apart from ROW_SCORES, see
+// rowScoresId()). Legacy qwixx.bin files, which are just the floats, are only
+// used with them.
+#define STANDARD_RULES (LOCK_MIN_MARKS == 5 && NUM_PENALTIES_TO_END == 4 && PENALTY_POINTS == 5 && NUM_LOCKS_TO_END == 2)
+
+// States of a single row: empty, the 55 states with the last mark in box 2-11
+// (1 to box-1 marks), and the locked rows with LOCK_MIN_MARKS+1 to 11 marks
+// (62 with the standard rules). The locked states start at
+// FIRST_LOCKED_ROW_STATE whatever the rules are.
+#define FIRST_LOCKED_ROW_STATE 56
+#define NUM_ROW_STATES         (FIRST_LOCKED_ROW_STATE + 11 - LOCK_MIN_MARKS)
+
+// Identifies ROW_SCORES in the qwixx.bin header: 0 for the standard scores
+// (which is also what files from before it was recorded have), otherwise the
+// low 32 bits of their FNV-1a hash, forced to be non-zero.
+static inline uint32_t rowScoresId(void)
+{
+  static const int standard[13] = {0,1,3,6,10,15,21,28,36,45,55,66,78};
+  static const int scores[13]   = ROW_SCORES;
+  uint64_t         hash         = 14695981039346656037ULL;
+  size_t           i;
+
+  if (memcmp(scores, standard, sizeof(scores)) == 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < sizeof(scores); i++)
+  {
+    hash ^= ((const unsigned char *) scores)[i];
+    hash *= 1099511628211ULL;
+  }
+  return (uint32_t) hash ? (uint32_t) hash : 1;
+}
+
+#endif // QWIXX_RULES_H
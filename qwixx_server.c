@@ -0,0 +1,539 @@
+// qwixx_server: a long running decision server for qwixx.bin, built on
+// libqwixx (qwixx.h).
+//
+//   gcc -O3 qwixx_server.c qwixx.c -o qwixx_server -lpthread
+//   ./qwixx_server [--threads N] [--table FILE] [--verify-checksum] SOCKET
+//
+// The table is mapped once, and clients connect to the Unix domain socket
+// SOCKET. Each request is one line: an ID (any word, echoed back) followed by
+// the board state and the dice in the same order as checker mode,
+//
+//   ID NumRed LastRed NumYellow LastYellow NumGreen LastGreen NumBlue LastBlue NumPenalties W1 W2 R Y G B
+//
+// and each answer is one line, in the order of the requests:
+//
+//   ID BestAction Q0 Q1 ... Q44   (expected final scores, '-' if illegal)
+//   ID ERR message
+//
+// Clients may write any number of requests without waiting for the answers;
+// everything that has arrived is answered together. The connections are
+// shared by a fixed pool of worker threads through one epoll instance. Every
+// connection is registered with EPOLLONESHOT, so it is only ever in the
+// hands of one worker, which takes it until it runs out of input (or the
+// client stops reading its answers) and then re-arms it.
+#define _GNU_SOURCE // accept4()
+#include "qwixx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define READ_CHUNK       65536
+#define MAX_LINE         256                            // longer requests drop the connection
+#define MAX_ID           32
+#define MAX_ANSWER       (MAX_ID + 16 + QWIXX_NUM_ACTIONS * 9)
+#define MAX_PENDING_OUT  (1 << 20)                      // stop reading while this many bytes are unsent
+#define LISTEN_BACKLOG   128
+
+typedef struct
+{
+  int    fd;
+  int    eof;     // the client has closed its end
+  char  *in;      // received, not yet answered
+  size_t inLen;
+  size_t inCap;
+  char  *out;     // answers not yet sent, from outPos on
+  size_t outPos;
+  size_t outLen;
+  size_t outCap;
+} Connection;
+
+static qwixx_ctx  *ctx;
+static int         epollFd;
+static int         listenFd;
+static const char *socketPath;
+
+//
+// Requests and answers
+//
+
+static void reserve(char **buf, size_t *cap, size_t needed)
+{
+  if (needed > *cap)
+  {
+    size_t newCap = *cap ? *cap : 4096;
+    while (newCap < needed)
+    {
+      newCap *= 2;
+    }
+    *buf = realloc(*buf, newCap);
+    if (*buf == NULL)
+    {
+      printf("Out of memory for a connection buffer! Exiting!\n");
+      exit(-1);
+    }
+    *cap = newCap;
+  }
+}
+
+// Parse a non-negative number from *p, skipping blanks first
+static int parseInt(const char **p, const char *end, int *val)
+{
+  const char *s = *p;
+  int         v = 0;
+
+  while (s < end && (*s == ' ' || *s == '\t'))
+  {
+    s++;
+  }
+  if (s == end || *s < '0' || *s > '9')
+  {
+    return 0;
+  }
+  while (s < end && *s >= '0' && *s <= '9')
+  {
+    v = (v < 1000) ? v * 10 + (*s - '0') : v; // anything this big is rejected later anyway
+    s++;
+  }
+  *p   = s;
+  *val = v;
+  return 1;
+}
+
+static char *appendInt(char *o, int v)
+{
+  char digits[12];
+  int  n = 0;
+
+  if (v < 0)
+  {
+    *o++ = '-';
+    v    = -v;
+  }
+  do
+  {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n)
+  {
+    *o++ = digits[--n];
+  }
+  return o;
+}
+
+// A Q-value with 3 decimals (printf() would take most of the time of a request)
+static char *appendValue(char *o, float v)
+{
+  long milli;
+
+  if (v <= QWIXX_ACTION_ILLEGAL)
+  {
+    *o++ = '-';
+    return o;
+  }
+  milli = (long) ((double) v * 1000.0 + (v < 0 ? -0.5 : 0.5));
+  if (milli < 0)
+  {
+    *o++  = '-';
+    milli = -milli;
+  }
+  o    = appendInt(o, (int) (milli / 1000));
+  *o++ = '.';
+  *o++ = '0' + (milli / 100) % 10;
+  *o++ = '0' + (milli / 10) % 10;
+  *o++ = '0' + milli % 10;
+  return o;
+}
+
+// Answer the request in line[0..len) into o (which has room for MAX_ANSWER
+// bytes). Returns the end of the answer.
+static char *answerRequest(const char *line, size_t len, char *o)
+{
+  const char  *p   = line;
+  const char  *end = line + len;
+  const char  *id;
+  int          v[15];
+  int          i, action;
+  float        values[QWIXX_NUM_ACTIONS];
+  qwixx_sheet  sheet;
+  qwixx_dice   dice;
+  qwixx_status status;
+
+  while (p < end && (*p == ' ' || *p == '\t'))
+  {
+    p++;
+  }
+  id = p;
+  while (p < end && *p != ' ' && *p != '\t' && p - id < MAX_ID)
+  {
+    p++;
+  }
+  memcpy(o, id, p - id);
+  o   += p - id;
+  *o++ = ' ';
+
+  for (i = 0; i < 15; i++)
+  {
+    if (! parseInt(&p, end, &v[i]))
+    {
+      break;
+    }
+  }
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+  {
+    p++;
+  }
+  if (i < 15 || p != end)
+  {
+    const char *msg = "ERR expected ID and 15 numbers\n";
+    memcpy(o, msg, strlen(msg));
+    return o + strlen(msg);
+  }
+
+  for (i = 0; i < QWIXX_NUM_COLORS; i++)
+  {
+    sheet.num_marks[i] = v[2*i];
+    sheet.last_mark[i] = v[2*i + 1];
+  }
+  sheet.num_penalties = v[8];
+  dice.white1 = v[9];
+  dice.white2 = v[10];
+  dice.red    = v[11];
+  dice.yellow = v[12];
+  dice.green  = v[13];
+  dice.blue   = v[14];
+
+  status = qwixx_evaluate_roll(ctx, &sheet, &dice, values, &action);
+  if (status != QWIXX_OK)
+  {
+    const char *msg = qwixx_strerror(status);
+    memcpy(o, "ERR ", 4);
+    memcpy(o + 4, msg, strlen(msg));
+    o   += 4 + strlen(msg);
+    *o++ = '\n';
+    return o;
+  }
+
+  o = appendInt(o, action);
+  for (i = 0; i < QWIXX_NUM_ACTIONS; i++)
+  {
+    *o++ = ' ';
+    o    = appendValue(o, values[i]);
+  }
+  *o++ = '\n';
+  return o;
+}
+
+// Answer every complete line in conn->in. Returns 0 if a line is too long.
+static int answerLines(Connection *conn)
+{
+  size_t start = 0;
+  char  *nl;
+
+  while ((nl = memchr(conn->in + start, '\n', conn->inLen - start)) != NULL)
+  {
+    size_t len = nl - (conn->in + start);
+    if (len > MAX_LINE)
+    {
+      return 0;
+    }
+    if (len > 0 && ! (len == 1 && conn->in[start] == '\r'))
+    {
+      reserve(&conn->out, &conn->outCap, conn->outLen + MAX_ANSWER);
+      conn->outLen = answerRequest(conn->in + start, len, conn->out + conn->outLen) - conn->out;
+    }
+    start += len + 1;
+  }
+
+  memmove(conn->in, conn->in + start, conn->inLen - start);
+  conn->inLen -= start;
+  return conn->inLen <= MAX_LINE;
+}
+
+//
+// Connections
+//
+
+// Send as much of the pending answers as the socket takes. Returns 0 if the
+// connection is broken.
+static int flushAnswers(Connection *conn)
+{
+  while (conn->outPos < conn->outLen)
+  {
+    ssize_t n = send(conn->fd, conn->out + conn->outPos, conn->outLen - conn->outPos, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      conn->outPos += n;
+    }
+    else if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      // Keep the unsent part at the front, so the buffer doesn't creep
+      memmove(conn->out, conn->out + conn->outPos, conn->outLen - conn->outPos);
+      conn->outLen -= conn->outPos;
+      conn->outPos  = 0;
+      return 1;
+    }
+    else
+    {
+      return 0;
+    }
+  }
+  conn->outPos = 0;
+  conn->outLen = 0;
+  return 1;
+}
+
+static void closeConnection(Connection *conn)
+{
+  // Closing the fd also removes it from the epoll set
+  close(conn->fd);
+  free(conn->in);
+  free(conn->out);
+  free(conn);
+}
+
+// Read, answer and send until the connection runs dry, then re-arm it (or
+// close it)
+static void serveConnection(Connection *conn)
+{
+  struct epoll_event ev;
+  int                ok = flushAnswers(conn);
+
+  while (ok && ! conn->eof && conn->outLen - conn->outPos < MAX_PENDING_OUT)
+  {
+    ssize_t n;
+
+    reserve(&conn->in, &conn->inCap, conn->inLen + READ_CHUNK);
+    n = recv(conn->fd, conn->in + conn->inLen, READ_CHUNK, 0);
+    if (n > 0)
+    {
+      conn->inLen += n;
+      ok = answerLines(conn) && flushAnswers(conn);
+    }
+    else if (n == 0)
+    {
+      conn->eof = 1;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      break;
+    }
+    else if (errno != EINTR)
+    {
+      ok = 0;
+    }
+  }
+
+  if (! ok || (conn->eof && conn->outPos == conn->outLen))
+  {
+    closeConnection(conn);
+    return;
+  }
+
+  ev.data.ptr = conn;
+  ev.events   = EPOLLONESHOT;
+  if (conn->outPos < conn->outLen)
+  {
+    ev.events |= EPOLLOUT;
+  }
+  if (! conn->eof && conn->outLen - conn->outPos < MAX_PENDING_OUT)
+  {
+    ev.events |= EPOLLIN;
+  }
+  if (epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev) != 0)
+  {
+    closeConnection(conn);
+  }
+}
+
+static void acceptConnections(void)
+{
+  struct epoll_event ev;
+  int                fd;
+
+  while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+  {
+    Connection *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL)
+    {
+      close(fd);
+      continue;
+    }
+    conn->fd    = fd;
+    ev.data.ptr = conn;
+    ev.events   = EPOLLIN | EPOLLONESHOT;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+      closeConnection(conn);
+    }
+  }
+
+  // The listening socket is one shot as well, so only one worker accepts
+  ev.data.ptr = NULL;
+  ev.events   = EPOLLIN | EPOLLONESHOT;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &ev);
+}
+
+static void *serverWorker(void *arg)
+{
+  struct epoll_event ev;
+
+  (void) arg;
+  for (;;)
+  {
+    // One event at a time, so a worker never sits on a ready connection
+    // while it serves another one
+    int n = epoll_wait(epollFd, &ev, 1, -1);
+    if (n < 0 && errno != EINTR)
+    {
+      printf("epoll_wait failed (%s)! Exiting!\n", strerror(errno));
+      exit(-1);
+    }
+    if (n == 1)
+    {
+      if (ev.data.ptr == NULL)
+      {
+        acceptConnections();
+      }
+      else
+      {
+        serveConnection((Connection *) ev.data.ptr);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void stopServer(int sig)
+{
+  (void) sig;
+  unlink(socketPath);
+  _exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  const char        *table_file      = "qwixx.bin";
+  int                verify_checksum = 0;
+  int                num_threads     = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  struct sockaddr_un addr;
+  struct epoll_event ev;
+  struct stat        st;
+  pthread_t         *threads;
+  qwixx_status       status;
+  int                argIx, t;
+
+  for (argIx = 1; argIx < argc; argIx++)
+  {
+    if (strcmp(argv[argIx], "--threads") == 0 && argIx + 1 < argc)
+    {
+      num_threads = atoi(argv[++argIx]);
+      if (num_threads < 1)
+      {
+        printf("Invalid number of threads (%s)! Exiting!\n", argv[argIx]);
+        exit(-1);
+      }
+    }
+    else if (strcmp(argv[argIx], "--table") == 0 && argIx + 1 < argc)
+    {
+      table_file = argv[++argIx];
+    }
+    else if (strcmp(argv[argIx], "--verify-checksum") == 0)
+    {
+      verify_checksum = 1;
+    }
+    else if (socketPath == NULL && argv[argIx][0] != '-')
+    {
+      socketPath = argv[argIx];
+    }
+    else
+    {
+      printf("Unknown option %s! Exiting!\n", argv[argIx]);
+      exit(-1);
+    }
+  }
+  if (socketPath == NULL)
+  {
+    printf("Usage: %s [--threads N] [--table FILE] [--verify-checksum] SOCKET\n", argv[0]);
+    exit(-1);
+  }
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+
+  status = qwixx_open(table_file, verify_checksum, &ctx);
+  if (status != QWIXX_OK)
+  {
+    printf("Can't use %s (%s)! Exiting!\n", table_file, qwixx_strerror(status));
+    exit(-1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+  {
+    printf("Socket path %s is too long! Exiting!\n", socketPath);
+    exit(-1);
+  }
+  strcpy(addr.sun_path, socketPath);
+
+  // A socket left behind by an earlier server is replaced, anything else isn't
+  if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode))
+  {
+    unlink(socketPath);
+  }
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd < 0 ||
+      bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+      listen(listenFd, LISTEN_BACKLOG) != 0)
+  {
+    printf("Can't listen on %s (%s)! Exiting!\n", socketPath, strerror(errno));
+    exit(-1);
+  }
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0)
+  {
+    printf("epoll_create1 failed (%s)! Exiting!\n", strerror(errno));
+    exit(-1);
+  }
+  ev.data.ptr = NULL;
+  ev.events   = EPOLLIN | EPOLLONESHOT;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT,  stopServer);
+  signal(SIGTERM, stopServer);
+
+  printf("Serving %s on %s with %d worker thread%s\n",
+         table_file, socketPath, num_threads, num_threads == 1 ? "" : "s");
+  fflush(stdout);
+
+  threads = malloc(sizeof(pthread_t) * num_threads);
+  for (t = 1; t < num_threads; t++)
+  {
+    if (pthread_create(&threads[t], NULL, serverWorker, NULL) != 0)
+    {
+      printf("Can't start worker thread %d! Exiting!\n", t);
+      exit(-1);
+    }
+  }
+  serverWorker(NULL); // the main thread is worker 0
+
+  return 0;
+}
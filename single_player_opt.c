@@ -1,15 +1,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <malloc.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "qwixx_rules.h"
+#include "qwixx_format.h"
 
 // The 4 Qwixx colors
 typedef enum {RED, YELLOW, GREEN, BLUE} QColor;
 
 #define NUM_COLORS 4
 
+// Red and yellow rows are marked from low to high (UP), green and blue rows
+// from high to low (DOWN)
+typedef enum {UP, DOWN} QDirection;
+
+static const int colorDirection[NUM_COLORS] = {UP, UP, DOWN, DOWN};
+
+// Points for a row with 0-12 marks (see ROW_SCORES in qwixx_rules.h, which
+// also has the other rules)
+static const int rowScores[13] = ROW_SCORES;
+
 typedef enum
 {
   PENALTY,                         // 0
@@ -92,39 +114,23 @@ typedef enum
 // States 47-56 are when the last mark is in box "11", and there are 1-10 marks in the row, respectively
 // States 57-62 are when the last mark is in box "12", and there are 6-11 marks in the row, respectively
 //    Note: you can't mark box "12" until you have already taken 5 marks.
+// (That is with the standard rules. In general there are NUM_ROW_STATES
+// states, the last 11-LOCK_MIN_MARKS of them for box "12".)
 
 // Given that there are 4 colors, and 5 possible penalty values (0, 1, 2, 3,
-// and 4), there are technically 62*62*62*62*5 = 73881680 "game" states.
-#define NUM_GAME_STATES (62*62*62*62*5)
-
-// Courtesy u/chaotic_iak:
-// While there are 62 states the row can be in, states 58-62 are all identical
-// to state 57, except they are offset by a constant number of points, so we
-// only need to actually track 57 states.
-#define NUM_SINGLE_COLOR_STATES 57
-
-// Courtesy u/chaotic_iak:
-// From a Markov probability perspective, red and yellow are essentially
-// equivalent.  That is - "3 red marks, last red 6; 4 yellow marks, last yellow
-// 9" is equivalent to "4 red marks, last red 9; 3 yellow marks, last yellow
-// 6". So treat them as the same Markov state. The same applies to green and
-// blue, respectively. Note that as a result, we are only populating the upper
-// triangular portion of c1c2ToCombined[][].
-#define NUM_DUAL_COLOR_STATES   (NUM_SINGLE_COLOR_STATES*(NUM_SINGLE_COLOR_STATES+1)/2) //    1653
-
-// Same logic as above, but it is for the *combination* of RY/GB.  We are only
-// populating the upper triangular portion of c12c34ToCombined[][].
-#define NUM_FOUR_COLOR_STATES   (NUM_DUAL_COLOR_STATES*(NUM_DUAL_COLOR_STATES+1)/2)     // 1367031
-
-// 4 possible penalty values before game ends (0, 1, 2, or 3). Add one state
-// for the end game state. This is the total number of states that we'll track
-// in the Markov matrix. Note that this is only ~7.4% of the total number of
-// "game" states.
-#define NUM_MARKOV_STATES       (NUM_FOUR_COLOR_STATES * 4 + 1)                         // 5468125
+// and 4), there are technically 62*62*62*62*5 = 73881680 "game" states. A
+// game state index is ((((p*62 + r)*62 + y)*62 + g)*62 + b).
+#define ROW_STATES_2    (NUM_ROW_STATES * NUM_ROW_STATES)
+#define ROW_STATES_3    (NUM_ROW_STATES * ROW_STATES_2)
+#define ROW_STATES_4    (NUM_ROW_STATES * ROW_STATES_3)
+#define NUM_GAME_STATES (ROW_STATES_4 * (NUM_PENALTIES_TO_END + 1))
+
+// The Markov states (NUM_SINGLE_COLOR_STATES up to NUM_MARKOV_STATES) are
+// sized in qwixx_format.h, which libqwixx shares.
 
 // Set Wvec[] values for "end of game" states to invalid because you can't
-// actually count a score for these states (due to the 62-->57 state reduction
-// above).
+// actually count a score for these states (due to the 62-->57 state reduction,
+// see NUM_SINGLE_COLOR_STATES).
 #define WVEC_END_OF_GAME (-1e100)
 
 // This is the state of a single color row on the Qwixx score sheet.
@@ -146,29 +152,72 @@ typedef struct
 // This is the expected final score under optimal decisions for all possible states.
 static float *Wvec = NULL;
 
+// 16-bit fixed-point version of Wvec[], used instead of Wvec[] when it is
+// non-NULL (only in checker/sim modes). Each entry is the expected number of
+// points still to come, in units of 1/WVEC_FIXED16_SCALE, on top of the score
+// the state already has. End of game entries are WVEC_FIXED16_END_OF_GAME.
+static const int16_t *WvecFixed = NULL;
+
 // Combines 2 colors' [0-NUM_SINGLE_COLOR_STATES-1] states to the [0-NUM_DUAL_COLOR_STATES-1] range
-static int c1c2ToCombined[NUM_SINGLE_COLOR_STATES][NUM_SINGLE_COLOR_STATES];
+static unsigned short c1c2ToCombined[NUM_SINGLE_COLOR_STATES][NUM_SINGLE_COLOR_STATES];
+
+// Reverse lookup of c1c2ToCombined[][]
+// Maps [0-NUM_DUAL_COLOR_STATES-1] down to the [0-NUM_SINGLE_COLOR_STATES-1] range; picked such that c1 <= c2
+static unsigned char dualToC1[NUM_DUAL_COLOR_STATES];
+static unsigned char dualToC2[NUM_DUAL_COLOR_STATES];
 
 // Combines the red/yellow [0-NUM_DUAL_COLOR_STATES-1] with green/blue
-// [0-NUM_DUAL_COLOR_STATES-1] states to [0-NUM_FOUR_COLOR_STATES-1] range
-static int c12c34ToCombined[NUM_DUAL_COLOR_STATES][NUM_DUAL_COLOR_STATES];
+// [0-NUM_DUAL_COLOR_STATES-1] states (c12 <= c34) to [0-NUM_FOUR_COLOR_STATES-1]
+// range. The pairs are numbered row by row through the upper triangle, so
+// row c12 starts after the c12 longer rows above it. This used to be an 11 MB
+// table (and its reverse lookup another 11 MB), which pushed Wvec[] out of the
+// cache; the arithmetic gives exactly the same numbering.
+static inline int c12c34ToCombined(int c12, int c34)
+{
+  // c12 * (2N + 1 - c12) is always even
+  return c12 * (2 * NUM_DUAL_COLOR_STATES + 1 - c12) / 2 + c34 - c12;
+}
 
-// Reverse lookup of c12c34ToCombined[][]
-// Maps [0-NUM_FOUR_COLOR_STATES-1] down to the [0-NUM_DUAL_COLOR_STATES-1] range; picked such that c12 <= c34
-static int quadToC12[NUM_FOUR_COLOR_STATES];
-static int quadToC34[NUM_FOUR_COLOR_STATES];
+// Reverse of c12c34ToCombined(). Counted from the end, row c12 is preceded by
+// the k(k+1)/2 entries of the k = N-1-c12 shorter rows below it, so k is the
+// largest with k(k+1)/2 <= fromEnd. The square root is exact when 8*fromEnd+1
+// is a perfect square and at least 1/(2*sqrt) away from the next integer
+// otherwise, so the double is never rounded across an integer.
+static inline void quadToC12C34(int c1234, int *c12, int *c34)
+{
+  int fromEnd = NUM_FOUR_COLOR_STATES - 1 - c1234;
+  int k       = (int) ((sqrt(8.0 * fromEnd + 1.0) - 1.0) * 0.5);
 
-// Reverse lookup of c1c2ToCombined[][]
-// Maps [0-NUM_DUAL_COLOR_STATES-1] down to the [0-NUM_SINGLE_COLOR_STATES-1] range; picked such that c1 <= c2
-static int dualToC1 [NUM_DUAL_COLOR_STATES];
-static int dualToC2 [NUM_DUAL_COLOR_STATES];
+  *c12 = NUM_DUAL_COLOR_STATES - 1 - k;
+  *c34 = c1234 - c12c34ToCombined(*c12, *c12) + *c12;
+}
+
+// Single color transition tables, indexed by the 0-61 color state described
+// above and generated by initLookupTables(). For DOWN colors, the boxes are
+// mirrored (box n in these tables is box 14-n on the score sheet), so the
+// 0-61 state of a DOWN color only needs the dice sum mirrored.
+static signed char    colorNext62   [2][NUM_ROW_STATES][13]; // [direction][state][dice sum] -> state after the mark, or -1 if illegal
+static unsigned short colorLegalSums[2][NUM_ROW_STATES];     // [direction][state] -> bit n is set if dice sum n can be marked
+static signed char    color62ToBox  [NUM_ROW_STATES];        // last marked (UP) box, 2-12, or 0 if the row is empty
+static signed char    color62ToMarks[NUM_ROW_STATES];        // number of marks in the row
+static short          color62Points [NUM_ROW_STATES];        // points for the row, including the lock bonus
+static signed char    boxMarksTo62  [13][12];                // [last UP box][number of marks] -> state; reverse of the two above
+
+// The following array helps account that state 56 is equivalent to states
+// 57-61, except for the number of points that has been earned by the state.
+// With the standard rules, it is {8.0, 17.0, 27.0, 38.0, 50.0} for states
+// 57-61.
+static float clippedStateOffset[NUM_ROW_STATES - FIRST_LOCKED_ROW_STATE];
 
 // Function prototypes
 static inline float getWforState       (QwixxState  *state, int *markovIx);
-static inline float getWforStateOpt    (QwixxState  *state, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx);
+static inline float getWforIx          (int colorStates[], int numPenalties, int *markovIx);
+static inline float getWforStateOpt    (int numPenalties, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx);
+static inline float lookupWforStateOpt (int numPenalties, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx);
 static inline int   colorStateTo62State(QColorState *color);
 
-static inline int getScore(QwixxState *state);
+static inline int getScore      (QwixxState *state);
+static inline int getScoreFromIx(int colorStates[], int numPenalties);
 
 // Macro to swap two integers
 #define SWAP_INT(a,b) \
@@ -188,137 +237,286 @@ void initialize_qwixx_state(QwixxState *state)
   state->color[BLUE  ].color = BLUE;
 }
 
+// Stage profiling (build with -DQWIXX_PROFILE)
+//
+// An instrumented build splits the time of analyzeMarkovState() into stages
+// with rdtsc "laps": PROFILE_LAP(stage) charges the cycles since the previous
+// lap to stage. getWforStateOpt() is timed on its own as well (its time is
+// also part of the stage that called it), and canTakeMark() and the
+// successor cache count how many marks are legal and how many lookups hit.
+// Every thread has its own counters; they are added up and printed on
+// stderr at exit, together with the process' cache misses when
+// perf_event_open() is allowed. Without QWIXX_PROFILE all of the PROFILE_*
+// macros are empty, so the normal build is unchanged.
+#ifdef QWIXX_PROFILE
+#include <x86intrin.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef enum
+{
+  PROFILE_W_AS_COLOR,    // CHECK_W_AS_COLOR
+  PROFILE_BEST_WHITE,    // the white-only bestActionInGroup()
+  PROFILE_C1_ONLY,       // CHECK_LOW_C1_ONLY / CHECK_HI_C1_ONLY
+  PROFILE_WAS_THEN_C2,   // CHECK_W_AS_C1_THEN_C2_LOW / _HI
+  PROFILE_DIE_BEST,      // SAVE_DIE_BEST / SAVE_DIE_BEST_LOCK (bestActionInGroup())
+  PROFILE_NESTED_PICK,   // the r/y/g/b loops of the nested kernel
+  PROFILE_FACTORED,      // sumOfMaxOverColoredDice()
+  PROFILE_NUM_STAGES,
+  PROFILE_GET_W = PROFILE_NUM_STAGES, // getWforStateOpt() from canTakeMark(), inside the stages
+  PROFILE_NUM_TIMERS
+} ProfileTimer;
+
+static const char *profileTimerNames[PROFILE_NUM_TIMERS] =
+{
+  "CHECK_W_AS_COLOR", "bestActionInGroup (white)", "CHECK_*_C1_ONLY", "CHECK_W_AS_C1_THEN_C2_*",
+  "SAVE_DIE_BEST*", "nested r/y/g/b pick", "sumOfMaxOverColoredDice", "getWforStateOpt"
+};
+
+typedef struct ProfileCounters
+{
+  unsigned long long      cycles[PROFILE_NUM_TIMERS];
+  unsigned long long      calls [PROFILE_NUM_TIMERS];
+  unsigned long long      markCalls;      // canTakeMark()
+  unsigned long long      markLegal;
+  unsigned long long      cacheLookups;   // takeMarkCached()
+  unsigned long long      cacheMisses;    // ... that had to call canTakeMark()
+  struct ProfileCounters *next;
+} ProfileCounters;
+
+static __thread ProfileCounters *profileMine = NULL;
+static ProfileCounters          *profileAll  = NULL; // every thread's counters, kept past the thread's exit
+static pthread_mutex_t           profileMutex = PTHREAD_MUTEX_INITIALIZER;
+static double                    profileLapOverhead = 0.0; // cycles an empty lap takes
+static int                       profileCacheMissFd = -1;
+static int                       profileCacheRefFd  = -1;
+
+static ProfileCounters *profileRegister(void)
+{
+  profileMine = calloc(1, sizeof(ProfileCounters));
+  if (profileMine == NULL)
+  {
+    printf("Error allocating profile counters! Aborting!\n");
+    exit(-1);
+  }
+  pthread_mutex_lock(&profileMutex);
+  profileMine->next = profileAll;
+  profileAll        = profileMine;
+  pthread_mutex_unlock(&profileMutex);
+  return profileMine;
+}
+
+static inline ProfileCounters *profileCounters(void)
+{
+  return profileMine ? profileMine : profileRegister();
+}
+
+// Charge the cycles since start to timer; returns the current time stamp
+static inline unsigned long long profileLap(ProfileTimer timer, unsigned long long start)
+{
+  ProfileCounters   *counters = profileCounters();
+  unsigned long long now      = __rdtsc();
+  counters->cycles[timer] += now - start;
+  counters->calls [timer]++;
+  return now;
+}
+
+static int profileOpenPerfCounter(unsigned long long config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = config;
+  attr.inherit        = 1; // include the threads started later
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void profilePrint(void)
+{
+  ProfileCounters    total;
+  ProfileCounters   *c;
+  unsigned long long stageCycles = 0;
+  int                numThreads  = 0;
+  int                t;
+
+  memset(&total, 0, sizeof(total));
+  pthread_mutex_lock(&profileMutex);
+  for (c = profileAll; c; c = c->next)
+  {
+    for (t = 0; t < PROFILE_NUM_TIMERS; t++)
+    {
+      total.cycles[t] += c->cycles[t];
+      total.calls [t] += c->calls [t];
+    }
+    total.markCalls    += c->markCalls;
+    total.markLegal    += c->markLegal;
+    total.cacheLookups += c->cacheLookups;
+    total.cacheMisses  += c->cacheMisses;
+    numThreads++;
+  }
+  pthread_mutex_unlock(&profileMutex);
+
+  for (t = 0; t < PROFILE_NUM_STAGES; t++)
+  {
+    stageCycles += total.cycles[t];
+  }
+
+  fprintf(stderr, "\nProfile (%d thread%s)\n", numThreads, numThreads == 1 ? "" : "s");
+  fprintf(stderr, "%-28s %15s %18s %12s %7s\n", "stage", "laps", "cycles", "cycles/lap", "share");
+  for (t = 0; t < PROFILE_NUM_TIMERS; t++)
+  {
+    if (t == PROFILE_NUM_STAGES)
+    {
+      fprintf(stderr, "(within the stages above)\n");
+    }
+    fprintf(stderr, "%-28s %15llu %18llu %12.1f %6.1f%%\n", profileTimerNames[t], total.calls[t], total.cycles[t],
+            total.calls[t] ? (double) total.cycles[t] / total.calls[t] : 0.0,
+            stageCycles ? 100.0 * total.cycles[t] / stageCycles : 0.0);
+  }
+  fprintf(stderr, "Every lap includes about %.0f cycles of profiling overhead\n", profileLapOverhead);
+  fprintf(stderr, "canTakeMark: %llu calls, %llu legal (%.1f%%)\n", total.markCalls, total.markLegal,
+          total.markCalls ? 100.0 * total.markLegal / total.markCalls : 0.0);
+  fprintf(stderr, "Successor cache: %llu lookups, %llu computed (%.1f%%)\n", total.cacheLookups, total.cacheMisses,
+          total.cacheLookups ? 100.0 * total.cacheMisses / total.cacheLookups : 0.0);
+
+  if (profileCacheMissFd >= 0 && profileCacheRefFd >= 0)
+  {
+    unsigned long long misses = 0, refs = 0;
+    if (read(profileCacheMissFd, &misses, sizeof(misses)) == sizeof(misses) &&
+        read(profileCacheRefFd,  &refs,   sizeof(refs))   == sizeof(refs))
+    {
+      fprintf(stderr, "Cache references: %llu, misses: %llu (%.1f%%)\n",
+              refs, misses, refs ? 100.0 * misses / refs : 0.0);
+    }
+  }
+  else
+  {
+    fprintf(stderr, "Cache misses: perf_event_open() not available\n");
+  }
+}
+
+__attribute__((constructor)) static void profileInit(void)
+{
+  // Time empty laps, on counters that aren't reported
+  ProfileCounters    calibration;
+  unsigned long long start;
+  int                i;
+
+  memset(&calibration, 0, sizeof(calibration));
+  profileMine = &calibration;
+  start = __rdtsc();
+  for (i = 0; i < 10000; i++)
+  {
+    start = profileLap(PROFILE_W_AS_COLOR, start);
+  }
+  profileLapOverhead = (double) calibration.cycles[PROFILE_W_AS_COLOR] / 10000;
+  profileMine = NULL;
+
+  profileCacheMissFd = profileOpenPerfCounter(PERF_COUNT_HW_CACHE_MISSES);
+  profileCacheRefFd  = profileOpenPerfCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+  atexit(profilePrint);
+}
+
+#define PROFILE_LAP_START()          unsigned long long profileLast = __rdtsc();
+#define PROFILE_LAP(timer)           profileLast = profileLap(timer, profileLast);
+#define PROFILE_TIMER_START(var)     unsigned long long var = __rdtsc();
+#define PROFILE_TIMER_STOP(timer, var) profileLap(timer, var);
+#define PROFILE_MARK(legal)          { ProfileCounters *pc = profileCounters(); pc->markCalls++; pc->markLegal += (legal) != 0; }
+#define PROFILE_CACHE(miss)          { ProfileCounters *pc = profileCounters(); pc->cacheLookups++; pc->cacheMisses += (miss); }
+#else
+#define PROFILE_LAP_START()
+#define PROFILE_LAP(timer)
+#define PROFILE_TIMER_START(var)
+#define PROFILE_TIMER_STOP(timer, var)
+#define PROFILE_MARK(legal)
+#define PROFILE_CACHE(miss)
+#endif
+
 // Returns 1 if it is legal to take a move; 0 otherwise Also returns the W
-// value for that new state. Note that this function is called A LOT.
-inline int canTakeMark(QwixxState *state, int color, int diceVal, int numPenalties,
+// value for that new state. Note that this function is called A LOT, so it
+// works purely on the 0-61 color state indices and the transition tables.
+// With quiet set, the W comes from lookupWforStateOpt() (no I/O, -INFINITY if
+// the table has none) instead of getWforStateOpt(); see canTakeMark() and
+// canTakeMarkQuiet().
+static inline int canTakeMarkW(int color, int diceVal, int numPenalties,
                 int colorStates[],       // the [0-61] color state for each of the 4 colors (INPUT)
+                int quiet,               // (INPUT)
                 // Outputs
                 int   *newStateIx,       // 0-NUM_GAME_STATES-1
                 int    newColorStates[], // The state of each color, [0-61]
                 float *newStateW)        // The expected score corresponding to *newStateIx
 {
-    int retVal = 0;
+    int direction = colorDirection[color];
+    int retVal    = (colorLegalSums[direction][colorStates[color]] >> diceVal) & 1;
+
+    PROFILE_MARK(retVal)
 
-    if (color == RED || color == YELLOW)
-    {
-        retVal = diceVal >       state->color[color].rightMark &&
-                (diceVal < 12 || state->color[color].numMarks >= 5);
-    }
-    else // green or blue
-    {
-        retVal = (diceVal <       state->color[color].rightMark || state->color[color].numMarks == 0) &&
-                 (diceVal >  2 || state->color[color].numMarks >= 5);
-    }
     if (retVal && newStateIx)
     {
-        QwixxState newQstate = *state;
-        newQstate.color[color].rightMark = diceVal;
-        newQstate.color[color].numMarks++;
-        //printf("Calling getWState for color %d diceVal %d\n", color, diceVal);
-
         // Calculate newColorStates[]
         newColorStates[0]     = colorStates[0];
         newColorStates[1]     = colorStates[1];
         newColorStates[2]     = colorStates[2];
         newColorStates[3]     = colorStates[3];
-        newColorStates[color] = colorStateTo62State(&newQstate.color[color]);
+        newColorStates[color] = colorNext62[direction][colorStates[color]][diceVal];
 
         // Shortcut to see if the game is over by seeing if two or more colors
         // are locked. This has to be done before calling getWforStateOpt().
         if ( (int)(newColorStates[0] >= 56) +
              (int)(newColorStates[1] >= 56) +
              (int)(newColorStates[2] >= 56) +
-             (int)(newColorStates[3] >= 56) >= 2)
+             (int)(newColorStates[3] >= 56) >= NUM_LOCKS_TO_END)
         {
-          *newStateW = getScore(&newQstate);
+          *newStateW = getScoreFromIx(newColorStates, numPenalties);
         }
         else
         {
-          *newStateW = getWforStateOpt(&newQstate,
-                                       newColorStates[0],
-                                       newColorStates[1],
-                                       newColorStates[2],
-                                       newColorStates[3],
-                                       NULL); // don't save markov state index output
+          PROFILE_TIMER_START(profileGetW)
+          *newStateW = (quiet ? lookupWforStateOpt : getWforStateOpt)(numPenalties,
+                                                                      newColorStates[0],
+                                                                      newColorStates[1],
+                                                                      newColorStates[2],
+                                                                      newColorStates[3],
+                                                                      NULL); // don't save markov state index output
+          PROFILE_TIMER_STOP(PROFILE_GET_W, profileGetW)
         }
 
-        *newStateIx = numPenalties           * 62*62*62*62 +
-                      newColorStates[RED   ] * 62*62*62    +
-                      newColorStates[YELLOW] * 62*62       +
-                      newColorStates[GREEN ] * 62          +
+        *newStateIx = numPenalties           * ROW_STATES_4   +
+                      newColorStates[RED   ] * ROW_STATES_3   +
+                      newColorStates[YELLOW] * ROW_STATES_2   +
+                      newColorStates[GREEN ] * NUM_ROW_STATES +
                       newColorStates[BLUE  ];
     }
 
     return retVal;
 }
 
+static inline int canTakeMark(int color, int diceVal, int numPenalties, int colorStates[],
+                              int *newStateIx, int newColorStates[], float *newStateW)
+{
+  return canTakeMarkW(color, diceVal, numPenalties, colorStates, 0, newStateIx, newColorStates, newStateW);
+}
+
+// canTakeMark() for qwixx_decide(), which must not print or exit
+static inline int canTakeMarkQuiet(int color, int diceVal, int numPenalties, int colorStates[],
+                                   int *newStateIx, int newColorStates[], float *newStateW)
+{
+  return canTakeMarkW(color, diceVal, numPenalties, colorStates, 1, newStateIx, newColorStates, newStateW);
+}
+
 // Update a QColorState's 'rightMark' and 'numMarks' corresponding to input ix (ix range: 0-61)
 void colorIx2State(int ix, QColorState *color)
 {
-  if (ix == 0)
-  {
-    color->rightMark = 0;
-    color->numMarks  = 0;
-  }
-  else if (ix <= 1)
-  {
-    color->rightMark = 2;
-    color->numMarks  = ix - 0;
-  }
-  else if (ix <= 3)
-  {
-    color->rightMark = 3;
-    color->numMarks  = ix - 1;
-  }
-  else if (ix <= 6)
-  {
-    color->rightMark = 4;
-    color->numMarks  = ix - 3;
-  }
-  else if (ix <= 10)
-  {
-    color->rightMark = 5;
-    color->numMarks  = ix - 6;
-  }
-  else if (ix <= 15)
-  {
-    color->rightMark = 6;
-    color->numMarks  = ix - 10;
-  }
-  else if (ix <= 21)
-  {
-    color->rightMark = 7;
-    color->numMarks  = ix - 15;
-  }
-  else if (ix <= 28)
-  {
-    color->rightMark = 8;
-    color->numMarks  = ix - 21;
-  }
-  else if (ix <= 36)
-  {
-    color->rightMark = 9;
-    color->numMarks  = ix - 28;
-  }
-  else if (ix <= 45)
-  {
-    color->rightMark = 10;
-    color->numMarks  = ix - 36;
-  }
-  else if (ix <= 55)
-  {
-    color->rightMark = 11;
-    color->numMarks  = ix - 45;
-  }
-  else if (ix <= 61)
-  {
-    color->rightMark = 12;       // locked
-    color->numMarks  = ix - 55 + 5;
-  }
+  color->rightMark = color62ToBox  [ix];
+  color->numMarks  = color62ToMarks[ix];
 
-  // Red and yellow count up and are handled correctly above.  If this is green
-  // or blue, then they count down. Adjust rightMark accordingly.
-  if (color->color == GREEN || color->color == BLUE)
+  // The tables count up, which is correct for red and yellow. If this is
+  // green or blue, then they count down. Adjust rightMark accordingly.
+  if (colorDirection[color->color] == DOWN)
   {
     if (color->rightMark > 0)
     {
@@ -330,12 +528,12 @@ void colorIx2State(int ix, QColorState *color)
 // Construct QwixxState from a state index (range 0-NUM_GAME_STATES-1)
 void constructStateFromIx(int ix, QwixxState *state)
 {
-  state->numPenalties = ix / (62*62*62*62);
-  int allColorIx      = ix % (62*62*62*62);
-  int blueIx   =  allColorIx               % 62;
-  int greenIx  = (allColorIx /  62       ) % 62;
-  int yellowIx = (allColorIx / (62*62   )) % 62;
-  int redIx    = (allColorIx / (62*62*62)) % 62;
+  state->numPenalties = ix / ROW_STATES_4;
+  int allColorIx      = ix % ROW_STATES_4;
+  int blueIx   =  allColorIx                   % NUM_ROW_STATES;
+  int greenIx  = (allColorIx / NUM_ROW_STATES) % NUM_ROW_STATES;
+  int yellowIx = (allColorIx / ROW_STATES_2  ) % NUM_ROW_STATES;
+  int redIx    = (allColorIx / ROW_STATES_3  ) % NUM_ROW_STATES;
 
   colorIx2State(redIx   , &state->color[RED   ]);
   colorIx2State(yellowIx, &state->color[YELLOW]);
@@ -346,26 +544,8 @@ void constructStateFromIx(int ix, QwixxState *state)
 // Convert a QColorState to a state index (0-61)
 static inline int colorStateTo62State(QColorState *color)
 {
-  static const int lookupTbl[13][12] =
-    {
-                                   /* Num Marks */
-                       /*   0   1   2   3   4   5   6   7   8   9  10  11  */
-      /* lastMark =  0 */ { 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  1 */ { 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  2 */ { 0,  1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  3 */ { 0,  2,  3,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  4 */ { 0,  4,  5,  6,  0,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  5 */ { 0,  7,  8,  9, 10,  0,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  6 */ { 0, 11, 12, 13, 14, 15,  0,  0,  0,  0,  0,  0 },
-      /* lastMark =  7 */ { 0, 16, 17, 18, 19, 20, 21,  0,  0,  0,  0,  0 },
-      /* lastMark =  8 */ { 0, 22, 23, 24, 25, 26, 27, 28,  0,  0,  0,  0 },
-      /* lastMark =  9 */ { 0, 29, 30, 31, 32, 33, 34, 35, 36,  0,  0,  0 },
-      /* lastMark = 10 */ { 0, 37, 38, 39, 40, 41, 42, 43, 44, 45,  0,  0 },
-      /* lastMark = 11 */ { 0, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55,  0 },
-      /* lastMark = 12 */ { 0,  0,  0,  0,  0,  0, 56, 57, 58, 59, 60, 61 } };
-
   int rightMark = color->rightMark;
-  if (color->color == GREEN || color->color == BLUE)
+  if (colorDirection[color->color] == DOWN)
   {
     if (rightMark > 0)
     {
@@ -373,13 +553,73 @@ static inline int colorStateTo62State(QColorState *color)
     }
   }
 
-  return lookupTbl[rightMark][color->numMarks];
+  return boxMarksTo62[rightMark][color->numMarks];
 }
 
 static void initLookupTables()
 {
-  // Form c1c2ToCombined and c12c34ToCombined
-  int c1, c2, c12, c34, c1234;
+  // Form c1c2ToCombined
+  int c1, c2, c12;
+  int ix, box, marks, sum, direction;
+
+  for (ix = 0; ix <= 12; ix++)
+  {
+    if (rowScores[ix] < 0 || rowScores[ix] > ROW_MAX_POINTS)
+    {
+      printf("ROW_SCORES must be between 0 and ROW_MAX_POINTS (%d)! Exiting!\n", ROW_MAX_POINTS);
+      exit(-1);
+    }
+  }
+
+  // Enumerate the 62 single color states in the order described at the top of
+  // this file, counting boxes UP. The last box can only be marked after
+  // LOCK_MIN_MARKS marks, and marking it locks the row (1 bonus mark).
+  memset(boxMarksTo62, 0, sizeof(boxMarksTo62));
+  color62ToBox  [0] = 0;
+  color62ToMarks[0] = 0;
+  ix = 1;
+  for (box = 2; box <= 12; box++)
+  {
+    for (marks = 1; marks < box; marks++)
+    {
+      if (box == 12 && marks <= LOCK_MIN_MARKS)
+      {
+        continue;
+      }
+      color62ToBox  [ix]         = box;
+      color62ToMarks[ix]         = marks;
+      boxMarksTo62  [box][marks] = ix;
+      ix++;
+    }
+  }
+  for (ix = 0; ix < NUM_ROW_STATES; ix++)
+  {
+    color62Points[ix] = rowScores[color62ToMarks[ix] + (color62ToBox[ix] == 12 ? 1 : 0)];
+  }
+  for (ix = FIRST_LOCKED_ROW_STATE + 1; ix < NUM_ROW_STATES; ix++)
+  {
+    clippedStateOffset[ix - FIRST_LOCKED_ROW_STATE - 1] = color62Points[ix] - color62Points[FIRST_LOCKED_ROW_STATE];
+  }
+
+  // Marking (UP) box 'sum' is legal if it is to the right of the last mark, and
+  // it isn't the last box of a row that doesn't have enough marks yet.
+  memset(colorNext62,    -1, sizeof(colorNext62));
+  memset(colorLegalSums,  0, sizeof(colorLegalSums));
+  for (ix = 0; ix < NUM_ROW_STATES; ix++)
+  {
+    for (sum = 2; sum <= 12; sum++)
+    {
+      if (sum > color62ToBox[ix] && (sum < 12 || color62ToMarks[ix] >= LOCK_MIN_MARKS))
+      {
+        for (direction = UP; direction <= DOWN; direction++)
+        {
+          int diceSum = (direction == UP) ? sum : 14 - sum;
+          colorNext62   [direction][ix][diceSum] = boxMarksTo62[sum][color62ToMarks[ix] + 1];
+          colorLegalSums[direction][ix]         |= 1 << diceSum;
+        }
+      }
+    }
+  }
 
   memset(c1c2ToCombined, 0, sizeof(c1c2ToCombined));
   memset(dualToC1,       0, sizeof(dualToC1));
@@ -395,21 +635,6 @@ static void initLookupTables()
       c12++;
     }
   }
-
-  memset(c12c34ToCombined, 0, sizeof(c12c34ToCombined));
-  memset(quadToC12,        0, sizeof(quadToC12));
-  memset(quadToC34,        0, sizeof(quadToC34));
-  c1234 = 0;
-  for (c12 = 0; c12 < NUM_DUAL_COLOR_STATES; c12++)
-  {
-    for (c34 = c12; c34 < NUM_DUAL_COLOR_STATES; c34++)
-    {
-      c12c34ToCombined[c12][c34] = c1234;
-      quadToC12[c1234]           = c12;
-      quadToC34[c1234]           = c34;
-      c1234++;
-    }
-  }
 }
 
 // Convert ALREADY CLIPPED values to a state index (output range 0..NUM_MARKOV_STATES-1)
@@ -419,7 +644,7 @@ static inline int convertClipped5tupleToIx(int redIx, int yellowIx, int greenIx,
 
   int ry, gb, rygb;
 
-  if (numPenalties >= 4)
+  if (numPenalties >= NUM_PENALTIES_TO_END)
   {
     retVal = NUM_MARKOV_STATES - 1;
   }
@@ -446,7 +671,7 @@ static inline int convertClipped5tupleToIx(int redIx, int yellowIx, int greenIx,
       SWAP_INT(ry, gb);
     }
 
-    rygb = c12c34ToCombined[ry][gb];
+    rygb = c12c34ToCombined(ry, gb);
 
     //printf("convert5tupleToIx(%d,%d,%d,%d,%d) --> ry %d, gb %d, rygb %d\n",
     //   redIx, yellowIx, greenIx, blueIx, numPenalties, ry, gb, rygb);
@@ -460,7 +685,7 @@ static inline int convertClipped5tupleToIx(int redIx, int yellowIx, int greenIx,
 static inline int isGameOver(QwixxState *state)
 {
   int retVal = 0;
-  if (state->numPenalties >= 4)
+  if (state->numPenalties >= NUM_PENALTIES_TO_END)
   {
     retVal = 1;
   }
@@ -471,7 +696,7 @@ static inline int isGameOver(QwixxState *state)
     numLocked += (state->color[YELLOW].rightMark == 12) ? 1 : 0;
     numLocked += (state->color[GREEN ].rightMark ==  2) ? 1 : 0;
     numLocked += (state->color[BLUE  ].rightMark ==  2) ? 1 : 0;
-    if (numLocked >= 2)
+    if (numLocked >= NUM_LOCKS_TO_END)
     {
       retVal = 1;
     }
@@ -483,7 +708,6 @@ static inline int isGameOver(QwixxState *state)
 static inline int getColorScore(QColorState *color)
 {
   // Index by number of marks. Add 1 for "lock" bonus
-  int scores[] = {0,1,3,6,10,15,21,28,36,45,55,66,78};
   int isLocked = 0;
   if (color->color == RED || color->color == YELLOW)
   {
@@ -494,7 +718,7 @@ static inline int getColorScore(QColorState *color)
     isLocked = (color->rightMark ==  2) ? 1 : 0;
   }
 
-  return scores[isLocked + color->numMarks];
+  return rowScores[isLocked + color->numMarks];
 }
 
 static inline int getScore(QwixxState *state)
@@ -502,7 +726,7 @@ static inline int getScore(QwixxState *state)
   int score = 0;
 
   // -5 points per penalty
-  score -= 5 * state->numPenalties;
+  score -= PENALTY_POINTS * state->numPenalties;
   score += getColorScore(&state->color[RED   ]);
   score += getColorScore(&state->color[YELLOW]);
   score += getColorScore(&state->color[GREEN ]);
@@ -511,11 +735,34 @@ static inline int getScore(QwixxState *state)
   return score;
 }
 
+// Same as getScore(), for a state given as 0-61 color state indices
+static inline int getScoreFromIx(int colorStates[], int numPenalties)
+{
+  return color62Points[colorStates[RED   ]] +
+         color62Points[colorStates[YELLOW]] +
+         color62Points[colorStates[GREEN ]] +
+         color62Points[colorStates[BLUE  ]] - PENALTY_POINTS * numPenalties;
+}
+
+// Same as isGameOver(), for a state given as 0-61 (or clipped 0-56) color
+// state indices
+static inline int isGameOverIx(int colorStates[], int numPenalties)
+{
+  return numPenalties >= NUM_PENALTIES_TO_END ||
+         (int)(colorStates[RED   ] >= 56) +
+         (int)(colorStates[YELLOW] >= 56) +
+         (int)(colorStates[GREEN ] >= 56) +
+         (int)(colorStates[BLUE  ] >= 56) >= NUM_LOCKS_TO_END;
+}
+
 // Optimized function for getWforState. There are 2 critical assumptions that
 // must be met before using this optimized version of the function.
-// 1. The "62 index" values must be consistent with the "state" parameter.
+// 1. numPenalties must be less than 4.
 // 2. The state must not correspond to a "game over" state
-static inline float getWforStateOpt(QwixxState *state, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx)
+// It does no checks and no I/O: a state the table has no W for (one a cut
+// short run never got to) comes back as -INFINITY. getWforStateOpt() is the
+// checked version.
+static inline float lookupWforStateOpt(int numPenalties, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx)
 {
   float retVal     = 0.0;
   int ix           = 0;
@@ -524,7 +771,6 @@ static inline float getWforStateOpt(QwixxState *state, int r62ix, int y62ix, int
   int yClipped     = 0;
   int gClipped     = 0;
   int bClipped     = 0;
-  int warning      = 0;
   int valIsClipped = 0;
 
 #define CLIP_CHECK(colorIx, cClipped, valIsClipped)  \
@@ -543,40 +789,51 @@ static inline float getWforStateOpt(QwixxState *state, int r62ix, int y62ix, int
   CLIP_CHECK(g62ix, gClipped, valIsClipped)
   CLIP_CHECK(b62ix, bClipped, valIsClipped)
 
-  // The following array helps account that state 56 is equivalent to states
-  // 57-61, except for the number of points that has been earned by the state.
-
-  // 62stateIx =                  57,   58,   59,   60,   61
-  static const float offset[] = {8.0, 17.0, 27.0, 38.0, 50.0};
-
-  ix = convertClipped5tupleToIx(rClipped, yClipped, gClipped, bClipped, state->numPenalties);
+  ix = convertClipped5tupleToIx(rClipped, yClipped, gClipped, bClipped, numPenalties);
+  if (markovIx)
+  {
+    *markovIx = ix;
+  }
 
-  retVal = Wvec[ix];
-  if (retVal == WVEC_END_OF_GAME)
+  if (WvecFixed)
   {
-    printf("WARNING!\n");
-    warning = 1;
+    // The future points of a clipped state are the same as for the actual
+    // state (that is what the offsets below account for), so adding them to
+    // the actual state's score gives its W directly.
+    int score = color62Points[r62ix] + color62Points[y62ix] +
+                color62Points[g62ix] + color62Points[b62ix] - PENALTY_POINTS * numPenalties;
+    if (WvecFixed[ix] == WVEC_FIXED16_END_OF_GAME)
+    {
+      return -INFINITY;
+    }
+    return (float) score + (float) WvecFixed[ix] * (1.0f / WVEC_FIXED16_SCALE);
   }
 
+  retVal = Wvec[ix];
+
   // Account for the fact that 56 undershoots some states
   if (valIsClipped)
   {
     retVal +=
-       ((r62ix > rClipped ) ? offset[r62ix - rClipped - 1] : 0.0f) +
-       ((y62ix > yClipped ) ? offset[y62ix - yClipped - 1] : 0.0f) +
-       ((g62ix > gClipped ) ? offset[g62ix - gClipped - 1] : 0.0f) +
-       ((b62ix > bClipped ) ? offset[b62ix - bClipped - 1] : 0.0f);
+       ((r62ix > rClipped ) ? clippedStateOffset[r62ix - rClipped - 1] : 0.0f) +
+       ((y62ix > yClipped ) ? clippedStateOffset[y62ix - yClipped - 1] : 0.0f) +
+       ((g62ix > gClipped ) ? clippedStateOffset[g62ix - gClipped - 1] : 0.0f) +
+       ((b62ix > bClipped ) ? clippedStateOffset[b62ix - bClipped - 1] : 0.0f);
   }
 
-  if (warning)
+  return retVal;
+}
+
+// lookupWforStateOpt() for generate and the checker, which must never need a
+// state that has no W yet
+static inline float getWforStateOpt(int numPenalties, int r62ix, int y62ix, int g62ix, int b62ix, int *markovIx)
+{
+  float retVal = lookupWforStateOpt(numPenalties, r62ix, y62ix, g62ix, b62ix, markovIx);
+
+  if (retVal == -INFINITY)
   {
-    printf("State %d [%d R:%d/%d(%d) Y:%d/%d(%d) G:%d/%d(%d) B:%d/%d(%d)], Wvec %.1f\n",
-           ix, state->numPenalties,
-           state->color[0].numMarks, state->color[0].rightMark, r62ix,
-           state->color[1].numMarks, state->color[1].rightMark, y62ix,
-           state->color[2].numMarks, state->color[2].rightMark, g62ix,
-           state->color[3].numMarks, state->color[3].rightMark, b62ix,
-           retVal);
+    printf("WARNING!\nState [%d R:%d Y:%d G:%d B:%d] has no W\n",
+           numPenalties, r62ix, y62ix, g62ix, b62ix);
     exit(-1);
   }
 
@@ -589,17 +846,26 @@ static inline float getWforStateOpt(QwixxState *state, int r62ix, int y62ix, int
 // reduced from NUM_GAME_STATES down to NUM_MARKOV_STATES states.
 static float getWforState(QwixxState *state, int *markovIx)
 {
-  float retVal     = 0.0;
-  int   redIx      = 0;
-  int   yellowIx   = 0;
-  int   greenIx    = 0;
-  int   blueIx     = 0;
+  int colorStates[NUM_COLORS];
+
+  colorStates[RED   ] = colorStateTo62State(&state->color[RED   ]);
+  colorStates[YELLOW] = colorStateTo62State(&state->color[YELLOW]);
+  colorStates[GREEN ] = colorStateTo62State(&state->color[GREEN ]);
+  colorStates[BLUE  ] = colorStateTo62State(&state->color[BLUE  ]);
+
+  return getWforIx(colorStates, state->numPenalties, markovIx);
+}
+
+// Same as getWforState(), for a state given as 0-61 color state indices
+static inline float getWforIx(int colorStates[], int numPenalties, int *markovIx)
+{
+  float retVal = 0.0;
 
   // Wvec[] is invalid for a "game over" state since a single "game over" state
   // can correspond to many actual scores.
-  if (isGameOver(state))
+  if (isGameOverIx(colorStates, numPenalties))
   {
-    retVal = (float) getScore(state);
+    retVal = (float) getScoreFromIx(colorStates, numPenalties);
     if (markovIx)
     {
       *markovIx = NUM_MARKOV_STATES - 1;
@@ -607,260 +873,488 @@ static float getWforState(QwixxState *state, int *markovIx)
   }
   else
   {
-    redIx    = colorStateTo62State(&state->color[RED   ]);
-    yellowIx = colorStateTo62State(&state->color[YELLOW]);
-    greenIx  = colorStateTo62State(&state->color[GREEN ]);
-    blueIx   = colorStateTo62State(&state->color[BLUE  ]);
-
-    retVal   = getWforStateOpt(state, redIx, yellowIx, greenIx, blueIx, markovIx);
+    retVal = getWforStateOpt(numPenalties,
+                             colorStates[RED   ],
+                             colorStates[YELLOW],
+                             colorStates[GREEN ],
+                             colorStates[BLUE  ],
+                             markovIx);
   }
 
   return retVal;
 }
 
-// Pick the best action out of the iStart...iStop possibilities
-inline int pickBestAction(double rewards[], int iStart, int iStop, int iBestBeforeStart)
+// Reward of an action that can't be taken with the current dice. It is lower
+// than any real reward, so it also serves as the legality mask: an illegal
+// action can never be picked over a legal one.
+#define ACTION_ILLEGAL (-1e9f)
+
+// The actions come in groups of 5: one action that doesn't use the white sum
+// as a color (PENALTY, or a colored die only), followed by its 4 "white as
+// color" versions. The rewards are floats (every reward is a float W value or
+// score), so the 4 "white as" rewards of a group are one 4-wide vector.
+typedef float ActionLanes    __attribute__((vector_size(4 * sizeof(float))));
+typedef int   ActionLaneMask __attribute__((vector_size(4 * sizeof(int))));
+
+// Lane by lane max(a, b)
+#define MAX_ACTION_LANES(a, b) \
+  ((ActionLanes) (((ActionLaneMask) (a) & ((b) <= (a))) | ((ActionLaneMask) (b) & ((b) > (a)))))
+
+// Pick the best action out of the 5 actions of the group starting at
+// iGroupStart. Ties go to the first action, the same as checking the actions
+// one by one and only switching to a strictly better one.
+static inline int bestActionInGroup(float rewards[], int iGroupStart)
+{
+  const ActionLaneMask laneBit = {1, 2, 4, 8};
+  ActionLanes    wasRewards, maxRewards, other;
+  ActionLaneMask isMax;
+
+  memcpy(&wasRewards, &rewards[iGroupStart + 1], sizeof(wasRewards));
+
+  // Every lane ends up holding the max of the 4 lanes
+  other      = __builtin_shuffle(wasRewards, (ActionLaneMask) {2, 3, 0, 1});
+  maxRewards = MAX_ACTION_LANES(wasRewards, other);
+  other      = __builtin_shuffle(maxRewards, (ActionLaneMask) {1, 0, 3, 2});
+  maxRewards = MAX_ACTION_LANES(maxRewards, other);
+
+  if (! (maxRewards[0] > rewards[iGroupStart]))
+  {
+    return iGroupStart;
+  }
+
+  // Argmax: the first lane that holds the max
+  isMax  = (wasRewards == maxRewards) & laneBit;
+  isMax |= __builtin_shuffle(isMax, (ActionLaneMask) {2, 3, 0, 1});
+  isMax |= __builtin_shuffle(isMax, (ActionLaneMask) {1, 0, 3, 2});
+
+  return iGroupStart + 1 + __builtin_ctz(isMax[0]);
+}
+
+// Pick the best action out of the iStart...iStop possibilities, one by one.
+// Only the reference kernel still uses this.
+static inline int pickBestAction(float rewards[], int iStart, int iStop, int iBestBeforeStart)
 {
-  int    bestIdx    = iBestBeforeStart;
-  double bestReward = rewards[iBestBeforeStart];
-  int    loopIdx;
+  int   bestIdx    = iBestBeforeStart;
+  float bestReward = rewards[iBestBeforeStart];
+  int   loopIdx;
 
   for (loopIdx = iStart; loopIdx <= iStop; loopIdx++)
   {
     if (rewards[loopIdx] > bestReward)
     {
       bestReward = rewards[loopIdx];
-      bestIdx = loopIdx;
+      bestIdx    = loopIdx;
     }
   }
 
   return bestIdx;
 }
 
-// This is the main function that calculates the W vector. It takes a very long time.
-// NOTE:
-//
-// If pState is NULL, this loops over all states to populate the W vector. In
-// this case, the dice roll values are ignored.
-//
-// If pState is non-NULL, the dice rolls are used to calculate the optimal move
-// according to W vector. pState is updated to the optimal selection.
-static void analyzeState(QwixxState *pState,
-                         int num_iterations,
-                         int w1_roll, int w2_roll, int r_roll, int y_roll, int g_roll, int b_roll,
-                         int print_actions)
+// Lazily filled cache of canTakeMark() results for the successors of one
+// Markov state. The dice loops of analyzeMarkovState() check the same
+// (color, dice sum) marks over and over, and each canTakeMark() call has to
+// rebuild a QwixxState and look up its W value. With the cache, each mark is
+// only evaluated once per Markov state and the rest are plain array reads.
+#define SUCCESSOR_UNKNOWN 0
+#define SUCCESSOR_ILLEGAL 1
+#define SUCCESSOR_LEGAL   2
+
+typedef struct
 {
-  int          p                = 0;  // shortcut for number of penalties
-  int          s                = 0;  // markov state loop index
-  int          RYGB[NUM_COLORS] = {0};
-  int          game_state       = 0;
+  // Marking color [c] with dice sum [sum]
+  char  singleStatus  [NUM_COLORS][13];
+  // Marking the white sum [w] as color [c1], and then color [c2] with dice sum [sum]
+  char  afterWasStatus[13][NUM_COLORS][NUM_COLORS][13];
+
+  // canTakeMark() outputs, only valid when the status is SUCCESSOR_LEGAL
+  float singleW       [NUM_COLORS][13];
+  int   singleIx      [NUM_COLORS][13];
+  float afterWasW     [13][NUM_COLORS][NUM_COLORS][13];
+  int   afterWasIx    [13][NUM_COLORS][NUM_COLORS][13];
+} SuccessorCache;
+
+// Forget everything; must be called at the start of each Markov state
+static inline void clearSuccessorCache(SuccessorCache *cache)
+{
+  memset(cache->singleStatus,   SUCCESSOR_UNKNOWN, sizeof(cache->singleStatus));
+  memset(cache->afterWasStatus, SUCCESSOR_UNKNOWN, sizeof(cache->afterWasStatus));
+}
 
-  int s1 = 0; // Looping indices (start index)
-  int s2 = 0; //                 (stop  index)
+// Same as canTakeMark() (without the newColorStates output), but only calls
+// it if the status of this cache entry is still unknown.
+static inline int takeMarkCached(char *status, float *cachedW, int *cachedIx,
+                                 int color, int diceVal, int numPenalties,
+                                 int colorStates[], int *newStateIx, float *newStateW)
+{
+  PROFILE_CACHE(*status == SUCCESSOR_UNKNOWN)
+  if (*status == SUCCESSOR_UNKNOWN)
+  {
+    int newColorStates[NUM_COLORS];
+    *status = canTakeMark(color, diceVal, numPenalties, colorStates,
+                          cachedIx, newColorStates, cachedW) ? SUCCESSOR_LEGAL : SUCCESSOR_ILLEGAL;
+  }
 
-  int do_one_state = (pState != NULL);
+  if (*status == SUCCESSOR_LEGAL)
+  {
+    *newStateIx = *cachedIx;
+    *newStateW  = *cachedW;
+    return 1;
+  }
 
-  // Probability of each 6-dice throw (each die has 6 possible outcomes)
-  const double inv6_to6 = 1.0 / (6*6*6*6*6*6);
+  return 0;
+}
 
-  QwixxState state;
-  memset(&state, 0, sizeof(state));
+// Cached canTakeMark() calls used by the CHECK_* macros in analyzeMarkovState()
+#define TAKE_MARK(COLOR, diceVal)                                                              \
+  takeMarkCached(&successors.singleStatus[COLOR][diceVal],                                     \
+                 &successors.singleW     [COLOR][diceVal],                                     \
+                 &successors.singleIx    [COLOR][diceVal],                                     \
+                 COLOR, diceVal, p, RYGB, &newStateIx, &newStateW)
+
+#define TAKE_MARK_AFTER_WAS(COLOR1, COLOR2, diceVal)                                           \
+  takeMarkCached(&successors.afterWasStatus[w][COLOR1][COLOR2][diceVal],                       \
+                 &successors.afterWasW     [w][COLOR1][COLOR2][diceVal],                       \
+                 &successors.afterWasIx    [w][COLOR1][COLOR2][diceVal],                       \
+                 COLOR2, diceVal, p, newTmpColStateTookWas##COLOR1,                            \
+                 &newStateIx, &newStateW)
+
+// Ways of calculating the expected value of a Markov state in generate mode.
+// The nested and factored kernels both start from the best action for each
+// face of each colored die; the reference kernel is the original loop that
+// checks and picks from all the actions again for every roll, and doesn't
+// share any of that.
+typedef enum
+{
+  KERNEL_NESTED,    // Loop over all 6^4 rolls of the colored dice, using the per-face best actions
+  KERNEL_FACTORED,  // Use sumOfMaxOverColoredDice() for the colored dice
+  KERNEL_CHECK,     // Run all three, keep the reference result and track the differences
+  KERNEL_REFERENCE  // Check every action for every roll of the 6 dice (slow)
+} GenerateKernel;
+
+static GenerateKernel generateKernel = KERNEL_NESTED;
+
+// Largest differences from the reference kernel seen in KERNEL_CHECK mode,
+// [0] for the nested kernel and [1] for the factored one
+static pthread_mutex_t kernelCheckMutex   = PTHREAD_MUTEX_INITIALIZER;
+static double          kernelCheckMaxDiff     [2] = {0.0, 0.0};
+static int             kernelCheckMaxDiffState[2] = {-1, -1};
+
+// Track the differences between the kernels for Markov state s
+static void recordKernelCheckDiff(int s, double referenceW, double nestedW, double factoredW)
+{
+  double diff[2];
+  int    k;
 
-  if (pState == NULL)
+  diff[0] = fabs(nestedW   - referenceW);
+  diff[1] = fabs(factoredW - referenceW);
+  pthread_mutex_lock(&kernelCheckMutex);
+  for (k = 0; k < 2; k++)
   {
-    initialize_qwixx_state(&state);
+    if (diff[k] > kernelCheckMaxDiff[k] || kernelCheckMaxDiffState[k] < 0)
+    {
+      kernelCheckMaxDiff     [k] = diff[k];
+      kernelCheckMaxDiffState[k] = s;
+    }
+  }
+  pthread_mutex_unlock(&kernelCheckMutex);
+}
 
-    s1 = NUM_MARKOV_STATES - 1;
-    s2 = 0;
+// Print what KERNEL_CHECK found, with prefix in front of each line
+static void printKernelCheck(const char *prefix)
+{
+  printf("%sMax difference between the nested and reference kernels:   %g (state %d)\n",
+         prefix, kernelCheckMaxDiff[0], kernelCheckMaxDiffState[0]);
+  printf("%sMax difference between the factored and reference kernels: %g (state %d)\n",
+         prefix, kernelCheckMaxDiff[1], kernelCheckMaxDiffState[1]);
+}
 
-    // Allow the main loop to be cut short if num_iterations is > 0
-    if (num_iterations > 0)
+// Returns the sum over all 6^4 rolls of the colored dice of
+//   max(whiteBest, dieBest[RED][r-1], dieBest[YELLOW][y-1], dieBest[GREEN][g-1], dieBest[BLUE][b-1])
+// which is what the nested r/y/g/b loops in analyzeMarkovState() add up.
+//
+// For a fixed white pair, every action that uses a colored die only depends
+// on that one die, so dieBest[c][d-1] is the best action value when colored
+// die c shows d. Since the dice are independent, the number of rolls whose
+// max is <= v is the product over the dice of the number of faces that are
+// <= v. Walking through the sorted die values from low to high then gives
+// the sum without looking at each of the 1296 rolls.
+static double sumOfMaxOverColoredDice(double whiteBest, double dieBest[NUM_COLORS][6])
+{
+  double sorted[NUM_COLORS][6];
+  int    numAtOrBelow[NUM_COLORS]; // number of faces of each die <= the current max
+  int    numRolls;                 // number of rolls whose max is <= the current max
+  int    c, i, j;
+  double sum;
+
+  // Sort each die's values (insertion sort; there are only 6 of them)
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    for (i = 0; i < 6; i++)
     {
-      s2 = NUM_MARKOV_STATES - num_iterations;
-      if (s2 < 0)
+      double val = dieBest[c][i];
+      for (j = i; j > 0 && sorted[c][j-1] > val; j--)
       {
-        s2 = 0;
+        sorted[c][j] = sorted[c][j-1];
       }
+      sorted[c][j] = val;
     }
   }
-  else
-  {
-    // Only run through the loop once. Fetch appropriate Markov state index for
-    // loop bounds.
-    getWforState(pState, &s1);
-    s2 = s1;
 
-#define CHECK_RANGE(d)                                                         \
-    if (d < 1 || d > 6)                                                        \
-    {                                                                          \
-      printf("Invalid dice value passed to analyzeState (%d)! Exiting!\n", d); \
-      exit(-1);                                                                \
+  // Every roll where no colored die beats whiteBest is worth whiteBest
+  numRolls = 1;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    numAtOrBelow[c] = 0;
+    while (numAtOrBelow[c] < 6 && sorted[c][numAtOrBelow[c]] <= whiteBest)
+    {
+      numAtOrBelow[c]++;
     }
-    CHECK_RANGE(w1_roll);
-    CHECK_RANGE(w2_roll);
-    CHECK_RANGE(r_roll);
-    CHECK_RANGE(y_roll);
-    CHECK_RANGE(g_roll);
-    CHECK_RANGE(b_roll);
+    numRolls *= numAtOrBelow[c];
   }
+  sum = whiteBest * numRolls;
 
-  // Loop through the states backwards. Each loop only looks at state indices
-  // >= this current s, so it only works when looping backward.
-  for (s = s1; s >= s2; s--)
+  // Step the max up through the remaining die values
+  while (numRolls < 6*6*6*6)
   {
-    int numPenalties = s / NUM_FOUR_COLOR_STATES; // integer division
-    int rygbState    = s % NUM_FOUR_COLOR_STATES;
+    double nextMax  = 0.0;
+    int    haveNext = 0;
+    int    numRollsAtOrBelowNext = 1;
 
-    if (do_one_state)
+    for (c = 0; c < NUM_COLORS; c++)
     {
-      if (isGameOver(pState))
+      if (numAtOrBelow[c] < 6 && (! haveNext || sorted[c][numAtOrBelow[c]] < nextMax))
       {
-        printf("Cannot analyze this state because the game is over.\n");
-        break;
+        nextMax  = sorted[c][numAtOrBelow[c]];
+        haveNext = 1;
       }
     }
-
-    if (numPenalties >= 4)
+    for (c = 0; c < NUM_COLORS; c++)
     {
-      // Set Wvec[s] to invalid because you can't actually count a score for
-      // "end of game" Wvec states.
-      Wvec[s] = WVEC_END_OF_GAME;
+      while (numAtOrBelow[c] < 6 && sorted[c][numAtOrBelow[c]] <= nextMax)
+      {
+        numAtOrBelow[c]++;
+      }
+      numRollsAtOrBelowNext *= numAtOrBelow[c];
     }
-    else
-    {
-      int ry = quadToC12[rygbState];
-      int gb = quadToC34[rygbState];
 
-      RYGB[0] = dualToC1[ry];
-      RYGB[1] = dualToC2[ry];
-      RYGB[2] = dualToC1[gb];
-      RYGB[3] = dualToC2[gb];
+    sum     += nextMax * (numRollsAtOrBelowNext - numRolls);
+    numRolls = numRollsAtOrBelowNext;
+  }
 
-      state.numPenalties = numPenalties;
-      colorIx2State(RYGB[0], &state.color[RED   ]);
-      colorIx2State(RYGB[1], &state.color[YELLOW]);
-      colorIx2State(RYGB[2], &state.color[GREEN ]);
-      colorIx2State(RYGB[3], &state.color[BLUE  ]);
+  return sum;
+}
 
-      if (do_one_state)
-      {
-        // Override state with pState contents
-        memcpy(&state, pState, sizeof(state));
+// Best actions of one Markov state for each of the 21 white pairs (w1 <= w2),
+// recorded by analyzeMarkovState() for --compare-decisions. For a roll, the
+// chosen action is the white-only one, unless a colored die's best action
+// beats it: the first die (in red, yellow, green, blue order) with a reward
+// strictly higher than everything before it, and at least as high as the
+// dice after it.
+typedef struct
+{
+  int   whiteAction  [21];
+  float whiteReward  [21];
+  int   dieBestAction[21][NUM_COLORS][6];
+  float dieBestReward[21][NUM_COLORS][6];
+} StateDecisions;
+
+// Analyze a single Markov state. This is the body of the main analyzeState()
+// loop, pulled out on its own so that the worker threads of the
+// multi-threaded generate mode can call it directly.
+//
+// If pState is NULL, this calculates Wvec[s] from the Wvec[] values of its
+// successor states, which must already be calculated. In this case, the dice
+// roll values are ignored.
+//
+// If pState is non-NULL, s must be the Markov state index of *pState. The dice
+// rolls are used to calculate the optimal move according to W vector. pState
+// is updated to the optimal selection.
+//
+// If decisions is non-NULL (and pState is NULL), the best actions for all the
+// rolls are recorded in *decisions instead, and Wvec[] is left alone. s must
+// not be an "end of game" state in this case.
+static void analyzeMarkovState(QwixxState *pState,
+                               int s,
+                               int w1_roll, int w2_roll, int r_roll, int y_roll, int g_roll, int b_roll,
+                               int print_actions,
+                               StateDecisions *decisions)
+{
+  int          p                = 0;  // shortcut for number of penalties
+  int          RYGB[NUM_COLORS] = {0};
+  int          game_state       = 0;
 
-        // In the do_one_state version, these are the 0-61 state indices while
-        // in the multi-state version of this function they are the 0-56
-        // states. The functions called by this function support both types of
-        // states.
-        RYGB[0] = colorStateTo62State(&state.color[RED   ]);
-        RYGB[1] = colorStateTo62State(&state.color[YELLOW]);
-        RYGB[2] = colorStateTo62State(&state.color[GREEN ]);
-        RYGB[3] = colorStateTo62State(&state.color[BLUE  ]);
-        numPenalties = state.numPenalties;
+  int do_one_state = (pState != NULL);
 
-        // Calculate state in range 0...NUM_GAME_STATES-1
-        game_state = numPenalties * 62*62*62*62 +
-                     RYGB[0]      * 62*62*62    +
-                     RYGB[1]      * 62*62       +
-                     RYGB[2]      * 62          +
-                     RYGB[3];
-      }
+  // Probability of each 6-dice throw (each die has 6 possible outcomes)
+  const double inv6_to6 = 1.0 / (6*6*6*6*6*6);
+
+  int numPenalties = s / NUM_FOUR_COLOR_STATES; // integer division
+  int rygbState    = s % NUM_FOUR_COLOR_STATES;
+
+  if (do_one_state)
+  {
+    if (isGameOver(pState))
+    {
+      printf("Cannot analyze this state because the game is over.\n");
+      return;
+    }
+  }
+
+  if (numPenalties >= NUM_PENALTIES_TO_END)
+  {
+    // Set Wvec[s] to invalid because you can't actually count a score for
+    // "end of game" Wvec states.
+    Wvec[s] = WVEC_END_OF_GAME;
+  }
+  else
+  {
+    int ry, gb;
+
+    quadToC12C34(rygbState, &ry, &gb);
+    RYGB[0] = dualToC1[ry];
+    RYGB[1] = dualToC2[ry];
+    RYGB[2] = dualToC1[gb];
+    RYGB[3] = dualToC2[gb];
+
+    if (do_one_state)
+    {
+      // Override the state with pState contents. From here on, the state is
+      // only handled as 0-61 color state indices.
+      //
+      // In the do_one_state version, these are the 0-61 state indices while
+      // in the multi-state version of this function they are the 0-56
+      // states. The functions called by this function support both types of
+      // states.
+      RYGB[0] = colorStateTo62State(&pState->color[RED   ]);
+      RYGB[1] = colorStateTo62State(&pState->color[YELLOW]);
+      RYGB[2] = colorStateTo62State(&pState->color[GREEN ]);
+      RYGB[3] = colorStateTo62State(&pState->color[BLUE  ]);
+      numPenalties = pState->numPenalties;
+
+      // Calculate state in range 0...NUM_GAME_STATES-1
+      game_state = numPenalties * ROW_STATES_4   +
+                   RYGB[0]      * ROW_STATES_3   +
+                   RYGB[1]      * ROW_STATES_2   +
+                   RYGB[2]      * NUM_ROW_STATES +
+                   RYGB[3];
+    }
 
-      // Shortcut for number of penalties
-      p = numPenalties;
+    // Shortcut for number of penalties
+    p = numPenalties;
 
-      if (isGameOver(&state))
+    if (isGameOverIx(RYGB, p))
+    {
+      // Set Wvec[s] to invalid because you can't actually count a score for
+      // "end of game" Wvec states.
+      Wvec[s] = WVEC_END_OF_GAME;
+    }
+    else
+    {
+      // Roll the dice (two white dice, red, yellow, green, blue)
+      int w1, w2, r, y, g, b;
+      int i;
+      float    actionReward[NUM_ACTIONS];
+      int    stateForAction[NUM_ACTIONS];
+      double theWnext = 0.0;
+      double theWnextFactored = 0.0;
+      double theWnextReference = 0.0;
+
+      // In generate mode, the kernel(s) picked by generateKernel calculate
+      // the expected value. Picking actions for a single roll always uses the
+      // nested loops.
+      int generating         = ! do_one_state && ! decisions;
+      int useNestedKernel    = do_one_state || (generating && (generateKernel == KERNEL_NESTED   ||
+                                                               generateKernel == KERNEL_CHECK));
+      int useFactoredKernel  = generating && (generateKernel == KERNEL_FACTORED || generateKernel == KERNEL_CHECK);
+      int useReferenceKernel = generating && (generateKernel == KERNEL_REFERENCE || generateKernel == KERNEL_CHECK);
+      int pair              = 0; // white pair index, when recording decisions
+
+      // "Was" means "White as"
+      int        newTmpColStateTookWasRED   [NUM_COLORS];
+      int        newTmpColStateTookWasYELLOW[NUM_COLORS];
+      int        newTmpColStateTookWasGREEN [NUM_COLORS];
+      int        newTmpColStateTookWasBLUE  [NUM_COLORS];
+      int        canTakeWasRED    = 0;
+      int        canTakeWasYELLOW = 0;
+      int        canTakeWasGREEN  = 0;
+      int        canTakeWasBLUE   = 0;
+      int        bestChoice       = 0;
+      SuccessorCache successors;
+
+      memset(stateForAction, 0, sizeof(stateForAction));
+      for (i = 0; i < NUM_ACTIONS; i++)
       {
-        // Set Wvec[s] to invalid because you can't actually count a score for
-        // "end of game" Wvec states.
-        Wvec[s] = WVEC_END_OF_GAME;
+        actionReward[i] = ACTION_ILLEGAL;
       }
-      else
-      {
-        // Roll the dice (two white dice, red, yellow, green, blue)
-        int w1, w2, r, y, g, b;
-        double   actionReward[NUM_ACTIONS];
-        int    stateForAction[NUM_ACTIONS];
-        int    newColorStates[NUM_COLORS];
-        double theWnext = 0.0;
-
-        // "Was" means "White as"
-        QwixxState newTmpStateTookWasRED;
-        QwixxState newTmpStateTookWasYELLOW;
-        QwixxState newTmpStateTookWasGREEN;
-        QwixxState newTmpStateTookWasBLUE;
-        int        newTmpColStateTookWasRED   [NUM_COLORS];
-        int        newTmpColStateTookWasYELLOW[NUM_COLORS];
-        int        newTmpColStateTookWasGREEN [NUM_COLORS];
-        int        newTmpColStateTookWasBLUE  [NUM_COLORS];
-        int        canTakeWasRED    = 0;
-        int        canTakeWasYELLOW = 0;
-        int        canTakeWasGREEN  = 0;
-        int        canTakeWasBLUE   = 0;
-        int        bestChoice       = 0;
-
-        memset(stateForAction, 0, sizeof(stateForAction));
-
-        // Use a macro to create w1_min, w1_max, ..., b_min, b_max
+      clearSuccessorCache(&successors);
+
+      // Use a macro to create w1_min, w1_max, ..., b_min, b_max
 #define DECLARE_LOOP_MIN_MAX(COLOR)                           \
-        int COLOR##_min = (do_one_state) ? COLOR##_roll : 1;  \
-        int COLOR##_max = (do_one_state) ? COLOR##_roll : 6;
-        DECLARE_LOOP_MIN_MAX(w1)
-        DECLARE_LOOP_MIN_MAX(w2)
-        DECLARE_LOOP_MIN_MAX(r)
-        DECLARE_LOOP_MIN_MAX(y)
-        DECLARE_LOOP_MIN_MAX(g)
-        DECLARE_LOOP_MIN_MAX(b)
-
-        QwixxState stateWithAddtlPenalty = state;
-        stateWithAddtlPenalty.numPenalties++;
-        actionReward  [PENALTY] = getWforState(&stateWithAddtlPenalty, NULL);
-        stateForAction[PENALTY] = game_state + 62*62*62*62;
-
-        for (w1 = w1_min; w1 <= w1_max; w1++)
+      int COLOR##_min = (do_one_state) ? COLOR##_roll : 1;    \
+      int COLOR##_max = (do_one_state) ? COLOR##_roll : 6;
+      DECLARE_LOOP_MIN_MAX(w1)
+      DECLARE_LOOP_MIN_MAX(w2)
+      DECLARE_LOOP_MIN_MAX(r)
+      DECLARE_LOOP_MIN_MAX(y)
+      DECLARE_LOOP_MIN_MAX(g)
+      DECLARE_LOOP_MIN_MAX(b)
+
+      actionReward  [PENALTY] = getWforIx(RYGB, p + 1, NULL);
+      stateForAction[PENALTY] = game_state + ROW_STATES_4;
+
+      for (w1 = w1_min; w1 <= w1_max; w1++)
+      {
+        // Optimization: w2 is always >= w1 (when doing multiple states)
+        if (do_one_state == 0)
         {
-          // Optimization: w2 is always >= w1 (when doing multiple states)
-          if (do_one_state == 0)
-          {
-            w2_min = w1;
-          }
+          w2_min = w1;
+        }
 
-          for (w2 = w2_min; w2 <= w2_max; w2++)
+        for (w2 = w2_min; w2 <= w2_max; w2++)
+        {
+          int w = w1 + w2;
+          // count some cases twice due to w2 looping limits optimizations
+          double pScale = (w1 == w2) ? inv6_to6 : (2*inv6_to6);
+          int newStateIx = 0;
+          float newStateW = 0.0f;
+          int d;
+
+          // Best action (and its reward) for each face of each colored die.
+          // Every action other than the white-only ones uses exactly one
+          // colored die, so this only has to be worked out once per face
+          // instead of once per roll of all 4 colored dice.
+          int   dieBestAction[NUM_COLORS][6];
+          float dieBestReward[NUM_COLORS][6];
+
+          if (do_one_state)
           {
-            int w = w1 + w2;
-            // count some cases twice due to w2 looping limits optimizations
-            double pScale = (w1 == w2) ? inv6_to6 : (2*inv6_to6);
-            int newStateIx = 0;
-            float newStateW = 0.0f;
+            pScale = 1.0; // only evaluating 1 possible dice throw combination
+          }
 
-            if (do_one_state)
-            {
-              pScale = 1.0; // only evaluating 1 possible dice throw combination
-            }
+          PROFILE_LAP_START()
 
 // This macro checks to see if you can take the sum of the two white dice as
 // one of the colors. This is the first choice a Qwixx player must evaluate.
 #define CHECK_W_AS_COLOR(COLORUPPER)                                                                                            \
-            actionReward[WHITE_AS_##COLORUPPER] = -1e9;                                                                         \
-            canTakeWas##COLORUPPER = 0;                                                                                         \
-            if (canTakeMark(&state, COLORUPPER, w, p, RYGB, &newStateIx, newTmpColStateTookWas##COLORUPPER, &newStateW))        \
-            {                                                                                                                   \
-              actionReward  [WHITE_AS_##COLORUPPER] = newStateW;                                                                \
-              stateForAction[WHITE_AS_##COLORUPPER] = newStateIx;                                                               \
-              newTmpStateTookWas##COLORUPPER = state;                                                                           \
-              colorIx2State(newTmpColStateTookWas##COLORUPPER[COLORUPPER], &newTmpStateTookWas##COLORUPPER.color[COLORUPPER]);  \
-              canTakeWas##COLORUPPER = ! isGameOver(&newTmpStateTookWas##COLORUPPER);                                           \
-            }
+          actionReward[WHITE_AS_##COLORUPPER] = ACTION_ILLEGAL;                                                                 \
+          canTakeWas##COLORUPPER = 0;                                                                                           \
+          if (canTakeMark(COLORUPPER, w, p, RYGB, &newStateIx, newTmpColStateTookWas##COLORUPPER, &newStateW))                  \
+          {                                                                                                                     \
+            actionReward  [WHITE_AS_##COLORUPPER] = newStateW;                                                                  \
+            stateForAction[WHITE_AS_##COLORUPPER] = newStateIx;                                                                 \
+            canTakeWas##COLORUPPER = ! isGameOverIx(newTmpColStateTookWas##COLORUPPER, p);                                      \
+          }                                                                                                                     \
+          PROFILE_LAP(PROFILE_W_AS_COLOR)
+
+          CHECK_W_AS_COLOR(RED)
+          CHECK_W_AS_COLOR(YELLOW)
+          CHECK_W_AS_COLOR(GREEN)
+          CHECK_W_AS_COLOR(BLUE)
+
+          // Evaluate the best option that has been calculated so far
+          int bestThruWhiteOnly = bestActionInGroup(actionReward, PENALTY);
+          PROFILE_LAP(PROFILE_BEST_WHITE)
 
-            CHECK_W_AS_COLOR(RED)
-            CHECK_W_AS_COLOR(YELLOW)
-            CHECK_W_AS_COLOR(GREEN)
-            CHECK_W_AS_COLOR(BLUE)
-
-            // Evaluate the best option that has been calculated so far
-            int bestThruWhiteOnly = pickBestAction(actionReward, WHITE_AS_RED, WHITE_AS_BLUE, PENALTY);
-
-            for (r = r_min; r <= r_max; r++)
-            {
 // CHECK_LOW_C1_ONLY:
 // This macro checks to see if you can take the lower of (w1,w2) (which is
 // always w1) plus a colored die as that color. This is denoted as "Choice 1"
@@ -871,17 +1365,18 @@ static void analyzeState(QwixxState *pState,
 // - LOW_GREEN_ONLY
 // - LOW_BLUE_ONLY
 #define CHECK_LOW_C1_ONLY(COLOR1UPPER, colorDiceVal)                                                                         \
-              actionReward[LOW_##COLOR1UPPER##_ONLY] = -1e9;                                                                 \
-              if (canTakeMark(&state, COLOR1UPPER, w1+colorDiceVal, p, RYGB, &newStateIx, newColorStates, &newStateW))       \
-              {                                                                                                              \
-                actionReward  [LOW_##COLOR1UPPER##_ONLY] = newStateW;                                                        \
-                stateForAction[LOW_##COLOR1UPPER##_ONLY] = newStateIx;                                                       \
-              }                                                                                                              \
-              else if (canTakeMark(&state, COLOR1UPPER, w2+colorDiceVal, p, RYGB, &newStateIx, newColorStates, &newStateW))  \
-              {                                                                                                              \
-                actionReward  [LOW_##COLOR1UPPER##_ONLY] = newStateW;                                                        \
-                stateForAction[LOW_##COLOR1UPPER##_ONLY] = newStateIx;                                                       \
-              }
+            actionReward[LOW_##COLOR1UPPER##_ONLY] = ACTION_ILLEGAL;                                                         \
+            if (TAKE_MARK(COLOR1UPPER, w1+colorDiceVal))                                                                     \
+            {                                                                                                                \
+              actionReward  [LOW_##COLOR1UPPER##_ONLY] = newStateW;                                                          \
+              stateForAction[LOW_##COLOR1UPPER##_ONLY] = newStateIx;                                                         \
+            }                                                                                                                \
+            else if (TAKE_MARK(COLOR1UPPER, w2+colorDiceVal))                                                                \
+            {                                                                                                                \
+              actionReward  [LOW_##COLOR1UPPER##_ONLY] = newStateW;                                                          \
+              stateForAction[LOW_##COLOR1UPPER##_ONLY] = newStateIx;                                                         \
+            }                                                                                                                \
+            PROFILE_LAP(PROFILE_C1_ONLY)
 
 // CHECK_HI_C1_ONLY:
 // Same as CHECK_LOW_C1_ONLY, except it evaluates w2+colorDiceVal first and
@@ -891,17 +1386,18 @@ static void analyzeState(QwixxState *pState,
 // - HI_GREEN_ONLY
 // - HI_BLUE_ONLY
 #define CHECK_HI_C1_ONLY(COLOR1UPPER, colorDiceVal)                                                                          \
-              actionReward[HI_##COLOR1UPPER##_ONLY] = -1e9;                                                                  \
-              if (canTakeMark(&state, COLOR1UPPER, w2+colorDiceVal, p, RYGB, &newStateIx, newColorStates, &newStateW))       \
-              {                                                                                                              \
-                actionReward  [HI_##COLOR1UPPER##_ONLY] = newStateW;                                                         \
-                stateForAction[HI_##COLOR1UPPER##_ONLY] = newStateIx;                                                        \
-              }                                                                                                              \
-              else if (canTakeMark(&state, COLOR1UPPER, w1+colorDiceVal, p, RYGB, &newStateIx, newColorStates, &newStateW))  \
-              {                                                                                                              \
-                actionReward  [HI_##COLOR1UPPER##_ONLY] = newStateW;                                                         \
-                stateForAction[HI_##COLOR1UPPER##_ONLY] = newStateIx;                                                        \
-              }
+            actionReward[HI_##COLOR1UPPER##_ONLY] = ACTION_ILLEGAL;                                                          \
+            if (TAKE_MARK(COLOR1UPPER, w2+colorDiceVal))                                                                     \
+            {                                                                                                                \
+              actionReward  [HI_##COLOR1UPPER##_ONLY] = newStateW;                                                           \
+              stateForAction[HI_##COLOR1UPPER##_ONLY] = newStateIx;                                                          \
+            }                                                                                                                \
+            else if (TAKE_MARK(COLOR1UPPER, w1+colorDiceVal))                                                                \
+            {                                                                                                                \
+              actionReward  [HI_##COLOR1UPPER##_ONLY] = newStateW;                                                           \
+              stateForAction[HI_##COLOR1UPPER##_ONLY] = newStateIx;                                                          \
+            }                                                                                                                \
+            PROFILE_LAP(PROFILE_C1_ONLY)
 
 // CHECK_W_AS_C1_THEN_C2_LOW:
 // This macro checks to see if you can take Choice 1 (C1) (two whites marked as
@@ -914,22 +1410,21 @@ static void analyzeState(QwixxState *pState,
 // - WHITE_AS_GREEN_THEN_LOW_RED , WHITE_AS_GREEN_THEN_LOW_YELLOW , WHITE_AS_GREEN_THEN_LOW_GREEN , WHITE_AS_GREEN_THEN_LOW_BLUE
 // - WHITE_AS_BLUE_THEN_LOW_RED  , WHITE_AS_BLUE_THEN_LOW_YELLOW  , WHITE_AS_BLUE_THEN_LOW_GREEN  , WHITE_AS_BLUE_THEN_LOW_BLUE
 #define CHECK_W_AS_C1_THEN_C2_LOW(COLOR1UPPER, COLOR2UPPER, colorDiceVal)                                                    \
-              actionReward[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = -1e9;                                          \
-              if (canTakeWas##COLOR1UPPER)                                                                                   \
+            actionReward[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = ACTION_ILLEGAL;                                  \
+            if (canTakeWas##COLOR1UPPER)                                                                                     \
+            {                                                                                                                \
+              if (TAKE_MARK_AFTER_WAS(COLOR1UPPER, COLOR2UPPER, w1+colorDiceVal))                                            \
               {                                                                                                              \
-                if (canTakeMark(&newTmpStateTookWas##COLOR1UPPER, COLOR2UPPER, w1+colorDiceVal, p,                           \
-                    newTmpColStateTookWas##COLOR1UPPER, &newStateIx, newColorStates, &newStateW))                            \
-                {                                                                                                            \
-                  actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateW;                               \
-                  stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateIx;                              \
-                }                                                                                                            \
-                else if (canTakeMark(&newTmpStateTookWas##COLOR1UPPER, COLOR2UPPER, w2+colorDiceVal, p,                      \
-                    newTmpColStateTookWas##COLOR1UPPER, &newStateIx, newColorStates, &newStateW))                            \
-                {                                                                                                            \
-                  actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateW;                               \
-                  stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateIx;                              \
-                }                                                                                                            \
-              }
+                actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateW;                                 \
+                stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateIx;                                \
+              }                                                                                                              \
+              else if (TAKE_MARK_AFTER_WAS(COLOR1UPPER, COLOR2UPPER, w2+colorDiceVal))                                       \
+              {                                                                                                              \
+                actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateW;                                 \
+                stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_LOW_##COLOR2UPPER] = newStateIx;                                \
+              }                                                                                                              \
+            }                                                                                                                \
+            PROFILE_LAP(PROFILE_WAS_THEN_C2)
 
 // CHECK_W_AS_C1_THEN_C2_HI:
 // Same as CHECK_W_AS_C1_THEN_C2_LOW, except it evaluates w2+colorDiceVal first
@@ -939,242 +1434,4795 @@ static void analyzeState(QwixxState *pState,
 // - WHITE_AS_GREEN_THEN_HI_RED , WHITE_AS_GREEN_THEN_HI_YELLOW , WHITE_AS_GREEN_THEN_HI_GREEN , WHITE_AS_GREEN_THEN_HI_BLUE
 // - WHITE_AS_BLUE_THEN_HI_RED  , WHITE_AS_BLUE_THEN_HI_YELLOW  , WHITE_AS_BLUE_THEN_HI_GREEN  , WHITE_AS_BLUE_THEN_HI_BLUE
 #define CHECK_W_AS_C1_THEN_C2_HI(COLOR1UPPER, COLOR2UPPER, colorDiceVal)                                                     \
-              actionReward[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = -1e9;                                           \
-              if (canTakeWas##COLOR1UPPER)                                                                                   \
+            actionReward[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = ACTION_ILLEGAL;                                   \
+            if (canTakeWas##COLOR1UPPER)                                                                                     \
+            {                                                                                                                \
+              if (TAKE_MARK_AFTER_WAS(COLOR1UPPER, COLOR2UPPER, w2+colorDiceVal))                                            \
+              {                                                                                                              \
+                actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateW;                                  \
+                stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateIx;                                 \
+              }                                                                                                              \
+              else if (TAKE_MARK_AFTER_WAS(COLOR1UPPER, COLOR2UPPER, w1+colorDiceVal))                                       \
+              {                                                                                                              \
+                actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateW;                                  \
+                stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateIx;                                 \
+              }                                                                                                              \
+            }                                                                                                                \
+            PROFILE_LAP(PROFILE_WAS_THEN_C2)
+
+// Record the best action of the group starting at GROUP_START for face d of
+// the COLOR die. If LOCK_GROUP_START is checked too (the other order of the
+// white dice, when it might lock the color), the first group wins ties.
+#define SAVE_DIE_BEST(COLOR, GROUP_START)                                                                                    \
+            dieBestAction[COLOR][d-1] = bestActionInGroup(actionReward, GROUP_START);                                        \
+            dieBestReward[COLOR][d-1] = actionReward[dieBestAction[COLOR][d-1]];                                             \
+            PROFILE_LAP(PROFILE_DIE_BEST)
+
+#define SAVE_DIE_BEST_LOCK(COLOR, LOCK_GROUP_START)                                                                          \
+            {                                                                                                                \
+              int lockBest = bestActionInGroup(actionReward, LOCK_GROUP_START);                                              \
+              if (actionReward[lockBest] > dieBestReward[COLOR][d-1])                                                        \
               {                                                                                                              \
-                if (canTakeMark(&newTmpStateTookWas##COLOR1UPPER, COLOR2UPPER, w2+colorDiceVal, p,                           \
-                    newTmpColStateTookWas##COLOR1UPPER, &newStateIx, newColorStates, &newStateW))                            \
-                {                                                                                                            \
-                  actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateW;                                \
-                  stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateIx;                               \
-                }                                                                                                            \
-                else if (canTakeMark(&newTmpStateTookWas##COLOR1UPPER, COLOR2UPPER, w1+colorDiceVal, p,                      \
-                    newTmpColStateTookWas##COLOR1UPPER, &newStateIx, newColorStates, &newStateW))                            \
-                {                                                                                                            \
-                  actionReward  [WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateW;                                \
-                  stateForAction[WHITE_AS_##COLOR1UPPER##_THEN_HI_##COLOR2UPPER] = newStateIx;                               \
-                }                                                                                                            \
+                dieBestAction[COLOR][d-1] = lockBest;                                                                        \
+                dieBestReward[COLOR][d-1] = actionReward[lockBest];                                                          \
+              }                                                                                                              \
+            }                                                                                                                \
+            PROFILE_LAP(PROFILE_DIE_BEST)
+
+          for (d = r_min; d <= r_max; d++)
+          {
+            // Evaluate all the options that just include the white dice and the red die
+            CHECK_LOW_C1_ONLY(RED, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(RED   , RED, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, RED, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(GREEN , RED, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , RED, d)
+            SAVE_DIE_BEST(RED, LOW_RED_ONLY)
+
+            // If it is possible to lock red, then check the high options, too
+            if (d == 6 && w2 == 6)
+            {
+              CHECK_HI_C1_ONLY(RED, d);
+              CHECK_W_AS_C1_THEN_C2_HI(RED   , RED, d)
+              CHECK_W_AS_C1_THEN_C2_HI(YELLOW, RED, d)
+              CHECK_W_AS_C1_THEN_C2_HI(GREEN , RED, d)
+              CHECK_W_AS_C1_THEN_C2_HI(BLUE  , RED, d)
+              SAVE_DIE_BEST_LOCK(RED, HI_RED_ONLY)
+            }
+          }
+
+          for (d = y_min; d <= y_max; d++)
+          {
+            // Evaluate all the options that just include the white dice and the yellow die
+            CHECK_LOW_C1_ONLY(YELLOW, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(RED   , YELLOW, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, YELLOW, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(GREEN , YELLOW, d)
+            CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , YELLOW, d)
+            SAVE_DIE_BEST(YELLOW, LOW_YELLOW_ONLY)
+
+            // If it is possible to lock yellow, then check the high options, too
+            if (d == 6 && w2 == 6)
+            {
+              CHECK_HI_C1_ONLY(YELLOW, d);
+              CHECK_W_AS_C1_THEN_C2_HI(RED   , YELLOW, d)
+              CHECK_W_AS_C1_THEN_C2_HI(YELLOW, YELLOW, d)
+              CHECK_W_AS_C1_THEN_C2_HI(GREEN , YELLOW, d)
+              CHECK_W_AS_C1_THEN_C2_HI(BLUE  , YELLOW, d)
+              SAVE_DIE_BEST_LOCK(YELLOW, HI_YELLOW_ONLY)
+            }
+          }
+
+          for (d = g_min; d <= g_max; d++)
+          {
+            // Evaluate all the options that just include the white dice and the green die
+            CHECK_HI_C1_ONLY(GREEN, d)
+            CHECK_W_AS_C1_THEN_C2_HI(RED   , GREEN, d)
+            CHECK_W_AS_C1_THEN_C2_HI(YELLOW, GREEN, d)
+            CHECK_W_AS_C1_THEN_C2_HI(GREEN , GREEN, d)
+            CHECK_W_AS_C1_THEN_C2_HI(BLUE  , GREEN, d)
+            SAVE_DIE_BEST(GREEN, HI_GREEN_ONLY)
+
+            // If it is possible to lock green, then check the low green, too
+            if (d == 1 && w1 == 1)
+            {
+              CHECK_LOW_C1_ONLY(GREEN, d);
+              CHECK_W_AS_C1_THEN_C2_LOW(RED   , GREEN, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, GREEN, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(GREEN , GREEN, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , GREEN, d)
+              SAVE_DIE_BEST_LOCK(GREEN, LOW_GREEN_ONLY)
+            }
+          }
+
+          for (d = b_min; d <= b_max; d++)
+          {
+            // Evaluate all the options that just include the white dice and the blue die
+            CHECK_HI_C1_ONLY(BLUE, d)
+            CHECK_W_AS_C1_THEN_C2_HI(RED   , BLUE, d)
+            CHECK_W_AS_C1_THEN_C2_HI(YELLOW, BLUE, d)
+            CHECK_W_AS_C1_THEN_C2_HI(GREEN , BLUE, d)
+            CHECK_W_AS_C1_THEN_C2_HI(BLUE  , BLUE, d)
+            SAVE_DIE_BEST(BLUE, HI_BLUE_ONLY)
+
+            // If it is possible to lock blue, then check the low blue, too
+            if (d == 1 && w1 == 1)
+            {
+              CHECK_LOW_C1_ONLY(BLUE, d);
+              CHECK_W_AS_C1_THEN_C2_LOW(RED   , BLUE, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, BLUE, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(GREEN , BLUE, d)
+              CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , BLUE, d)
+              SAVE_DIE_BEST_LOCK(BLUE, LOW_BLUE_ONLY)
+            }
+          }
+
+          if (useNestedKernel)
+          {
+            // Walk through all the rolls of the colored dice. The best action
+            // through each die is the same as picking from all of that die's
+            // actions: the die's best action replaces the best one so far
+            // only if its reward is strictly higher.
+            float bestThruWhiteOnlyW = actionReward[bestThruWhiteOnly];
+
+#define PICK_DIE_BEST(COLOR, face, bestThruBefore, bestThruBeforeW, bestThru, bestThruW)                                     \
+            int   bestThru  = bestThruBefore;                                                                                \
+            float bestThruW = bestThruBeforeW;                                                                               \
+            if (dieBestReward[COLOR][face-1] > bestThruW)                                                                    \
+            {                                                                                                                \
+              bestThru  = dieBestAction[COLOR][face-1];                                                                      \
+              bestThruW = dieBestReward[COLOR][face-1];                                                                      \
+            }
+
+            for (r = r_min; r <= r_max; r++)
+            {
+              PICK_DIE_BEST(RED, r, bestThruWhiteOnly, bestThruWhiteOnlyW, bestThruRed, bestThruRedW)
+
+              for (y = y_min; y <= y_max; y++)
+              {
+                PICK_DIE_BEST(YELLOW, y, bestThruRed, bestThruRedW, bestThruYellow, bestThruYellowW)
+
+                for (g = g_min; g <= g_max; g++)
+                {
+                  PICK_DIE_BEST(GREEN, g, bestThruYellow, bestThruYellowW, bestThruGreen, bestThruGreenW)
+
+                  for (b = b_min; b <= b_max; b++)
+                  {
+                    // Note that since this is the inner-most loop, this is
+                    // where a vast majority of the program's time is spent.
+                    PICK_DIE_BEST(BLUE, b, bestThruGreen, bestThruGreenW, bestThruBlue, bestThruBlueW)
+
+                    theWnext += bestThruBlueW * pScale;
+
+                    bestChoice = bestThruBlue;
+                  } // b
+                } //g
+              } // y
+            } // r
+            PROFILE_LAP(PROFILE_NESTED_PICK)
+          } // end if useNestedKernel
+
+          // Factored version of the r/y/g/b loops (see sumOfMaxOverColoredDice())
+          if (useFactoredKernel)
+          {
+            double dieBest[NUM_COLORS][6];
+            int    c;
+
+            for (c = 0; c < NUM_COLORS; c++)
+            {
+              for (d = 0; d < 6; d++)
+              {
+                dieBest[c][d] = dieBestReward[c][d];
               }
+            }
+
+            theWnextFactored += sumOfMaxOverColoredDice(actionReward[bestThruWhiteOnly], dieBest) * pScale;
+            PROFILE_LAP(PROFILE_FACTORED)
+          } // end if useFactoredKernel
 
-              // Evaluate all the options that just include the white dice and the red die
+          // Reference version of the r/y/g/b loops: every action is checked
+          // again for every roll and the best one is picked one action at a
+          // time, without the per-face tables above. The checks overwrite
+          // actionReward[] (all but the white-only actions, which stay as
+          // they are), which nothing reads after this.
+          if (useReferenceKernel)
+          {
+            int refThruWhiteOnly = pickBestAction(actionReward, WHITE_AS_RED, WHITE_AS_BLUE, PENALTY);
+
+            for (r = r_min; r <= r_max; r++)
+            {
               CHECK_LOW_C1_ONLY(RED, r)
               CHECK_W_AS_C1_THEN_C2_LOW(RED   , RED, r)
               CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, RED, r)
               CHECK_W_AS_C1_THEN_C2_LOW(GREEN , RED, r)
               CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , RED, r)
-
-              int bestThruRed = pickBestAction(actionReward,
-                          LOW_RED_ONLY, WHITE_AS_BLUE_THEN_LOW_RED, bestThruWhiteOnly);
+              int refThruRed = pickBestAction(actionReward, LOW_RED_ONLY, WHITE_AS_BLUE_THEN_LOW_RED, refThruWhiteOnly);
 
               // If it is possible to lock red, then check the high options, too
               if (r == 6 && w2 == 6)
               {
-                CHECK_HI_C1_ONLY(RED, r);
+                CHECK_HI_C1_ONLY(RED, r)
                 CHECK_W_AS_C1_THEN_C2_HI(RED   , RED, r)
                 CHECK_W_AS_C1_THEN_C2_HI(YELLOW, RED, r)
                 CHECK_W_AS_C1_THEN_C2_HI(GREEN , RED, r)
                 CHECK_W_AS_C1_THEN_C2_HI(BLUE  , RED, r)
-                bestThruRed = pickBestAction(actionReward,
-                          HI_RED_ONLY, WHITE_AS_BLUE_THEN_HI_RED, bestThruRed);
+                refThruRed = pickBestAction(actionReward, HI_RED_ONLY, WHITE_AS_BLUE_THEN_HI_RED, refThruRed);
               }
 
               for (y = y_min; y <= y_max; y++)
               {
-                // Evaluate all the options that just include the white dice and the yellow die
                 CHECK_LOW_C1_ONLY(YELLOW, y)
                 CHECK_W_AS_C1_THEN_C2_LOW(RED   , YELLOW, y)
                 CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, YELLOW, y)
                 CHECK_W_AS_C1_THEN_C2_LOW(GREEN , YELLOW, y)
                 CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , YELLOW, y)
+                int refThruYellow = pickBestAction(actionReward, LOW_YELLOW_ONLY, WHITE_AS_BLUE_THEN_LOW_YELLOW, refThruRed);
 
-                int bestThruYellow = pickBestAction(actionReward,
-                            LOW_YELLOW_ONLY, WHITE_AS_BLUE_THEN_LOW_YELLOW, bestThruRed);
-
-                // If it is possible to lock yellow, then check the high options, too
                 if (y == 6 && w2 == 6)
                 {
-                  CHECK_HI_C1_ONLY(YELLOW, y);
+                  CHECK_HI_C1_ONLY(YELLOW, y)
                   CHECK_W_AS_C1_THEN_C2_HI(RED   , YELLOW, y)
                   CHECK_W_AS_C1_THEN_C2_HI(YELLOW, YELLOW, y)
                   CHECK_W_AS_C1_THEN_C2_HI(GREEN , YELLOW, y)
                   CHECK_W_AS_C1_THEN_C2_HI(BLUE  , YELLOW, y)
-                  bestThruYellow = pickBestAction(actionReward,
-                            HI_YELLOW_ONLY, WHITE_AS_BLUE_THEN_HI_YELLOW, bestThruYellow);
+                  refThruYellow = pickBestAction(actionReward, HI_YELLOW_ONLY, WHITE_AS_BLUE_THEN_HI_YELLOW, refThruYellow);
                 }
 
                 for (g = g_min; g <= g_max; g++)
                 {
-                  // Evaluate all the options that just include the white dice and the green die
                   CHECK_HI_C1_ONLY(GREEN, g)
                   CHECK_W_AS_C1_THEN_C2_HI(RED   , GREEN, g)
                   CHECK_W_AS_C1_THEN_C2_HI(YELLOW, GREEN, g)
                   CHECK_W_AS_C1_THEN_C2_HI(GREEN , GREEN, g)
                   CHECK_W_AS_C1_THEN_C2_HI(BLUE  , GREEN, g)
+                  int refThruGreen = pickBestAction(actionReward, HI_GREEN_ONLY, WHITE_AS_BLUE_THEN_HI_GREEN, refThruYellow);
 
-                  int bestThruGreen = pickBestAction(actionReward,
-                              HI_GREEN_ONLY, WHITE_AS_BLUE_THEN_HI_GREEN, bestThruYellow);
-
-                  // If it is possible to lock green, then check the low green, too
                   if (g == 1 && w1 == 1)
                   {
-                    CHECK_LOW_C1_ONLY(GREEN, g);
+                    CHECK_LOW_C1_ONLY(GREEN, g)
                     CHECK_W_AS_C1_THEN_C2_LOW(RED   , GREEN, g)
                     CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, GREEN, g)
                     CHECK_W_AS_C1_THEN_C2_LOW(GREEN , GREEN, g)
                     CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , GREEN, g)
-                    bestThruGreen = pickBestAction(actionReward,
-                              LOW_GREEN_ONLY, WHITE_AS_BLUE_THEN_LOW_GREEN, bestThruGreen);
+                    refThruGreen = pickBestAction(actionReward, LOW_GREEN_ONLY, WHITE_AS_BLUE_THEN_LOW_GREEN, refThruGreen);
                   }
 
-                  for (b = b_min; b <= b_max; b++)
-                  {
-                    // Evaluate all the options that just include the white dice and the blue die
+                  for (b = b_min; b <= b_max; b++)
+                  {
+                    CHECK_HI_C1_ONLY(BLUE, b)
+                    CHECK_W_AS_C1_THEN_C2_HI(RED   , BLUE, b)
+                    CHECK_W_AS_C1_THEN_C2_HI(YELLOW, BLUE, b)
+                    CHECK_W_AS_C1_THEN_C2_HI(GREEN , BLUE, b)
+                    CHECK_W_AS_C1_THEN_C2_HI(BLUE  , BLUE, b)
+                    int refThruBlue = pickBestAction(actionReward, HI_BLUE_ONLY, WHITE_AS_BLUE_THEN_HI_BLUE, refThruGreen);
+
+                    if (b == 1 && w1 == 1)
+                    {
+                      CHECK_LOW_C1_ONLY(BLUE, b)
+                      CHECK_W_AS_C1_THEN_C2_LOW(RED   , BLUE, b)
+                      CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, BLUE, b)
+                      CHECK_W_AS_C1_THEN_C2_LOW(GREEN , BLUE, b)
+                      CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , BLUE, b)
+                      refThruBlue = pickBestAction(actionReward, LOW_BLUE_ONLY, WHITE_AS_BLUE_THEN_LOW_BLUE, refThruBlue);
+                    }
+
+                    theWnextReference += actionReward[refThruBlue] * pScale;
+                  } // b
+                } // g
+              } // y
+            } // r
+          } // end if useReferenceKernel
+
+          if (decisions)
+          {
+            decisions->whiteAction[pair] = bestThruWhiteOnly;
+            decisions->whiteReward[pair] = actionReward[bestThruWhiteOnly];
+            memcpy(decisions->dieBestAction[pair], dieBestAction, sizeof(dieBestAction));
+            memcpy(decisions->dieBestReward[pair], dieBestReward, sizeof(dieBestReward));
+            pair++;
+          }
+        } // w2
+      } // w1
+
+      if (generateKernel == KERNEL_CHECK && generating)
+      {
+        recordKernelCheckDiff(s, theWnextReference, theWnext, theWnextFactored);
+      }
+
+      if ( do_one_state )
+      {
+        // Update the state according to the best choice
+        constructStateFromIx(stateForAction[bestChoice], pState);
+
+        if ( print_actions )
+        {
+          printf("Before the dice, your expected score was %.3f\n", getWforIx(RYGB, p, NULL));
+          printf("After  the dice, your expected score is  %.3f, if you take choice %d\n",
+                        actionReward[bestChoice], bestChoice);
+          printf("Here are the expected scores for all choices:\n");
+          printf("  00 - PENALTY:                          %.3f\n", actionReward[ 0]);
+          printf("  01 - WHITE_AS_RED:                     %.3f\n", actionReward[ 1]);
+          printf("  02 - WHITE_AS_YELLOW:                  %.3f\n", actionReward[ 2]);
+          printf("  03 - WHITE_AS_GREEN:                   %.3f\n", actionReward[ 3]);
+          printf("  04 - WHITE_AS_BLUE:                    %.3f\n", actionReward[ 4]);
+          printf("  05 - LOW_RED_ONLY:                     %.3f\n", actionReward[ 5]);
+          printf("  06 - WHITE_AS_RED_THEN_LOW_RED:        %.3f\n", actionReward[ 6]);
+          printf("  07 - WHITE_AS_YELLOW_THEN_LOW_RED:     %.3f\n", actionReward[ 7]);
+          printf("  08 - WHITE_AS_GREEN_THEN_LOW_RED:      %.3f\n", actionReward[ 8]);
+          printf("  09 - WHITE_AS_BLUE_THEN_LOW_RED:       %.3f\n", actionReward[ 9]);
+          printf("  10 - LOW_YELLOW_ONLY:                  %.3f\n", actionReward[10]);
+          printf("  11 - WHITE_AS_RED_THEN_LOW_YELLOW:     %.3f\n", actionReward[11]);
+          printf("  12 - WHITE_AS_YELLOW_THEN_LOW_YELLOW:  %.3f\n", actionReward[12]);
+          printf("  13 - WHITE_AS_GREEN_THEN_LOW_YELLOW:   %.3f\n", actionReward[13]);
+          printf("  14 - WHITE_AS_BLUE_THEN_LOW_YELLOW:    %.3f\n", actionReward[14]);
+          printf("  15 - HI_GREEN_ONLY:                    %.3f\n", actionReward[15]);
+          printf("  16 - WHITE_AS_RED_THEN_HI_GREEN:       %.3f\n", actionReward[16]);
+          printf("  17 - WHITE_AS_YELLOW_THEN_HI_GREEN:    %.3f\n", actionReward[17]);
+          printf("  18 - WHITE_AS_GREEN_THEN_HI_GREEN:     %.3f\n", actionReward[18]);
+          printf("  19 - WHITE_AS_BLUE_THEN_HI_GREEN:      %.3f\n", actionReward[19]);
+          printf("  20 - HI_BLUE_ONLY:                     %.3f\n", actionReward[20]);
+          printf("  21 - WHITE_AS_RED_THEN_HI_BLUE:        %.3f\n", actionReward[21]);
+          printf("  22 - WHITE_AS_YELLOW_THEN_HI_BLUE:     %.3f\n", actionReward[22]);
+          printf("  23 - WHITE_AS_GREEN_THEN_HI_BLUE:      %.3f\n", actionReward[23]);
+          printf("  24 - WHITE_AS_BLUE_THEN_HI_BLUE:       %.3f\n", actionReward[24]);
+
+          // If it was possible to lock a color, then evaluate/print the additional options
+          if (w2_roll == 6 && r_roll == 6 && color62ToMarks[RYGB[RED   ]] >= LOCK_MIN_MARKS)
+          {
+            printf("  25 - HI_RED_ONLY:                      %.3f\n", actionReward[25]);
+            printf("  26 - WHITE_AS_RED_THEN_HI_RED:         %.3f\n", actionReward[26]);
+            printf("  27 - WHITE_AS_YELLOW_THEN_HI_RED:      %.3f\n", actionReward[27]);
+            printf("  28 - WHITE_AS_GREEN_THEN_HI_RED:       %.3f\n", actionReward[28]);
+            printf("  29 - WHITE_AS_BLUE_THEN_HI_RED:        %.3f\n", actionReward[29]);
+          }
+          if (w2_roll == 6 && y_roll == 6 && color62ToMarks[RYGB[YELLOW]] >= LOCK_MIN_MARKS)
+          {
+            printf("  30 - HI_YELLOW_ONLY:                   %.3f\n", actionReward[30]);
+            printf("  31 - WHITE_AS_RED_THEN_HI_YELLOW:      %.3f\n", actionReward[31]);
+            printf("  32 - WHITE_AS_YELLOW_THEN_HI_YELLOW:   %.3f\n", actionReward[32]);
+            printf("  33 - WHITE_AS_GREEN_THEN_HI_YELLOW:    %.3f\n", actionReward[33]);
+            printf("  34 - WHITE_AS_BLUE_THEN_HI_YELLOW:     %.3f\n", actionReward[34]);
+          }
+          if (w1_roll == 1 && g_roll == 1 && color62ToMarks[RYGB[GREEN ]] >= LOCK_MIN_MARKS)
+          {
+            printf("  35 - LOW_GREEN_ONLY:                   %.3f\n", actionReward[35]);
+            printf("  36 - WHITE_AS_RED_THEN_LOW_GREEN:      %.3f\n", actionReward[36]);
+            printf("  37 - WHITE_AS_YELLOW_THEN_LOW_GREEN:   %.3f\n", actionReward[37]);
+            printf("  38 - WHITE_AS_GREEN_THEN_LOW_GREEN:    %.3f\n", actionReward[38]);
+            printf("  39 - WHITE_AS_BLUE_THEN_LOW_GREEN:     %.3f\n", actionReward[39]);
+          }
+          if (w1_roll == 1 && b_roll == 1 && color62ToMarks[RYGB[BLUE  ]] >= LOCK_MIN_MARKS)
+          {
+            printf("  40 - LOW_BLUE_ONLY:                    %.3f\n", actionReward[40]);
+            printf("  41 - WHITE_AS_RED_THEN_LOW_BLUE:       %.3f\n", actionReward[41]);
+            printf("  42 - WHITE_AS_YELLOW_THEN_LOW_BLUE:    %.3f\n", actionReward[42]);
+            printf("  43 - WHITE_AS_GREEN_THEN_LOW_BLUE:     %.3f\n", actionReward[43]);
+            printf("  44 - WHITE_AS_BLUE_THEN_LOW_BLUE:      %.3f\n", actionReward[44]);
+          }
+        } // end if print_actions
+      }
+      else if (! decisions) // Only save the best if we're running multiple states (i.e. generating the Wvec)
+      {
+        Wvec[s] = (generateKernel == KERNEL_FACTORED) ? theWnextFactored :
+                  (generateKernel == KERNEL_NESTED)   ? theWnext         : theWnextReference;
+      }
+    } // end else game not over
+  } // end else numPenalties < NUM_PENALTIES_TO_END
+} // end analyzeMarkovState()
+
+// qwixx.bin
+//
+// qwixx.bin starts with a 64 byte QwixxBinHeader, followed by the
+// NUM_MARKOV_STATES floats of Wvec[]. The checker and sim modes mmap the file
+// read-only and use the floats in place, so starting up doesn't read the whole
+// file, and all the processes using it share one copy in the page cache. The
+// checksum covers the Wvec[] bytes; checking it means reading every page, so
+// it is only done with --verify-checksum.
+//
+// With --fixed16, the values are stored as WvecFixed[] instead, which halves
+// the file and the memory the checker and sim modes touch.
+//
+// Older versions of this program wrote Wvec[] without any header. Such a file
+// is recognized by its size and is still accepted. The header and the format
+// constants are in qwixx_format.h, which libqwixx shares.
+#define QWIXX_BIN_FILENAME "qwixx.bin"
+
+// A loaded qwixx.bin; exactly one of the two is non-NULL
+typedef struct
+{
+  const float   *W;
+  const int16_t *Wfixed;
+  uint64_t       checksum; // from the header; 0 for legacy files
+  const void    *map;      // the whole file's mapping, for unloadQwixxBin()
+  size_t         mapSize;
+} QwixxTable;
+
+// Size in bytes of one Wvec[] value of the given type
+static inline size_t qwixxBinValueSize(uint32_t valueType)
+{
+  return (valueType == QWIXX_BIN_VALUES_FIXED16) ? sizeof(int16_t) : sizeof(float);
+}
+
+// Encode W[] (a float Wvec[]) as WvecFixed[] values. Returns the largest
+// rounding error; exits if a value doesn't fit.
+static float quantizeWvec(const float *W, int16_t *Wfixed)
+{
+  float maxError = 0.0f;
+  int   s;
+
+  for (s = 0; s < NUM_MARKOV_STATES; s++)
+  {
+    int numPenalties = s / NUM_FOUR_COLOR_STATES;
+    int rygbState    = s % NUM_FOUR_COLOR_STATES;
+    int colorStates[NUM_COLORS];
+    int ry, gb;
+    float future, error;
+    long  q;
+
+    Wfixed[s] = WVEC_FIXED16_END_OF_GAME;
+    if (numPenalties >= NUM_PENALTIES_TO_END)
+    {
+      continue;
+    }
+
+    quadToC12C34(rygbState, &ry, &gb);
+    colorStates[RED   ] = dualToC1[ry];
+    colorStates[YELLOW] = dualToC2[ry];
+    colorStates[GREEN ] = dualToC1[gb];
+    colorStates[BLUE  ] = dualToC2[gb];
+    // Truncated runs leave the states they didn't get to at WVEC_END_OF_GAME
+    if (isGameOverIx(colorStates, numPenalties) || W[s] == (float) WVEC_END_OF_GAME)
+    {
+      continue;
+    }
+
+    future = W[s] - (float) getScoreFromIx(colorStates, numPenalties);
+    q      = lrintf(future * WVEC_FIXED16_SCALE);
+    if (q <= WVEC_FIXED16_END_OF_GAME || q > INT16_MAX)
+    {
+      printf("State %d (W %.3f) doesn't fit in 16 bits! Aborting!\n", s, W[s]);
+      exit(-1);
+    }
+    Wfixed[s] = (int16_t) q;
+
+    error = fabsf((float) q / WVEC_FIXED16_SCALE - future);
+    if (error > maxError)
+    {
+      maxError = error;
+    }
+  }
+
+  return maxError;
+}
+
+static void fillQwixxBinHeader(QwixxBinHeader *header, uint32_t valueType, const void *values)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, QWIXX_BIN_MAGIC, sizeof(header->magic));
+  header->version           = QWIXX_BIN_VERSION;
+  header->headerSize        = sizeof(*header);
+  header->numMarkovStates   = NUM_MARKOV_STATES;
+  header->valueType         = valueType;
+  header->fixedScale        = (valueType == QWIXX_BIN_VALUES_FIXED16) ? WVEC_FIXED16_SCALE : 0;
+  header->numColors         = NUM_COLORS;
+  header->lockMinMarks      = LOCK_MIN_MARKS;
+  header->numPenaltiesToEnd = NUM_PENALTIES_TO_END;
+  header->penaltyPoints     = PENALTY_POINTS;
+  header->numLocksToEnd     = NUM_LOCKS_TO_END;
+  header->rowScoresId       = rowScoresId();
+  header->checksum          = fnv1a64(values, qwixxBinValueSize(valueType) * NUM_MARKOV_STATES);
+}
+
+// Write the float table W[] to filename, as floats or (valueType
+// QWIXX_BIN_VALUES_FIXED16) as WvecFixed[] values. The data goes to a
+// temporary file first, which is then renamed, so a reader never sees a
+// partial file. Returns 1 on success.
+static int saveQwixxBin(const char *filename, const float *W, uint32_t valueType)
+{
+  QwixxBinHeader header;
+  char           tmpFilename[256];
+  FILE          *fp;
+  int            ok;
+  const void    *values = W;
+  int16_t       *Wfixed = NULL;
+
+  if (valueType == QWIXX_BIN_VALUES_FIXED16)
+  {
+    Wfixed = malloc(sizeof(int16_t) * NUM_MARKOV_STATES);
+    if (Wfixed == NULL)
+    {
+      return 0;
+    }
+    printf("Largest 16-bit rounding error: %.5f points\n", quantizeWvec(W, Wfixed));
+    values = Wfixed;
+  }
+
+  fillQwixxBinHeader(&header, valueType, values);
+
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+  fp = fopen(tmpFilename, "wb");
+  ok = (fp != NULL);
+  if (ok)
+  {
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+         fwrite(values, qwixxBinValueSize(valueType), NUM_MARKOV_STATES, fp) == NUM_MARKOV_STATES;
+    ok = (fclose(fp) == 0) && ok;
+  }
+
+  free(Wfixed);
+  return ok && rename(tmpFilename, filename) == 0;
+}
+
+// Map filename read-only into *table. Exits on any error.
+static void loadQwixxBin(const char *filename, int verifyChecksum, QwixxTable *table)
+{
+  struct stat           st;
+  const unsigned char  *map;
+  const QwixxBinHeader *header;
+  const void           *values;
+  size_t                valueSize;
+  int                   fd = open(filename, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    printf("Error opening %s! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED)
+  {
+    printf("Error mapping %s! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  memset(table, 0, sizeof(*table));
+  table->map     = map;
+  table->mapSize = st.st_size;
+  header = (const QwixxBinHeader *) map;
+  if (st.st_size == (off_t) (sizeof(float) * NUM_MARKOV_STATES))
+  {
+    // Legacy file: just the floats, nothing to check. They are always for the
+    // standard rules.
+    if (! STANDARD_RULES || rowScoresId() != 0)
+    {
+      printf("%s is a legacy file for the standard rules! Aborting!\n", filename);
+      exit(-1);
+    }
+    table->W = (const float *) map;
+  }
+  else if (st.st_size >= (off_t) sizeof(QwixxBinHeader) &&
+           memcmp(header->magic, QWIXX_BIN_MAGIC, sizeof(header->magic)) == 0)
+  {
+    if (header->version != QWIXX_BIN_VERSION)
+    {
+      printf("%s has version %u, but only version %d is supported! Aborting!\n",
+             filename, header->version, QWIXX_BIN_VERSION);
+      exit(-1);
+    }
+    if (header->numMarkovStates   != NUM_MARKOV_STATES    ||
+        (header->valueType        != QWIXX_BIN_VALUES_FLOAT32 &&
+         (header->valueType       != QWIXX_BIN_VALUES_FIXED16 || header->fixedScale != WVEC_FIXED16_SCALE)) ||
+        header->numColors         != NUM_COLORS           ||
+        header->lockMinMarks      != LOCK_MIN_MARKS       ||
+        header->numPenaltiesToEnd != NUM_PENALTIES_TO_END ||
+        header->penaltyPoints     != PENALTY_POINTS       ||
+        header->numLocksToEnd     != NUM_LOCKS_TO_END     ||
+        header->rowScoresId       != rowScoresId())
+    {
+      printf("%s was generated for different rules or a different state space! Aborting!\n", filename);
+      exit(-1);
+    }
+    valueSize = qwixxBinValueSize(header->valueType);
+    if (st.st_size != (off_t) (header->headerSize + valueSize * NUM_MARKOV_STATES) ||
+        header->headerSize % sizeof(float) != 0)
+    {
+      printf("%s has the wrong size (%lld bytes)! Aborting!\n", filename, (long long) st.st_size);
+      exit(-1);
+    }
+
+    values = map + header->headerSize;
+    if (verifyChecksum && fnv1a64(values, valueSize * NUM_MARKOV_STATES) != header->checksum)
+    {
+      printf("%s has a bad checksum! Aborting!\n", filename);
+      exit(-1);
+    }
+    table->checksum = header->checksum;
+    if (header->valueType == QWIXX_BIN_VALUES_FIXED16)
+    {
+      table->Wfixed = (const int16_t *) values;
+    }
+    else
+    {
+      table->W = (const float *) values;
+    }
+  }
+  else
+  {
+    printf("%s is not a qwixx.bin file! Aborting!\n", filename);
+    exit(-1);
+  }
+}
+
+// Unmap a table from loadQwixxBin(). Only for tables nothing uses any more.
+static void unloadQwixxBin(QwixxTable *table)
+{
+  munmap((void *) table->map, table->mapSize);
+  memset(table, 0, sizeof(*table));
+}
+
+// Make getWforState() and friends use table. Checker and sim modes never
+// write Wvec[]; the mapping is read-only, so any attempt to do so would fault.
+static void useQwixxTable(const QwixxTable *table)
+{
+  Wvec      = (float *) table->W;
+  WvecFixed = table->Wfixed;
+}
+
+// Allocate Wvec[] for generating it, with every entry WVEC_END_OF_GAME
+static void allocWvec(void)
+{
+  int i;
+
+  Wvec = malloc(sizeof(float)*NUM_MARKOV_STATES);
+  if (Wvec == NULL)
+  {
+    printf("Error allocating Wvec! Aborting!\n");
+    exit(-1);
+  }
+  for (i = 0; i < NUM_MARKOV_STATES; i++)
+  {
+    // Initialize to "end of game" values
+    Wvec[i] = WVEC_END_OF_GAME;
+  }
+}
+
+// Number of rolls of the 4 colored dice (out of 1296) for which a and b pick
+// the same action, for white pair number pair. Like sumOfMaxOverColoredDice(),
+// this counts the rolls won by each choice instead of going through all of
+// them: whether die c showing f wins (see StateDecisions) only depends on each
+// of the other dice on its own, so the number of rolls it wins in both a and
+// b is a product of per-die face counts.
+static int countSameDecisions(const StateDecisions *a, const StateDecisions *b, int pair)
+{
+  float aWhite = a->whiteReward[pair];
+  float bWhite = b->whiteReward[pair];
+  int   same   = 0;
+  int   c, f, j, g, count;
+
+  // No die beats the white-only action
+  if (a->whiteAction[pair] == b->whiteAction[pair])
+  {
+    count = 1;
+    for (j = 0; j < NUM_COLORS; j++)
+    {
+      int numFaces = 0;
+      for (g = 0; g < 6; g++)
+      {
+        numFaces += (a->dieBestReward[pair][j][g] <= aWhite && b->dieBestReward[pair][j][g] <= bWhite);
+      }
+      count *= numFaces;
+    }
+    same += count;
+  }
+
+  // Die c showing f + 1 wins
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    for (f = 0; f < 6; f++)
+    {
+      float aVal = a->dieBestReward[pair][c][f];
+      float bVal = b->dieBestReward[pair][c][f];
+
+      if (a->dieBestAction[pair][c][f] != b->dieBestAction[pair][c][f] || ! (aVal > aWhite) || ! (bVal > bWhite))
+      {
+        continue;
+      }
+
+      count = 1;
+      for (j = 0; j < NUM_COLORS && count > 0; j++)
+      {
+        int numFaces = 0;
+        if (j == c)
+        {
+          continue;
+        }
+        for (g = 0; g < 6; g++)
+        {
+          float aOther = a->dieBestReward[pair][j][g];
+          float bOther = b->dieBestReward[pair][j][g];
+          numFaces += (j < c) ? (aOther <  aVal && bOther <  bVal) :
+                                (aOther <= aVal && bOther <= bVal);
+        }
+        count *= numFaces;
+      }
+      same += count;
+    }
+  }
+
+  return same;
+}
+
+// What compareDecisions() found
+typedef struct
+{
+  int    numStates;        // states compared
+  int    numMissing;       // states skipped because a table has no value for them
+  int    numChangedStates; // states with a different action for some roll
+  double maxWdiff;         // largest |W difference|
+  double meanWdiff;        // and the mean over the states compared
+} DecisionComparison;
+
+// --compare-decisions: for every Markov state (or only the last num_states
+// of them if num_states > 0) and every roll of the 6 dice, check whether
+// tables a and b lead to the same action, and report how often they don't,
+// listing the first maxListed states where they don't. States a cut short
+// generate run didn't get to are skipped. result may be NULL.
+static void compareDecisions(const QwixxTable *a, const QwixxTable *b, int num_states, int maxListed,
+                             DecisionComparison *result)
+{
+  StateDecisions *decA = malloc(sizeof(StateDecisions));
+  StateDecisions *decB = malloc(sizeof(StateDecisions));
+  int    s, s2, pair, w1, w2;
+  int    numStates        = 0;
+  int    numMissing       = 0;
+  int    numChangedStates = 0;
+  int    worstState       = -1;
+  double worstChanged     = 0.0;
+  double sumChanged       = 0.0;
+  double maxWdiff         = 0.0;
+  double sumWdiff         = 0.0;
+  int    maxWdiffState    = -1;
+
+  if (decA == NULL || decB == NULL)
+  {
+    printf("Error allocating decision buffers! Aborting!\n");
+    exit(-1);
+  }
+
+  s2 = 0;
+  if (num_states > 0)
+  {
+    s2 = NUM_MARKOV_STATES - num_states;
+    if (s2 < 0)
+    {
+      s2 = 0;
+    }
+  }
+
+  for (s = NUM_MARKOV_STATES - 2; s >= s2; s--)
+  {
+    int    numPenalties = s / NUM_FOUR_COLOR_STATES;
+    int    rygbState    = s % NUM_FOUR_COLOR_STATES;
+    int    ry, gb;
+    int    colorStates[NUM_COLORS];
+    double sameFraction = 0.0;
+    double changed, Wdiff;
+    float  Wa, Wb;
+
+    quadToC12C34(rygbState, &ry, &gb);
+    colorStates[RED   ] = dualToC1[ry];
+    colorStates[YELLOW] = dualToC2[ry];
+    colorStates[GREEN ] = dualToC1[gb];
+    colorStates[BLUE  ] = dualToC2[gb];
+    if (isGameOverIx(colorStates, numPenalties))
+    {
+      continue;
+    }
+
+    useQwixxTable(a);
+    Wa = getWforIx(colorStates, numPenalties, NULL);
+    useQwixxTable(b);
+    Wb = getWforIx(colorStates, numPenalties, NULL);
+    if (! isfinite(Wa) || ! isfinite(Wb))
+    {
+      numMissing++;
+      continue;
+    }
+
+    useQwixxTable(a);
+    analyzeMarkovState(NULL, s, 0, 0, 0, 0, 0, 0, 0, decA);
+    useQwixxTable(b);
+    analyzeMarkovState(NULL, s, 0, 0, 0, 0, 0, 0, 0, decB);
+
+    pair = 0;
+    for (w1 = 1; w1 <= 6; w1++)
+    {
+      for (w2 = w1; w2 <= 6; w2++, pair++)
+      {
+        double pairProb = (w1 == w2) ? (1.0 / 36) : (2.0 / 36);
+        sameFraction += pairProb * countSameDecisions(decA, decB, pair) / (6*6*6*6);
+      }
+    }
+
+    changed = 1.0 - sameFraction;
+    if (changed < 1e-12)
+    {
+      changed = 0.0;
+    }
+    numStates++;
+    sumChanged += changed;
+    if (changed > 0.0)
+    {
+      if (numChangedStates < maxListed)
+      {
+        printf("State %d (R %d/%d Y %d/%d G %d/%d B %d/%d, %d penalties): %.6f%% of rolls changed, W %.5f vs %.5f\n",
+               s,
+               color62ToMarks[colorStates[RED   ]], color62ToBox[colorStates[RED   ]],
+               color62ToMarks[colorStates[YELLOW]], color62ToBox[colorStates[YELLOW]],
+               color62ToMarks[colorStates[GREEN ]], color62ToBox[colorStates[GREEN ]],
+               color62ToMarks[colorStates[BLUE  ]], color62ToBox[colorStates[BLUE  ]],
+               numPenalties, 100.0 * changed, Wa, Wb);
+      }
+      numChangedStates++;
+    }
+    if (changed > worstChanged)
+    {
+      worstChanged = changed;
+      worstState   = s;
+    }
+
+    Wdiff     = fabs((double) Wa - (double) Wb);
+    sumWdiff += Wdiff;
+    if (Wdiff > maxWdiff)
+    {
+      maxWdiff      = Wdiff;
+      maxWdiffState = s;
+    }
+
+    if ((NUM_MARKOV_STATES - s) % 100000 == 0)
+    {
+      printf("% 8d / % 8d states compared\n", NUM_MARKOV_STATES - s, NUM_MARKOV_STATES);
+    }
+  }
+
+  printf("States compared:                  %d\n", numStates);
+  if (numMissing > 0)
+  {
+    printf("States not in both tables:        %d (skipped)\n", numMissing);
+  }
+  printf("States with any changed decision: %d\n", numChangedStates);
+  printf("Changed decisions, all states:    %.6f%% of (state, roll) pairs\n",
+         numStates ? 100.0 * sumChanged / numStates : 0.0);
+  printf("Most changed decisions:           %.6f%% of rolls (state %d)\n", 100.0 * worstChanged, worstState);
+  printf("Largest W difference:             %.5f points (state %d)\n", maxWdiff, maxWdiffState);
+  printf("Mean W difference:                %.3g points\n", numStates ? sumWdiff / numStates : 0.0);
+
+  if (result)
+  {
+    result->numStates        = numStates;
+    result->numMissing       = numMissing;
+    result->numChangedStates = numChangedStates;
+    result->maxWdiff         = maxWdiff;
+    result->meanWdiff        = numStates ? sumWdiff / numStates : 0.0;
+  }
+  free(decA);
+  free(decB);
+}
+
+// Checkpoints
+//
+// A full generate run takes a long time, so every checkpointIntervalSec
+// seconds the loop position and Wvec[] are saved to CHECKPOINT_FILENAME, and
+// --resume picks the run up from there. Taking a checkpoint only costs the
+// compute threads a copy of Wvec[] into a snapshot buffer; a background thread
+// writes the snapshot to a temporary file and renames it over the old
+// checkpoint, so there is always one complete checkpoint on disk.
+#define CHECKPOINT_FILENAME "qwixx.ckpt"
+#define CHECKPOINT_MAGIC    "QWXCKPT1"
+
+// How the generate loop was being run. Checkpoint positions of different
+// engines don't mean the same thing, so a run can only be resumed by the same
+// engine.
+typedef enum
+{
+  CHECKPOINT_SERIAL,        // analyzeState(); position is the next Markov state (counting down)
+  CHECKPOINT_WAVEFRONT,     // generateWvecThreaded(); position is the next wavefront level
+  CHECKPOINT_PENALTY_LANES  // same, with --penalty-lanes
+} CheckpointEngine;
+
+typedef struct
+{
+  char magic[8];        // CHECKPOINT_MAGIC (without the terminating 0)
+  int  numMarkovStates; // NUM_MARKOV_STATES
+  int  engine;          // CheckpointEngine
+  int  kernel;          // GenerateKernel
+  int  numIterations;   // num_iterations of the run (-1 for all of them)
+  int  position;        // where to resume the loop (see CheckpointEngine)
+  int  reserved;
+} CheckpointHeader;
+
+static int              checkpointIntervalSec    = 0;  // 0: no checkpoints
+static int              checkpointResumePosition = -1; // >= 0 when resuming a run
+static time_t           checkpointLastTime       = 0;
+static int              checkpointWriting        = 0;  // set while the writer thread runs (atomic)
+static int              checkpointWriterStarted  = 0;
+static pthread_t        checkpointWriter;
+static CheckpointHeader checkpointHeader;
+static float           *checkpointSnapshot       = NULL;
+
+static void *checkpointWriterThread(void *arg)
+{
+  const char *tmpFilename = CHECKPOINT_FILENAME ".tmp";
+  FILE       *fp          = fopen(tmpFilename, "wb");
+  int         ok          = (fp != NULL);
+
+  (void) arg;
+
+  if (ok)
+  {
+    ok = fwrite(&checkpointHeader, sizeof(checkpointHeader), 1, fp) == 1 &&
+         fwrite(checkpointSnapshot, sizeof(float), NUM_MARKOV_STATES, fp) == NUM_MARKOV_STATES &&
+         fflush(fp) == 0 &&
+         fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+  }
+  if (ok)
+  {
+    ok = (rename(tmpFilename, CHECKPOINT_FILENAME) == 0);
+  }
+
+  if (ok)
+  {
+    printf("Saved checkpoint to %s (position %d)\n", CHECKPOINT_FILENAME, checkpointHeader.position);
+  }
+  else
+  {
+    // Not fatal; the run itself is still fine
+    printf("WARNING: Unable to write checkpoint %s!\n", tmpFilename);
+  }
+
+  __atomic_store_n(&checkpointWriting, 0, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Returns 1 if it is time to take a checkpoint
+static inline int checkpointDue(void)
+{
+  return checkpointIntervalSec > 0 && time(NULL) - checkpointLastTime >= checkpointIntervalSec;
+}
+
+// Snapshot Wvec[] and start writing it out in the background. Wvec[] must not
+// be written while this runs. If the previous checkpoint is still being
+// written, this one is skipped rather than waiting for it.
+static void takeCheckpoint(CheckpointEngine engine, int numIterations, int position)
+{
+  if (__atomic_load_n(&checkpointWriting, __ATOMIC_ACQUIRE))
+  {
+    return;
+  }
+  if (checkpointWriterStarted)
+  {
+    pthread_join(checkpointWriter, NULL);
+    checkpointWriterStarted = 0;
+  }
+
+  if (checkpointSnapshot == NULL)
+  {
+    checkpointSnapshot = malloc(sizeof(float) * NUM_MARKOV_STATES);
+    if (checkpointSnapshot == NULL)
+    {
+      printf("Error allocating the checkpoint buffer! Aborting!\n");
+      exit(-1);
+    }
+  }
+
+  memset(&checkpointHeader, 0, sizeof(checkpointHeader));
+  memcpy(checkpointHeader.magic, CHECKPOINT_MAGIC, sizeof(checkpointHeader.magic));
+  checkpointHeader.numMarkovStates = NUM_MARKOV_STATES;
+  checkpointHeader.engine          = engine;
+  checkpointHeader.kernel          = generateKernel;
+  checkpointHeader.numIterations   = numIterations;
+  checkpointHeader.position        = position;
+  memcpy(checkpointSnapshot, Wvec, sizeof(float) * NUM_MARKOV_STATES);
+
+  checkpointLastTime = time(NULL);
+  __atomic_store_n(&checkpointWriting, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&checkpointWriter, NULL, checkpointWriterThread, NULL) != 0)
+  {
+    printf("WARNING: Unable to start the checkpoint writer thread!\n");
+    __atomic_store_n(&checkpointWriting, 0, __ATOMIC_RELEASE);
+    return;
+  }
+  checkpointWriterStarted = 1;
+}
+
+// Wait for a checkpoint that is still being written
+static void finishCheckpoints(void)
+{
+  if (checkpointWriterStarted)
+  {
+    pthread_join(checkpointWriter, NULL);
+    checkpointWriterStarted = 0;
+  }
+}
+
+// Load Wvec[] and the loop position from CHECKPOINT_FILENAME for --resume. The
+// checkpoint must come from a run with the same engine, kernel and
+// num_iterations, otherwise the result wouldn't match an uninterrupted run.
+static void loadCheckpoint(CheckpointEngine engine, int numIterations)
+{
+  CheckpointHeader header;
+  FILE            *fp = fopen(CHECKPOINT_FILENAME, "rb");
+
+  if (fp == NULL)
+  {
+    printf("Error opening %s for --resume! Exiting!\n", CHECKPOINT_FILENAME);
+    exit(-1);
+  }
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.numMarkovStates != NUM_MARKOV_STATES)
+  {
+    printf("%s is not a valid checkpoint! Exiting!\n", CHECKPOINT_FILENAME);
+    exit(-1);
+  }
+  if (header.engine != (int) engine || header.kernel != (int) generateKernel ||
+      header.numIterations != numIterations)
+  {
+    printf("%s was written by a different kind of run (engine %d, kernel %d, num_iterations %d)! Exiting!\n",
+           CHECKPOINT_FILENAME, header.engine, header.kernel, header.numIterations);
+    exit(-1);
+  }
+  if (fread(Wvec, sizeof(float), NUM_MARKOV_STATES, fp) != NUM_MARKOV_STATES)
+  {
+    printf("Error reading %s! Exiting!\n", CHECKPOINT_FILENAME);
+    exit(-1);
+  }
+  fclose(fp);
+
+  checkpointResumePosition = header.position;
+  printf("Resuming from %s (position %d)\n", CHECKPOINT_FILENAME, header.position);
+}
+
+// Progress telemetry (--progress-interval, --progress-file)
+//
+// The generate engines count the states they finish in per-thread counters
+// (one relaxed store per state or chunk, on a cache line of its own), and
+// mark the start of each penalty layer. A monitor thread wakes up every
+// progressIntervalSec seconds, adds up the counters and reports the overall
+// progress, the rate over the last PROGRESS_WINDOW_SEC seconds, the time each
+// layer took and an ETA, either on stderr or as a JSON status file that is
+// replaced atomically.
+#define PROGRESS_WINDOW_SEC  60
+#define PROGRESS_MAX_SAMPLES 1024 // ring of (time, states) samples for the window
+
+typedef struct
+{
+  long long count;
+  char      pad[64 - sizeof(long long)];
+} ProgressCounter;
+
+typedef struct
+{
+  double    startTime; // seconds since the run started; < 0 if the layer hasn't started
+  double    endTime;   // < 0 while the layer is running
+  long long startDone; // states done when it started
+  long long endDone;
+} ProgressLayer;
+
+static int              progressIntervalSec = 0;    // 0: no telemetry
+static const char      *progressFile        = NULL; // JSON status file instead of stderr
+static ProgressCounter *progressCounters    = NULL; // [progressNumThreads]
+static int              progressNumThreads;
+static long long        progressTotal;              // states in the whole run
+static long long        progressStartDone;          // states already done when it (re)started
+static ProgressLayer    progressLayers[NUM_PENALTIES_TO_END];
+static int              progressCurrentLayer;       // -1: none yet (or penalty lanes, which has none)
+static struct timespec  progressStartTime;
+static double           progressSampleTime [PROGRESS_MAX_SAMPLES];
+static long long        progressSampleDone [PROGRESS_MAX_SAMPLES];
+static int              progressNumSamples;
+static int              progressStopping;
+static pthread_t        progressMonitor;
+static pthread_mutex_t  progressMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   progressCond  = PTHREAD_COND_INITIALIZER;
+
+static double progressElapsed(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - progressStartTime.tv_sec) + (now.tv_nsec - progressStartTime.tv_nsec) * 1e-9;
+}
+
+// numStates more states are done by thread threadIx. Only that thread writes
+// its counter, so this is a plain add and store.
+static inline void progressAdd(int threadIx, int numStates)
+{
+  if (progressCounters)
+  {
+    ProgressCounter *counter = &progressCounters[threadIx];
+    __atomic_store_n(&counter->count, counter->count + numStates, __ATOMIC_RELAXED);
+  }
+}
+
+static long long progressDone(void)
+{
+  long long done = progressStartDone;
+  int       t;
+  for (t = 0; t < progressNumThreads; t++)
+  {
+    done += __atomic_load_n(&progressCounters[t].count, __ATOMIC_RELAXED);
+  }
+  return done;
+}
+
+// The layer of numPenalties penalties starts now (called by one thread at a
+// time)
+static void progressLayer(int numPenalties)
+{
+  double    now;
+  long long done;
+
+  if (progressCounters == NULL || numPenalties == progressCurrentLayer)
+  {
+    return;
+  }
+  now  = progressElapsed();
+  done = progressDone();
+  pthread_mutex_lock(&progressMutex);
+  if (progressCurrentLayer >= 0)
+  {
+    progressLayers[progressCurrentLayer].endTime = now;
+    progressLayers[progressCurrentLayer].endDone = done;
+  }
+  progressCurrentLayer = numPenalties;
+  progressLayers[numPenalties].startTime = now;
+  progressLayers[numPenalties].startDone = done;
+  progressLayers[numPenalties].endTime   = -1.0;
+  pthread_mutex_unlock(&progressMutex);
+}
+
+static void formatDuration(char *buf, size_t len, double sec)
+{
+  long long s = (long long) (sec + 0.5);
+  snprintf(buf, len, "%lld:%02lld:%02lld", s / 3600, (s / 60) % 60, s % 60);
+}
+
+// Take a sample and report it. Called with progressMutex held.
+static void progressReport(int finished)
+{
+  double    now  = progressElapsed();
+  long long done = progressDone();
+  double    windowTime, rate, eta;
+  long long windowDone;
+  int       oldest, i, p;
+
+  // Rate over the oldest sample still inside the window
+  i = progressNumSamples % PROGRESS_MAX_SAMPLES;
+  progressSampleTime[i] = now;
+  progressSampleDone[i] = done;
+  progressNumSamples++;
+  oldest = (progressNumSamples > PROGRESS_MAX_SAMPLES) ? progressNumSamples - PROGRESS_MAX_SAMPLES : 0;
+  while (oldest < progressNumSamples - 1 &&
+         now - progressSampleTime[oldest % PROGRESS_MAX_SAMPLES] > PROGRESS_WINDOW_SEC)
+  {
+    oldest++;
+  }
+  if (oldest == progressNumSamples - 1)
+  {
+    // Only the sample just taken: use the whole run so far
+    windowTime = now;
+    windowDone = done - progressStartDone;
+  }
+  else
+  {
+    windowTime = now  - progressSampleTime[oldest % PROGRESS_MAX_SAMPLES];
+    windowDone = done - progressSampleDone[oldest % PROGRESS_MAX_SAMPLES];
+  }
+  rate = (windowTime > 0.0) ? windowDone / windowTime : 0.0;
+  eta  = (rate > 0.0) ? (progressTotal - done) / rate : -1.0;
+
+  if (progressFile)
+  {
+    char  tmpFilename[1024];
+    FILE *fp;
+
+    snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", progressFile);
+    fp = fopen(tmpFilename, "w");
+    if (fp == NULL)
+    {
+      fprintf(stderr, "WARNING: Unable to write %s!\n", tmpFilename);
+      return;
+    }
+    fprintf(fp, "{\n  \"finished\": %s,\n  \"threads\": %d,\n  \"states_done\": %lld,\n  \"states_total\": %lld,\n"
+                "  \"percent\": %.3f,\n  \"elapsed_sec\": %.1f,\n  \"window_sec\": %.1f,\n"
+                "  \"states_per_sec\": %.1f,\n  \"eta_sec\": %.1f,\n  \"current_layer\": %d,\n  \"layers\": [",
+            finished ? "true" : "false", progressNumThreads, done, progressTotal,
+            100.0 * done / progressTotal, now, windowTime, rate, finished ? 0.0 : eta,
+            progressCurrentLayer);
+    for (p = NUM_PENALTIES_TO_END - 1, i = 0; p >= 0; p--)
+    {
+      const ProgressLayer *layer = &progressLayers[p];
+      double               end   = (layer->endTime >= 0.0) ? layer->endTime : now;
+      long long            endDone = (layer->endTime >= 0.0) ? layer->endDone : done;
+      if (layer->startTime < 0.0)
+      {
+        continue;
+      }
+      fprintf(fp, "%s\n    {\"penalties\": %d, \"done\": %s, \"sec\": %.1f, \"states\": %lld, \"states_per_sec\": %.1f}",
+              i++ ? "," : "", p, (layer->endTime >= 0.0) ? "true" : "false", end - layer->startTime,
+              endDone - layer->startDone,
+              (end > layer->startTime) ? (endDone - layer->startDone) / (end - layer->startTime) : 0.0);
+    }
+    fprintf(fp, "%s]\n}\n", i ? "\n  " : "");
+    if (fclose(fp) != 0 || rename(tmpFilename, progressFile) != 0)
+    {
+      fprintf(stderr, "WARNING: Unable to write %s!\n", progressFile);
+    }
+  }
+  else
+  {
+    char elapsedBuf[32], etaBuf[32];
+
+    formatDuration(elapsedBuf, sizeof(elapsedBuf), now);
+    if (finished)
+    {
+      snprintf(etaBuf, sizeof(etaBuf), "done");
+    }
+    else if (eta >= 0.0)
+    {
+      memcpy(etaBuf, "ETA ", 4);
+      formatDuration(etaBuf + 4, sizeof(etaBuf) - 4, eta);
+    }
+    else
+    {
+      snprintf(etaBuf, sizeof(etaBuf), "ETA ?");
+    }
+    fprintf(stderr, "[progress] %lld / %lld states (%.1f%%), %.0f states/s over %.0f s, elapsed %s, %s",
+            done, progressTotal, 100.0 * done / progressTotal, rate, windowTime, elapsedBuf, etaBuf);
+    for (p = NUM_PENALTIES_TO_END - 1; p >= 0; p--)
+    {
+      const ProgressLayer *layer = &progressLayers[p];
+      if (layer->startTime >= 0.0)
+      {
+        fprintf(stderr, ", layer %d %.1f s%s", p,
+                ((layer->endTime >= 0.0) ? layer->endTime : now) - layer->startTime,
+                (layer->endTime >= 0.0) ? "" : " (running)");
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+}
+
+static void *progressMonitorThread(void *arg)
+{
+  struct timespec deadline;
+
+  (void) arg;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  pthread_mutex_lock(&progressMutex);
+  while (! progressStopping)
+  {
+    deadline.tv_sec += progressIntervalSec;
+    while (! progressStopping &&
+           pthread_cond_timedwait(&progressCond, &progressMutex, &deadline) != ETIMEDOUT)
+      ;
+    if (! progressStopping)
+    {
+      progressReport(0);
+    }
+  }
+  pthread_mutex_unlock(&progressMutex);
+  return NULL;
+}
+
+// Start the telemetry for a run of totalStates states (startDone of them done
+// before a --resume), with numThreads counters
+static void progressStart(long long totalStates, long long startDone, int numThreads)
+{
+  int p;
+
+  if (progressIntervalSec <= 0)
+  {
+    return;
+  }
+  progressCounters = calloc(numThreads, sizeof(ProgressCounter));
+  if (progressCounters == NULL)
+  {
+    printf("Error allocating progress counters! Aborting!\n");
+    exit(-1);
+  }
+  progressNumThreads   = numThreads;
+  progressTotal        = totalStates;
+  progressStartDone    = startDone;
+  progressCurrentLayer = -1;
+  progressNumSamples   = 0;
+  progressStopping     = 0;
+  for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+  {
+    progressLayers[p].startTime = -1.0;
+    progressLayers[p].endTime   = -1.0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &progressStartTime);
+
+  if (pthread_create(&progressMonitor, NULL, progressMonitorThread, NULL) != 0)
+  {
+    printf("WARNING: Unable to start the progress monitor thread!\n");
+    free(progressCounters);
+    progressCounters = NULL;
+  }
+}
+
+// Stop the monitor and give the final report
+static void progressStop(void)
+{
+  if (progressCounters == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock(&progressMutex);
+  progressStopping = 1;
+  pthread_cond_signal(&progressCond);
+  pthread_mutex_unlock(&progressMutex);
+  pthread_join(progressMonitor, NULL);
+
+  if (progressCurrentLayer >= 0)
+  {
+    progressLayers[progressCurrentLayer].endTime = progressElapsed();
+    progressLayers[progressCurrentLayer].endDone = progressDone();
+  }
+  progressReport(1);
+  free(progressCounters);
+  progressCounters = NULL;
+}
+
+// This is the main function that calculates the W vector. It takes a very long time.
+// NOTE:
+//
+// If pState is NULL, this loops over all states to populate the W vector. In
+// this case, the dice roll values are ignored.
+//
+// If pState is non-NULL, the dice rolls are used to calculate the optimal move
+// according to W vector. pState is updated to the optimal selection.
+static void analyzeState(QwixxState *pState,
+                         int num_iterations,
+                         int w1_roll, int w2_roll, int r_roll, int y_roll, int g_roll, int b_roll,
+                         int print_actions)
+{
+  int s  = 0; // markov state loop index
+  int s1 = 0; // Looping indices (start index)
+  int s2 = 0; //                 (stop  index)
+
+  if (pState == NULL)
+  {
+    s1 = NUM_MARKOV_STATES - 1;
+    s2 = 0;
+
+    if (checkpointResumePosition >= 0)
+    {
+      s1 = checkpointResumePosition;
+    }
+
+    // Allow the main loop to be cut short if num_iterations is > 0
+    if (num_iterations > 0)
+    {
+      s2 = NUM_MARKOV_STATES - num_iterations;
+      if (s2 < 0)
+      {
+        s2 = 0;
+      }
+    }
+  }
+  else
+  {
+    // Only run through the loop once. Fetch appropriate Markov state index for
+    // loop bounds.
+    getWforState(pState, &s1);
+    s2 = s1;
+
+#define CHECK_RANGE(d)                                                         \
+    if (d < 1 || d > 6)                                                        \
+    {                                                                          \
+      printf("Invalid dice value passed to analyzeState (%d)! Exiting!\n", d); \
+      exit(-1);                                                                \
+    }
+    CHECK_RANGE(w1_roll);
+    CHECK_RANGE(w2_roll);
+    CHECK_RANGE(r_roll);
+    CHECK_RANGE(y_roll);
+    CHECK_RANGE(g_roll);
+    CHECK_RANGE(b_roll);
+  }
+
+  if (pState == NULL)
+  {
+    progressStart(NUM_MARKOV_STATES - s2, NUM_MARKOV_STATES - 1 - s1, 1);
+  }
+
+  // Loop through the states backwards. Each loop only looks at state indices
+  // >= this current s, so it only works when looping backward.
+  for (s = s1; s >= s2; s--)
+  {
+    if (pState == NULL && s / NUM_FOUR_COLOR_STATES < NUM_PENALTIES_TO_END)
+    {
+      progressLayer(s / NUM_FOUR_COLOR_STATES);
+    }
+
+    analyzeMarkovState(pState, s, w1_roll, w2_roll, r_roll, y_roll, g_roll, b_roll, print_actions, NULL);
+
+    if (pState == NULL && ((NUM_MARKOV_STATES - s) % 1000 == 0))
+    {
+      printf("% 8d / % 8d states complete\n", NUM_MARKOV_STATES - s, NUM_MARKOV_STATES);
+
+      if (checkpointDue())
+      {
+        takeCheckpoint(CHECKPOINT_SERIAL, num_iterations, s - 1);
+      }
+    }
+    if (pState == NULL)
+    {
+      progressAdd(0, 1);
+    }
+  } // end s loop
+
+  if (pState == NULL)
+  {
+    progressStop();
+  }
+} // end analyzeState()
+
+// Work out the 5 actions of the group that marks color with diceVal1 (or
+// diceVal2 if diceVal1 can't be marked): the mark by itself, and the mark
+// after each possible "white as" mark. Same as the CHECK_* macros of
+// analyzeMarkovState(), for a single roll.
+static inline void decideDieGroup(int color, int diceVal1, int diceVal2, int p,
+                                  int colorStates[], int wasStates[][NUM_COLORS], const int canTakeWas[],
+                                  float groupReward[], int groupStateIx[])
+{
+  int newColorStates[NUM_COLORS];
+  int c;
+
+  groupReward[0] = ACTION_ILLEGAL;
+  if (! canTakeMarkQuiet(color, diceVal1, p, colorStates, &groupStateIx[0], newColorStates, &groupReward[0]))
+  {
+    canTakeMarkQuiet(color, diceVal2, p, colorStates, &groupStateIx[0], newColorStates, &groupReward[0]);
+  }
+
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    groupReward[1 + c] = ACTION_ILLEGAL;
+    if (canTakeWas[c] &&
+        ! canTakeMarkQuiet(color, diceVal1, p, wasStates[c], &groupStateIx[1 + c], newColorStates, &groupReward[1 + c]))
+    {
+      canTakeMarkQuiet(color, diceVal2, p, wasStates[c], &groupStateIx[1 + c], newColorStates, &groupReward[1 + c]);
+    }
+  }
+}
+
+// Lowest of the 5 rewards of an action group (see qwixx_decide())
+static inline float groupMinReward(const float groupReward[])
+{
+  return fminf(fminf(fminf(groupReward[0], groupReward[1]), fminf(groupReward[2], groupReward[3])), groupReward[4]);
+}
+
+// Pick the best action for one roll of the dice in *state and write the state
+// after taking it to *next (which may be state). This makes the same choice as
+// analyzeState(state, 0, w1, ..., b, 0), ties included, but only looks at the
+// actions these dice allow, and does no I/O and no allocation. Returns the
+// action (a QAction), and its expected final score in *reward if reward is
+// non-NULL, or -1 if the game is already over or the table has no W for one of
+// the successors (a cut short run); *next is left alone then.
+static int qwixx_decide(const QwixxState *state, int w1, int w2, int r, int y, int g, int b,
+                        QwixxState *next, float *reward)
+{
+  int   colorStates[NUM_COLORS];
+  int   wasStates[NUM_COLORS][NUM_COLORS];
+  int   canTakeWas[NUM_COLORS];
+  float groupReward[5];
+  int   groupStateIx[5];
+  int   dice[NUM_COLORS];
+  int   p, w, c, stateIx, best;
+  int   wasIx = 0;
+  int   bestAction, bestStateIx;
+  float bestReward, wasW = 0.0f;
+  float minReward;
+
+  if (isGameOver((QwixxState *) state))
+  {
+    return -1;
+  }
+
+  if (w2 < w1)
+  {
+    SWAP_INT(w1, w2);
+  }
+  w       = w1 + w2;
+  p       = state->numPenalties;
+  dice[RED   ] = r;
+  dice[YELLOW] = y;
+  dice[GREEN ] = g;
+  dice[BLUE  ] = b;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    colorStates[c] = colorStateTo62State((QColorState *) &state->color[c]);
+  }
+  stateIx = p              * ROW_STATES_4   +
+            colorStates[0] * ROW_STATES_3   +
+            colorStates[1] * ROW_STATES_2   +
+            colorStates[2] * NUM_ROW_STATES +
+            colorStates[3];
+
+  // PENALTY and the white sum as each color
+  groupReward [PENALTY] = isGameOverIx(colorStates, p + 1) ?
+                          (float) getScoreFromIx(colorStates, p + 1) :
+                          lookupWforStateOpt(p + 1, colorStates[RED], colorStates[YELLOW],
+                                             colorStates[GREEN], colorStates[BLUE], NULL);
+  groupStateIx[PENALTY] = stateIx + ROW_STATES_4;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    groupReward[WHITE_AS_RED + c] = ACTION_ILLEGAL;
+    canTakeWas[c] = 0;
+    if (canTakeMarkQuiet(c, w, p, colorStates, &wasIx, wasStates[c], &wasW))
+    {
+      groupReward [WHITE_AS_RED + c] = wasW;
+      groupStateIx[WHITE_AS_RED + c] = wasIx;
+      canTakeWas[c] = ! isGameOverIx(wasStates[c], p);
+    }
+  }
+  best        = bestActionInGroup(groupReward, 0);
+  bestAction  = best;
+  bestReward  = groupReward[best];
+  bestStateIx = groupStateIx[best];
+  minReward   = groupMinReward(groupReward);
+
+  // Then each colored die in turn: its normal group and, when its sum with a
+  // white die may lock the color, the group with the other white die. A die
+  // only replaces the best action so far if it is strictly better.
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    int   d          = dice[c];
+    int   isUp       = (colorDirection[c] == UP);
+    int   groupStart = isUp ? LOW_RED_ONLY + 5*c : HI_GREEN_ONLY + 5*(c - GREEN);
+    int   lockStart  = isUp ? HI_RED_ONLY  + 5*c : LOW_GREEN_ONLY + 5*(c - GREEN);
+    int   dieAction, dieStateIx;
+    float dieReward;
+
+    decideDieGroup(c, isUp ? w1 + d : w2 + d, isUp ? w2 + d : w1 + d, p,
+                   colorStates, wasStates, canTakeWas, groupReward, groupStateIx);
+    best       = bestActionInGroup(groupReward, 0);
+    dieAction  = groupStart + best;
+    dieReward  = groupReward[best];
+    dieStateIx = groupStateIx[best];
+    minReward  = fminf(minReward, groupMinReward(groupReward));
+
+    if (isUp ? (d == 6 && w2 == 6) : (d == 1 && w1 == 1))
+    {
+      decideDieGroup(c, isUp ? w2 + d : w1 + d, isUp ? w1 + d : w2 + d, p,
+                     colorStates, wasStates, canTakeWas, groupReward, groupStateIx);
+      best      = bestActionInGroup(groupReward, 0);
+      minReward = fminf(minReward, groupMinReward(groupReward));
+      if (groupReward[best] > dieReward)
+      {
+        dieAction  = lockStart + best;
+        dieReward  = groupReward[best];
+        dieStateIx = groupStateIx[best];
+      }
+    }
+
+    if (dieReward > bestReward)
+    {
+      bestAction  = dieAction;
+      bestReward  = dieReward;
+      bestStateIx = dieStateIx;
+    }
+  }
+
+  // Illegal actions are ACTION_ILLEGAL, so only a missing W is below that
+  if (minReward < ACTION_ILLEGAL)
+  {
+    return -1;
+  }
+
+  // constructStateFromIx() only fills in the marks and penalties
+  if (next != state)
+  {
+    *next = *state;
+  }
+  constructStateFromIx(bestStateIx, next);
+  if (reward)
+  {
+    *reward = bestReward;
+  }
+  return bestAction;
+}
+
+// Penalty lanes
+//
+// The Markov states (rygb, 0), (rygb, 1), (rygb, 2) and (rygb, 3) have the
+// same colors, so every mark is legal (or not) for all of them alike and leads
+// to the same successor color state. Only the Wvec[] layer of the successor
+// (a stride of NUM_FOUR_COLOR_STATES) and the PENALTY action differ. The
+// penalty lanes generate mode evaluates all 4 of them in one pass: the
+// legality checks and index calculations are done once per color state, and
+// the action values are handled as 4-wide vectors (one lane per number of
+// penalties).
+//
+// The vectors need a power of 2 lanes, so with rules that end the game after
+// fewer than 4 penalties the last lanes are unused (their values are 0), and
+// with more than 4 they are 8 lanes wide.
+#if NUM_PENALTIES_TO_END <= 4
+#define NUM_PENALTY_LANES 4
+#else
+#define NUM_PENALTY_LANES 8
+#endif
+
+// A vector with all lanes set to val
+#define PENALTY_LANES_ALL(val) ((PenaltyLanes) {0} + (val))
+
+typedef double    PenaltyLanes    __attribute__((vector_size(NUM_PENALTY_LANES * sizeof(double))));
+typedef long long PenaltyLaneMask __attribute__((vector_size(NUM_PENALTY_LANES * sizeof(long long))));
+
+// Lane by lane best = max(best, val). This is a macro (rather than a function
+// taking vectors by value) so the ABI of the vector types never matters.
+#define MAX_LANES(best, val)                                                  \
+do {                                                                          \
+  PenaltyLaneMask valIsBigger = (PenaltyLaneMask) ((val) > (best));           \
+  best = (PenaltyLanes) (((PenaltyLaneMask) (val) &  valIsBigger) |           \
+                         ((PenaltyLaneMask) (best) & ~valIsBigger));          \
+} while (0)
+
+// Same as canTakeMark(), but returns the W value of the new state for all 4
+// numbers of penalties. Each lane is calculated with the exact same float
+// arithmetic as canTakeMark() so that the results are bit-identical.
+static inline int canTakeMarkLanes(int color, int diceVal,
+                                   int colorStates[],       // the [0-61] color state for each of the 4 colors (INPUT)
+                                   // Outputs
+                                   int           newColorStates[],
+                                   PenaltyLanes *newStateW)
+{
+  int   direction = colorDirection[color];
+  int   clipped[NUM_COLORS];
+  int   numLocked = 0;
+  int   c, p, ix;
+  float offset    = 0.0f;
+  int   isClipped = 0;
+
+  if (! ((colorLegalSums[direction][colorStates[color]] >> diceVal) & 1))
+  {
+    return 0;
+  }
+
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    newColorStates[c] = colorStates[c];
+  }
+  newColorStates[color] = colorNext62[direction][colorStates[color]][diceVal];
+
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    numLocked += (newColorStates[c] >= 56);
+    clipped[c] = newColorStates[c];
+    if (clipped[c] > 56)
+    {
+      // Added up in color order, the same as getWforStateOpt()
+      offset    += clippedStateOffset[clipped[c] - 57];
+      isClipped  = 1;
+      clipped[c] = 56;
+    }
+  }
+
+  if (numLocked >= NUM_LOCKS_TO_END)
+  {
+    int score = getScoreFromIx(newColorStates, 0);
+    for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+    {
+      (*newStateW)[p] = (float) (score - PENALTY_POINTS * p);
+    }
+  }
+  else
+  {
+    ix = convertClipped5tupleToIx(clipped[RED], clipped[YELLOW], clipped[GREEN], clipped[BLUE], 0);
+    for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+    {
+      float w = Wvec[ix + p * NUM_FOUR_COLOR_STATES];
+      (*newStateW)[p] = isClipped ? (w + offset) : w;
+    }
+  }
+  for (p = NUM_PENALTIES_TO_END; p < NUM_PENALTY_LANES; p++)
+  {
+    (*newStateW)[p] = 0.0;
+  }
+
+  return 1;
+}
+
+// Lazily filled cache of canTakeMarkLanes() results for one color state,
+// organized like SuccessorCache.
+typedef struct
+{
+  char         singleStatus  [NUM_COLORS][13];
+  char         afterWasStatus[13][NUM_COLORS][NUM_COLORS][13];
+  PenaltyLanes singleW       [NUM_COLORS][13];
+  PenaltyLanes afterWasW     [13][NUM_COLORS][NUM_COLORS][13];
+} LaneSuccessorCache;
+
+static inline int takeMarkLanesCached(char *status, PenaltyLanes *cachedW,
+                                      int color, int diceVal, int colorStates[],
+                                      PenaltyLanes *newStateW)
+{
+  PROFILE_CACHE(*status == SUCCESSOR_UNKNOWN)
+  if (*status == SUCCESSOR_UNKNOWN)
+  {
+    int newColorStates[NUM_COLORS];
+    *status = canTakeMarkLanes(color, diceVal, colorStates,
+                               newColorStates, cachedW) ? SUCCESSOR_LEGAL : SUCCESSOR_ILLEGAL;
+  }
+
+  if (*status == SUCCESSOR_LEGAL)
+  {
+    *newStateW = *cachedW;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Updates *best with the value of marking color with firstSum, or with
+// secondSum if firstSum can't be marked (like the CHECK_* macros of
+// analyzeMarkovState()). If wasColor >= 0, the white sum w was marked as
+// wasColor first, which led to the color states tookWasStates[].
+static inline void markInOrderLanes(PenaltyLanes *best, LaneSuccessorCache *cache, int w, int wasColor,
+                                    int tookWasStates[], int colorStates[],
+                                    int color, int firstSum, int secondSum)
+{
+  PenaltyLanes newStateW;
+  int          diceVal = firstSum;
+  int          tries;
+
+  for (tries = 0; tries < 2; tries++, diceVal = secondSum)
+  {
+    int legal = (wasColor < 0) ?
+      takeMarkLanesCached(&cache->singleStatus[color][diceVal], &cache->singleW[color][diceVal],
+                          color, diceVal, colorStates, &newStateW) :
+      takeMarkLanesCached(&cache->afterWasStatus[w][wasColor][color][diceVal],
+                          &cache->afterWasW     [w][wasColor][color][diceVal],
+                          color, diceVal, tookWasStates, &newStateW);
+    if (legal)
+    {
+      MAX_LANES(*best, newStateW);
+      break;
+    }
+  }
+}
+
+// Penalty lane version of analyzeMarkovState() in generate mode: calculates
+// Wvec[] of the Markov states (rygbState, p) for p = 0..3. Successor states
+// with more marks must already be calculated for all 4 layers. (With other
+// rules, 0..NUM_PENALTIES_TO_END-1.)
+//
+// The successor values and the best action value for each face of each
+// colored die are calculated once, as vectors. Then the lanes are finished in
+// p = 3..0 order, since the PENALTY action of lane p needs the result of lane
+// p+1. Both kernels add up the exact same values in the exact same order as
+// analyzeMarkovState(), so Wvec[] is bit-identical.
+static void analyzePenaltyLanes(int rygbState)
+{
+  const double inv6_to6 = 1.0 / (6*6*6*6*6*6);
+
+  // The 21 white pairs w1 <= w2
+  PenaltyLanes whiteBest[21];
+  PenaltyLanes dieBest  [21][NUM_COLORS][6];
+  double       pScale   [21];
+
+  int                RYGB[NUM_COLORS];
+  int                tookWas   [NUM_COLORS][NUM_COLORS];
+  int                canTakeWas[NUM_COLORS];
+  LaneSuccessorCache successors;
+  int                ry, gb;
+  int                w1, w2, pair, c, c1, d, p;
+
+  quadToC12C34(rygbState, &ry, &gb);
+  RYGB[0] = dualToC1[ry];
+  RYGB[1] = dualToC2[ry];
+  RYGB[2] = dualToC1[gb];
+  RYGB[3] = dualToC2[gb];
+
+  if (isGameOverIx(RYGB, 0))
+  {
+    for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+    {
+      Wvec[p * NUM_FOUR_COLOR_STATES + rygbState] = WVEC_END_OF_GAME;
+    }
+    return;
+  }
+
+  memset(successors.singleStatus,   SUCCESSOR_UNKNOWN, sizeof(successors.singleStatus));
+  memset(successors.afterWasStatus, SUCCESSOR_UNKNOWN, sizeof(successors.afterWasStatus));
+
+  pair = 0;
+  for (w1 = 1; w1 <= 6; w1++)
+  {
+    for (w2 = w1; w2 <= 6; w2++, pair++)
+    {
+      int w = w1 + w2;
+
+      pScale[pair] = (w1 == w2) ? inv6_to6 : (2*inv6_to6);
+
+      // White sum as each of the colors
+      whiteBest[pair] = PENALTY_LANES_ALL(-1e9);
+      for (c1 = 0; c1 < NUM_COLORS; c1++)
+      {
+        PenaltyLanes wasW;
+        canTakeWas[c1] = 0;
+        if (canTakeMarkLanes(c1, w, RYGB, tookWas[c1], &wasW))
+        {
+          MAX_LANES(whiteBest[pair], wasW);
+          canTakeWas[c1]  = ! isGameOverIx(tookWas[c1], 0);
+        }
+      }
+
+      // Best action that uses colored die c showing d
+      for (c = 0; c < NUM_COLORS; c++)
+      {
+        for (d = 1; d <= 6; d++)
+        {
+          // Red and yellow try the low sum first, green and blue the high one
+          int firstSum  = (colorDirection[c] == UP) ? w1 + d : w2 + d;
+          int secondSum = (colorDirection[c] == UP) ? w2 + d : w1 + d;
+          // The other order only matters when it may lock the color
+          int lockOrder = (colorDirection[c] == UP) ? (d == 6 && w2 == 6) : (d == 1 && w1 == 1);
+          PenaltyLanes best = PENALTY_LANES_ALL(-1e9);
+
+          markInOrderLanes(&best, &successors, w, -1, NULL, RYGB, c, firstSum, secondSum);
+          for (c1 = 0; c1 < NUM_COLORS; c1++)
+          {
+            if (canTakeWas[c1])
+            {
+              markInOrderLanes(&best, &successors, w, c1, tookWas[c1], RYGB, c, firstSum, secondSum);
+            }
+          }
+          if (lockOrder)
+          {
+            markInOrderLanes(&best, &successors, w, -1, NULL, RYGB, c, secondSum, firstSum);
+            for (c1 = 0; c1 < NUM_COLORS; c1++)
+            {
+              if (canTakeWas[c1])
+              {
+                markInOrderLanes(&best, &successors, w, c1, tookWas[c1], RYGB, c, secondSum, firstSum);
+              }
+            }
+          }
+          dieBest[pair][c][d-1] = best;
+        }
+      }
+    }
+  }
+
+  for (p = NUM_PENALTIES_TO_END - 1; p >= 0; p--)
+  {
+    // Reads Wvec[] of lane p+1, which was just written
+    double penaltyW         = getWforIx(RYGB, p + 1, NULL);
+    double theWnext         = 0.0;
+    double theWnextFactored = 0.0;
+    int    s                = p * NUM_FOUR_COLOR_STATES + rygbState;
+
+    for (pair = 0; pair < 21; pair++)
+    {
+      double whiteW = (whiteBest[pair][p] > penaltyW) ? whiteBest[pair][p] : penaltyW;
+      double laneDieBest[NUM_COLORS][6];
+      int    r, y, g, b;
+
+      for (c = 0; c < NUM_COLORS; c++)
+      {
+        for (d = 0; d < 6; d++)
+        {
+          laneDieBest[c][d] = dieBest[pair][c][d][p];
+        }
+      }
+
+      // The nested and factored kernels only; main() doesn't allow the
+      // others with penalty lanes
+      if (generateKernel == KERNEL_NESTED)
+      {
+        for (r = 0; r < 6; r++)
+        {
+          double bestThruRed = (laneDieBest[RED][r] > whiteW) ? laneDieBest[RED][r] : whiteW;
+          for (y = 0; y < 6; y++)
+          {
+            double bestThruYellow = (laneDieBest[YELLOW][y] > bestThruRed) ? laneDieBest[YELLOW][y] : bestThruRed;
+            for (g = 0; g < 6; g++)
+            {
+              double bestThruGreen = (laneDieBest[GREEN][g] > bestThruYellow) ? laneDieBest[GREEN][g] : bestThruYellow;
+              for (b = 0; b < 6; b++)
+              {
+                double bestThruBlue = (laneDieBest[BLUE][b] > bestThruGreen) ? laneDieBest[BLUE][b] : bestThruGreen;
+                theWnext += bestThruBlue * pScale[pair];
+              }
+            }
+          }
+        }
+      }
+      else
+      {
+        theWnextFactored += sumOfMaxOverColoredDice(whiteW, laneDieBest) * pScale[pair];
+      }
+    }
+
+    Wvec[s] = (generateKernel == KERNEL_FACTORED) ? theWnextFactored : theWnext;
+  }
+} // end analyzePenaltyLanes()
+
+// Number of values that the sum of the four clipped (0-56) color state indices
+// of a Markov state can take.
+#define NUM_COLOR_SUM_LEVELS (NUM_COLORS*(NUM_SINGLE_COLOR_STATES-1) + 1)    // 225
+
+// Every action other than PENALTY marks at least one box, which strictly
+// increases the clipped state index of the marked color. PENALTY keeps the
+// colors and moves to the next penalty layer. So a Markov state only ever
+// reads Wvec[] of states in a later penalty layer, or of states in the same
+// penalty layer with a larger color index sum. Grouping the states by
+// (penalties, color index sum) therefore gives "wavefronts" of states that
+// don't depend on each other, and only depend on earlier wavefronts.
+#define NUM_WAVEFRONT_LEVELS (NUM_PENALTIES_TO_END * NUM_COLOR_SUM_LEVELS)  // 900
+
+// Number of states a worker claims at a time from a work queue
+#define WAVEFRONT_CHUNK 8
+
+// Wavefront level (0 is evaluated first) of a color state within its penalty
+// layer. This is also the level of a color state in penalty lanes mode, where
+// all 4 layers of a color state are evaluated together.
+static inline int colorStateLevel(int rygbState)
+{
+  int ry, gb, colorSum;
+
+  quadToC12C34(rygbState, &ry, &gb);
+  colorSum = dualToC1[ry] + dualToC2[ry] + dualToC1[gb] + dualToC2[gb];
+  return NUM_COLOR_SUM_LEVELS - 1 - colorSum;
+}
+
+// Wavefront level (0 is evaluated first) of a Markov state that isn't the end
+// of the game
+static inline int markovStateLevel(int s)
+{
+  int numPenalties = s / NUM_FOUR_COLOR_STATES; // integer division
+  int rygbState    = s % NUM_FOUR_COLOR_STATES;
+
+  return (NUM_PENALTIES_TO_END - 1 - numPenalties) * NUM_COLOR_SUM_LEVELS + colorStateLevel(rygbState);
+}
+
+// One worker's share of a wavefront level. Each worker starts on its own
+// share and steals chunks from the other workers' shares once it runs out.
+// Padded to a cache line so workers don't fight over each other's cursors.
+typedef struct
+{
+  int  next; // next unclaimed position in levelStates[] (updated atomically)
+  int  stop; // one past the last position of this share
+  char pad[64 - 2*sizeof(int)];
+} WavefrontQueue;
+
+typedef struct
+{
+  int               numThreads;
+  int               penaltyLanes;                        // 1: levelStates[] holds color states for analyzePenaltyLanes()
+  int               numLevels;
+  int               firstLevel;                          // > 0 when resuming from a checkpoint
+  int               numIterations;                       // for checkpoints
+  int               quiet;                               // 1: no per level output, telemetry or checkpoints
+  int              *levelStates;                         // state indices, grouped by level
+  int               levelStart[NUM_WAVEFRONT_LEVELS + 1]; // levelStates[] range of each level
+  WavefrontQueue   *queues;                              // [NUM_WAVEFRONT_LEVELS][numThreads]
+  pthread_barrier_t levelDone;
+  pthread_barrier_t checkpointDone;                      // only used with checkpoints
+} WavefrontJob;
+
+typedef struct
+{
+  WavefrontJob *job;
+  int           threadIx;
+} WavefrontWorkerArgs;
+
+// Claim up to WAVEFRONT_CHUNK states from a queue and analyze them. Returns 0
+// if the queue was already empty.
+static int wavefrontRunChunk(WavefrontJob *job, WavefrontQueue *queue, int threadIx)
+{
+  int ix     = __atomic_fetch_add(&queue->next, WAVEFRONT_CHUNK, __ATOMIC_RELAXED);
+  int ixStop = ix + WAVEFRONT_CHUNK;
+
+  if (ix >= queue->stop)
+  {
+    return 0;
+  }
+  if (ixStop > queue->stop)
+  {
+    ixStop = queue->stop;
+  }
+  progressAdd(threadIx, (ixStop - ix) * (job->penaltyLanes ? NUM_PENALTIES_TO_END : 1));
+
+  for (; ix < ixStop; ix++)
+  {
+    if (job->penaltyLanes)
+    {
+      analyzePenaltyLanes(job->levelStates[ix]);
+    }
+    else
+    {
+      analyzeMarkovState(NULL, job->levelStates[ix], 0, 0, 0, 0, 0, 0, 0, NULL);
+    }
+  }
+
+  return 1;
+}
+
+static void *wavefrontWorker(void *arg)
+{
+  WavefrontWorkerArgs *args = (WavefrontWorkerArgs *) arg;
+  WavefrontJob        *job  = args->job;
+  int                  level;
+
+  for (level = job->firstLevel; level < job->numLevels; level++)
+  {
+    WavefrontQueue *queues = &job->queues[level * job->numThreads];
+    int             victim;
+
+    // Work through our own share first, then steal from everybody else
+    while (wavefrontRunChunk(job, &queues[args->threadIx], args->threadIx))
+      ;
+    for (victim = 1; victim < job->numThreads; victim++)
+    {
+      while (wavefrontRunChunk(job, &queues[(args->threadIx + victim) % job->numThreads], args->threadIx))
+        ;
+    }
+
+    // Wvec[] writes of this level must be visible before the next level starts
+    if (pthread_barrier_wait(&job->levelDone) == PTHREAD_BARRIER_SERIAL_THREAD && ! job->quiet)
+    {
+      if (job->levelStart[level + 1] != job->levelStart[level])
+      {
+        int statesPerEntry = job->penaltyLanes ? NUM_PENALTIES_TO_END : 1;
+        printf("% 8d / % 8d states complete\n", job->levelStart[level + 1] * statesPerEntry + 1, NUM_MARKOV_STATES);
+      }
+
+      if (! job->penaltyLanes && level + 1 < job->numLevels && (level + 1) % NUM_COLOR_SUM_LEVELS == 0)
+      {
+        progressLayer(NUM_PENALTIES_TO_END - 1 - (level + 1) / NUM_COLOR_SUM_LEVELS);
+      }
+
+      if (checkpointDue())
+      {
+        takeCheckpoint(job->penaltyLanes ? CHECKPOINT_PENALTY_LANES : CHECKPOINT_WAVEFRONT,
+                       job->numIterations, level + 1);
+      }
+    }
+
+    // With checkpoints, hold everybody until the snapshot of Wvec[] is taken
+    if (checkpointIntervalSec > 0 && ! job->quiet)
+    {
+      pthread_barrier_wait(&job->checkpointDone);
+    }
+  }
+
+  return NULL;
+}
+
+// Evaluate the levels of a job whose levelStates[] and levelStart[] are filled
+// in, with a pool of job->numThreads workers
+static void runWavefrontJob(WavefrontJob *job)
+{
+  pthread_t           *threads;
+  WavefrontWorkerArgs *args;
+  int                  level, t;
+
+  job->queues = malloc(sizeof(WavefrontQueue) * NUM_WAVEFRONT_LEVELS * job->numThreads);
+  threads     = malloc(sizeof(pthread_t) * job->numThreads);
+  args        = malloc(sizeof(WavefrontWorkerArgs) * job->numThreads);
+  if (job->queues == NULL || threads == NULL || args == NULL)
+  {
+    printf("Error allocating wavefront work queues! Aborting!\n");
+    exit(-1);
+  }
+
+  // Give every worker an even share of every level to start with
+  for (level = 0; level < job->numLevels; level++)
+  {
+    int levelSize = job->levelStart[level + 1] - job->levelStart[level];
+    for (t = 0; t < job->numThreads; t++)
+    {
+      WavefrontQueue *queue = &job->queues[level * job->numThreads + t];
+      queue->next = job->levelStart[level] + (int) ((long long) levelSize *  t      / job->numThreads);
+      queue->stop = job->levelStart[level] + (int) ((long long) levelSize * (t + 1) / job->numThreads);
+    }
+  }
+
+  pthread_barrier_init(&job->levelDone,      NULL, job->numThreads);
+  pthread_barrier_init(&job->checkpointDone, NULL, job->numThreads);
+  for (t = 0; t < job->numThreads; t++)
+  {
+    args[t].job      = job;
+    args[t].threadIx = t;
+    if (pthread_create(&threads[t], NULL, wavefrontWorker, &args[t]) != 0)
+    {
+      printf("Error creating worker thread %d! Aborting!\n", t);
+      exit(-1);
+    }
+  }
+  for (t = 0; t < job->numThreads; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  pthread_barrier_destroy(&job->levelDone);
+  pthread_barrier_destroy(&job->checkpointDone);
+
+  free(args);
+  free(threads);
+  free(job->queues);
+}
+
+// Multi-threaded version of analyzeState(NULL, num_iterations, ...). The
+// Markov states are split into wavefront levels (see NUM_WAVEFRONT_LEVELS)
+// and each level is evaluated by a pool of num_threads workers. Every state
+// is calculated exactly the same way as in the single threaded loop, so the
+// resulting Wvec[] is bit-identical.
+//
+// With penalty_lanes, the workers run analyzePenaltyLanes() on color states
+// instead, and only the color sum levels are needed. A cut short run then
+// covers the last num_iterations/NUM_PENALTIES_TO_END color states of every
+// penalty layer.
+static void generateWvecThreaded(int num_iterations, int num_threads, int penalty_lanes)
+{
+  WavefrontJob job;
+  int          s, s2, level;
+  int          sStop = penalty_lanes ? NUM_FOUR_COLOR_STATES : NUM_MARKOV_STATES - 1;
+
+  // Same cut-short semantics as analyzeState()
+  s2 = 0;
+  if (num_iterations > 0)
+  {
+    s2 = penalty_lanes ? (NUM_FOUR_COLOR_STATES - num_iterations / NUM_PENALTIES_TO_END) :
+                         (NUM_MARKOV_STATES     - num_iterations);
+    if (s2 < 0)
+    {
+      s2 = 0;
+    }
+  }
+
+  // The 4 penalty "end of game" state
+  Wvec[NUM_MARKOV_STATES - 1] = WVEC_END_OF_GAME;
+
+  memset(&job, 0, sizeof(job));
+  job.numThreads   = num_threads;
+  job.penaltyLanes = penalty_lanes;
+  job.numLevels    = penalty_lanes ? NUM_COLOR_SUM_LEVELS : NUM_WAVEFRONT_LEVELS;
+  job.numIterations = num_iterations;
+  if (checkpointResumePosition >= 0)
+  {
+    job.firstLevel = checkpointResumePosition;
+  }
+  job.levelStates = malloc(sizeof(int) * NUM_MARKOV_STATES);
+  if (job.levelStates == NULL)
+  {
+    printf("Error allocating wavefront work queues! Aborting!\n");
+    exit(-1);
+  }
+
+  // Bucket the states by level (counting sort)
+  for (s = s2; s < sStop; s++)
+  {
+    job.levelStart[(penalty_lanes ? colorStateLevel(s) : markovStateLevel(s)) + 1]++;
+  }
+  for (level = 0; level < job.numLevels; level++)
+  {
+    job.levelStart[level + 1] += job.levelStart[level];
+  }
+  for (s = sStop - 1; s >= s2; s--)
+  {
+    level = penalty_lanes ? colorStateLevel(s) : markovStateLevel(s);
+    job.levelStates[job.levelStart[level]++] = s;
+  }
+  for (level = job.numLevels; level > 0; level--)
+  {
+    job.levelStart[level] = job.levelStart[level - 1];
+  }
+  job.levelStart[0] = 0;
+
+  progressStart((long long) job.levelStart[job.numLevels] * (penalty_lanes ? NUM_PENALTIES_TO_END : 1),
+                (long long) job.levelStart[job.firstLevel] * (penalty_lanes ? NUM_PENALTIES_TO_END : 1), num_threads);
+  if (! penalty_lanes && job.firstLevel < job.numLevels)
+  {
+    progressLayer(NUM_PENALTIES_TO_END - 1 - job.firstLevel / NUM_COLOR_SUM_LEVELS);
+  }
+
+  runWavefrontJob(&job);
+  progressStop();
+
+  free(job.levelStates);
+}
+
+// Sharded generate (--shards)
+//
+// generateWvecSharded() runs generate mode in num_shards worker processes
+// instead of threads. Wvec[] and the bookkeeping below live in a shared
+// mapping that the workers inherit, so a worker's finished states are simply
+// there for the others to read. The states are split into slices, one per
+// penalty layer p and color sum level (see NUM_WAVEFRONT_LEVELS), and every
+// slice is divided among the shards in WAVEFRONT_CHUNK state chunks.
+//
+// Slice (p, L) reads slices (p, 0..L-1), and (p+1, L) through PENALTY. So it
+// can start as soon as (p, L-1) and (p+1, L) are done, without waiting for
+// the rest of layer p+1: the shards go through the slices in diagonals
+// d = L + (NUM_PENALTIES_TO_END - 1 - p), and layer p runs one level behind
+// layer p+1. That is NUM_COLOR_SUM_LEVELS + NUM_PENALTIES_TO_END - 1 steps
+// instead of the wavefront's NUM_WAVEFRONT_LEVELS, with the small slices at
+// the start and end of each layer overlapping bigger ones.
+//
+// The parent process only waits: it reports progress as slices finish, and
+// once every worker has exited it checks that every shard finished every
+// slice before qwixx.bin is written (the merge). If a worker fails, the
+// others are killed and the run is aborted. The mutex is robust, so a worker
+// that dies holding it doesn't hang the others: their next lock fails with
+// EOWNERDEAD, which counts as a failed shard too.
+typedef struct
+{
+  pthread_mutex_t mutex;     // process-shared and robust
+  pthread_cond_t  sliceDone; // broadcast whenever a done[][] count goes up
+  int             numShards;
+  int             done[NUM_PENALTIES_TO_END][NUM_COLOR_SUM_LEVELS]; // shards finished with each slice
+  double          kernelCheckMaxDiff     [2]; // --kernel check: kernelCheckMaxDiff[] over all the shards
+  int             kernelCheckMaxDiffState[2];
+} ShardSync;
+
+// Where Wvec[] starts in the shared mapping, a cache line after ShardSync
+#define SHARD_WVEC_OFFSET ((sizeof(ShardSync) + 63) / 64 * 64)
+
+typedef struct
+{
+  ShardSync *sync;
+  int       *levelStates;                          // state indices, grouped by wavefront level
+  int        levelStart[NUM_WAVEFRONT_LEVELS + 1]; // levelStates[] range of each level
+} ShardJob;
+
+// Wait until every shard has finished slice (p, L). Slices outside the
+// layers and levels are done.
+static void shardWaitForSlice(ShardSync *sync, int p, int L)
+{
+  if (p >= NUM_PENALTIES_TO_END || L < 0)
+  {
+    return;
+  }
+  if (pthread_mutex_lock(&sync->mutex) != 0)
+  {
+    _exit(1); // another shard died holding the lock
+  }
+  while (sync->done[p][L] < sync->numShards)
+  {
+    if (pthread_cond_wait(&sync->sliceDone, &sync->mutex) != 0)
+    {
+      _exit(1);
+    }
+  }
+  pthread_mutex_unlock(&sync->mutex);
+}
+
+// Body of worker process shardIx. Prints how long it computed and how long it
+// waited for the other shards.
+static void runShard(ShardJob *job, int shardIx)
+{
+  ShardSync      *sync      = job->sync;
+  int             numShards = sync->numShards;
+  double          waitSec   = 0.0;
+  struct timespec start, mark, now;
+  int             d, p, L, ix;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (d = 0; d < NUM_COLOR_SUM_LEVELS + NUM_PENALTIES_TO_END - 1; d++)
+  {
+    for (p = NUM_PENALTIES_TO_END - 1; p >= 0; p--)
+    {
+      int level, ixStop;
+
+      L = d - (NUM_PENALTIES_TO_END - 1 - p);
+      if (L < 0 || L >= NUM_COLOR_SUM_LEVELS)
+      {
+        continue;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &mark);
+      shardWaitForSlice(sync, p, L - 1);
+      shardWaitForSlice(sync, p + 1, L);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      waitSec += (now.tv_sec - mark.tv_sec) + 1e-9 * (now.tv_nsec - mark.tv_nsec);
+
+      // This shard's chunks of the slice
+      level  = (NUM_PENALTIES_TO_END - 1 - p) * NUM_COLOR_SUM_LEVELS + L;
+      ixStop = job->levelStart[level + 1];
+      for (ix = job->levelStart[level] + shardIx * WAVEFRONT_CHUNK; ix < ixStop; ix += numShards * WAVEFRONT_CHUNK)
+      {
+        int k;
+        for (k = ix; k < ix + WAVEFRONT_CHUNK && k < ixStop; k++)
+        {
+          analyzeMarkovState(NULL, job->levelStates[k], 0, 0, 0, 0, 0, 0, 0, NULL);
+        }
+      }
+
+      if (pthread_mutex_lock(&sync->mutex) != 0)
+      {
+        _exit(1); // another shard died holding the lock
+      }
+      sync->done[p][L]++;
+      pthread_cond_broadcast(&sync->sliceDone);
+      pthread_mutex_unlock(&sync->mutex);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  printf("Shard %d done: %.2f seconds, %.2f of them waiting for other shards\n", shardIx,
+         (now.tv_sec - start.tv_sec) + 1e-9 * (now.tv_nsec - start.tv_nsec), waitSec);
+
+  // The parent prints the kernel check of all the shards
+  if (generateKernel == KERNEL_CHECK)
+  {
+    int k;
+    if (pthread_mutex_lock(&sync->mutex) != 0)
+    {
+      _exit(1); // another shard died holding the lock
+    }
+    for (k = 0; k < 2; k++)
+    {
+      if (kernelCheckMaxDiffState[k] >= 0 &&
+          (sync->kernelCheckMaxDiffState[k] < 0 || kernelCheckMaxDiff[k] > sync->kernelCheckMaxDiff[k]))
+      {
+        sync->kernelCheckMaxDiff     [k] = kernelCheckMaxDiff     [k];
+        sync->kernelCheckMaxDiffState[k] = kernelCheckMaxDiffState[k];
+      }
+    }
+    pthread_mutex_unlock(&sync->mutex);
+  }
+}
+
+// Kill the workers that are still running, and give up
+static void abortShards(pid_t *pids, int num_shards)
+{
+  int i;
+
+  for (i = 0; i < num_shards; i++)
+  {
+    if (pids[i] > 0)
+    {
+      kill(pids[i], SIGKILL);
+      waitpid(pids[i], NULL, 0);
+    }
+  }
+  printf("Sharded generate failed! Aborting!\n");
+  exit(-1);
+}
+
+// Same as analyzeState(NULL, num_iterations, ...), in num_shards worker
+// processes. Replaces Wvec[] with one in shared memory; the values are
+// bit-identical to the other engines'.
+static void generateWvecSharded(int num_iterations, int num_shards)
+{
+  ShardJob       job;
+  ShardSync     *sync;
+  unsigned char *map;
+  size_t         mapSize = SHARD_WVEC_OFFSET + sizeof(float) * NUM_MARKOV_STATES;
+  pid_t         *pids    = calloc(num_shards, sizeof(pid_t));
+  long long      totalStates, reported = 0;
+  int            numRunning = num_shards;
+  int            s, s2, level, p, L, i;
+  pthread_mutexattr_t mutexAttr;
+  pthread_condattr_t  condAttr;
+
+  // The shared mapping: ShardSync, then Wvec[]
+  map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED || pids == NULL)
+  {
+    printf("Error allocating the shared Wvec! Aborting!\n");
+    exit(-1);
+  }
+  sync = (ShardSync *) map;
+  memset(sync, 0, sizeof(*sync));
+  sync->numShards = num_shards;
+  sync->kernelCheckMaxDiffState[0] = -1;
+  sync->kernelCheckMaxDiffState[1] = -1;
+  pthread_mutexattr_init(&mutexAttr);
+  pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&sync->mutex, &mutexAttr);
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+  pthread_cond_init(&sync->sliceDone, &condAttr);
+
+  free(Wvec);
+  Wvec = (float *) (map + SHARD_WVEC_OFFSET);
+  for (i = 0; i < NUM_MARKOV_STATES; i++)
+  {
+    Wvec[i] = WVEC_END_OF_GAME;
+  }
+
+  // Same cut-short semantics and levels as generateWvecThreaded()
+  s2 = 0;
+  if (num_iterations > 0)
+  {
+    s2 = NUM_MARKOV_STATES - num_iterations;
+    if (s2 < 0)
+    {
+      s2 = 0;
+    }
+  }
+  memset(&job, 0, sizeof(job));
+  job.sync        = sync;
+  job.levelStates = malloc(sizeof(int) * NUM_MARKOV_STATES);
+  if (job.levelStates == NULL)
+  {
+    printf("Error allocating the shard slices! Aborting!\n");
+    exit(-1);
+  }
+  for (s = s2; s < NUM_MARKOV_STATES - 1; s++)
+  {
+    job.levelStart[markovStateLevel(s) + 1]++;
+  }
+  for (level = 0; level < NUM_WAVEFRONT_LEVELS; level++)
+  {
+    job.levelStart[level + 1] += job.levelStart[level];
+  }
+  for (s = NUM_MARKOV_STATES - 2; s >= s2; s--)
+  {
+    level = markovStateLevel(s);
+    job.levelStates[job.levelStart[level]++] = s;
+  }
+  for (level = NUM_WAVEFRONT_LEVELS; level > 0; level--)
+  {
+    job.levelStart[level] = job.levelStart[level - 1];
+  }
+  job.levelStart[0] = 0;
+  totalStates       = job.levelStart[NUM_WAVEFRONT_LEVELS];
+
+  // Anything still buffered would be printed by every worker too
+  fflush(stdout);
+  for (i = 0; i < num_shards; i++)
+  {
+    pids[i] = fork();
+    if (pids[i] < 0)
+    {
+      printf("Error starting shard %d! ", i);
+      abortShards(pids, num_shards);
+    }
+    if (pids[i] == 0)
+    {
+      runShard(&job, i);
+      fflush(stdout);
+      _exit(0);
+    }
+  }
+
+  // Wait for the workers, counting the states of the finished slices
+  progressStart(totalStates, 0, 1);
+  while (numRunning > 0)
+  {
+    struct timespec deadline;
+    long long       done = 0;
+    pid_t           pid;
+    int             status, err;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec++;
+    err = pthread_mutex_lock(&sync->mutex);
+    if (err == 0)
+    {
+      err = pthread_cond_timedwait(&sync->sliceDone, &sync->mutex, &deadline);
+      err = (err == ETIMEDOUT) ? 0 : err;
+    }
+    if (err != 0)
+    {
+      printf("A shard died holding the shard lock (%s)! ", strerror(err));
+      abortShards(pids, num_shards);
+    }
+    for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+    {
+      for (L = 0; L < NUM_COLOR_SUM_LEVELS; L++)
+      {
+        if (sync->done[p][L] == num_shards)
+        {
+          level = (NUM_PENALTIES_TO_END - 1 - p) * NUM_COLOR_SUM_LEVELS + L;
+          done += job.levelStart[level + 1] - job.levelStart[level];
+        }
+      }
+    }
+    pthread_mutex_unlock(&sync->mutex);
+    progressAdd(0, (int) (done - reported));
+    if (done / 1000000 != reported / 1000000)
+    {
+      printf("% 8lld / % 8lld states complete\n", done, totalStates);
+    }
+    reported = done;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      for (i = 0; i < num_shards && pids[i] != pid; i++)
+      {
+      }
+      if (i < num_shards)
+      {
+        pids[i] = 0;
+        numRunning--;
+        if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+          printf("Shard %d failed! ", i);
+          abortShards(pids, num_shards);
+        }
+      }
+    }
+  }
+  progressStop();
+
+  // Merge: every shard has to have finished its part of every slice
+  for (p = 0; p < NUM_PENALTIES_TO_END; p++)
+  {
+    for (L = 0; L < NUM_COLOR_SUM_LEVELS; L++)
+    {
+      if (sync->done[p][L] != num_shards)
+      {
+        printf("Slice %d/%d was only finished by %d of %d shards! ", p, L, sync->done[p][L], num_shards);
+        abortShards(pids, num_shards);
+      }
+    }
+  }
+  printf("All %d shards done (%lld states)\n", num_shards, totalStates);
+  memcpy(kernelCheckMaxDiff,      sync->kernelCheckMaxDiff,      sizeof(kernelCheckMaxDiff));
+  memcpy(kernelCheckMaxDiffState, sync->kernelCheckMaxDiffState, sizeof(kernelCheckMaxDiffState));
+
+  free(job.levelStates);
+  free(pids);
+}
+
+// Lazy solver (--solve)
+//
+// A late-game position only depends on the few states that can still follow
+// it, so it doesn't need all of qwixx.bin. solveReachable() collects the
+// Markov states that can be reached from a score sheet (through PENALTY, or
+// any one or two marks a roll allows), and evaluates just those with the
+// wavefront workers, level by level. Wvec[] itself serves as the memo: each
+// value is stored where qwixx.bin has it, and is calculated by the same
+// analyzeMarkovState() as in generate mode, so it is bit-identical to a full
+// run with the same --kernel. Every state the checker can get to afterwards
+// is reachable too, so the rest of the game can be played from it.
+typedef struct
+{
+  unsigned char *seen;      // one bit per Markov state
+  int           *states;    // reachable states, in the order they were found
+  int            numStates;
+  int            capacity;
+} ReachableSet;
+
+// Add the Markov state of a (0-61 color states) state, unless the game is
+// over there or it was already found
+static void addReachable(ReachableSet *set, int colorStates[], int numPenalties)
+{
+  int s;
+
+  if (isGameOverIx(colorStates, numPenalties))
+  {
+    return;
+  }
+
+  s = convertClipped5tupleToIx((colorStates[RED   ] > 56) ? 56 : colorStates[RED   ],
+                               (colorStates[YELLOW] > 56) ? 56 : colorStates[YELLOW],
+                               (colorStates[GREEN ] > 56) ? 56 : colorStates[GREEN ],
+                               (colorStates[BLUE  ] > 56) ? 56 : colorStates[BLUE  ],
+                               numPenalties);
+  if (set->seen[s >> 3] & (1 << (s & 7)))
+  {
+    return;
+  }
+  set->seen[s >> 3] |= 1 << (s & 7);
+
+  if (set->numStates == set->capacity)
+  {
+    set->capacity *= 2;
+    set->states    = realloc(set->states, sizeof(int) * set->capacity);
+    if (set->states == NULL)
+    {
+      printf("Error allocating the reachable states! Aborting!\n");
+      exit(-1);
+    }
+  }
+  set->states[set->numStates++] = s;
+}
+
+// Add every state whose Wvec[] analyzeMarkovState(NULL, s, ...) reads
+static void addSuccessors(ReachableSet *set, int s)
+{
+  int p         = s / NUM_FOUR_COLOR_STATES; // integer division
+  int rygbState = s % NUM_FOUR_COLOR_STATES;
+  int RYGB[NUM_COLORS], afterOne[NUM_COLORS], afterTwo[NUM_COLORS];
+  int ry, gb, c1, c2, sum1, sum2;
+
+  quadToC12C34(rygbState, &ry, &gb);
+  RYGB[0] = dualToC1[ry];
+  RYGB[1] = dualToC2[ry];
+  RYGB[2] = dualToC1[gb];
+  RYGB[3] = dualToC2[gb];
+
+  addReachable(set, RYGB, p + 1);
+
+  for (c1 = 0; c1 < NUM_COLORS; c1++)
+  {
+    int direction1 = colorDirection[c1];
+    for (sum1 = 2; sum1 <= 12; sum1++)
+    {
+      if (! ((colorLegalSums[direction1][RYGB[c1]] >> sum1) & 1))
+      {
+        continue;
+      }
+      memcpy(afterOne, RYGB, sizeof(afterOne));
+      afterOne[c1] = colorNext62[direction1][RYGB[c1]][sum1];
+      addReachable(set, afterOne, p);
+
+      // A second mark (white sum, then a colored die) is only allowed if the
+      // first one didn't end the game
+      if (isGameOverIx(afterOne, p))
+      {
+        continue;
+      }
+      for (c2 = 0; c2 < NUM_COLORS; c2++)
+      {
+        int direction2 = colorDirection[c2];
+        for (sum2 = 2; sum2 <= 12; sum2++)
+        {
+          if ((colorLegalSums[direction2][afterOne[c2]] >> sum2) & 1)
+          {
+            memcpy(afterTwo, afterOne, sizeof(afterTwo));
+            afterTwo[c2] = colorNext62[direction2][afterOne[c2]][sum2];
+            addReachable(set, afterTwo, p);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Fill in Wvec[] for every state reachable from state. Returns the number of
+// states that were evaluated.
+static int solveReachable(QwixxState *state, int num_threads)
+{
+  ReachableSet set;
+  WavefrontJob job;
+  int          colorStates[NUM_COLORS];
+  int          i, level;
+
+  colorStates[RED   ] = colorStateTo62State(&state->color[RED   ]);
+  colorStates[YELLOW] = colorStateTo62State(&state->color[YELLOW]);
+  colorStates[GREEN ] = colorStateTo62State(&state->color[GREEN ]);
+  colorStates[BLUE  ] = colorStateTo62State(&state->color[BLUE  ]);
+
+  set.seen      = calloc((NUM_MARKOV_STATES + 7) / 8, 1);
+  set.capacity  = 1024;
+  set.numStates = 0;
+  set.states    = malloc(sizeof(int) * set.capacity);
+  if (set.seen == NULL || set.states == NULL)
+  {
+    printf("Error allocating the reachable states! Aborting!\n");
+    exit(-1);
+  }
+
+  // The list of states found so far is also the work list
+  addReachable(&set, colorStates, state->numPenalties);
+  for (i = 0; i < set.numStates; i++)
+  {
+    addSuccessors(&set, set.states[i]);
+  }
+
+  // Bucket the states by level (counting sort), like generateWvecThreaded()
+  memset(&job, 0, sizeof(job));
+  job.numThreads  = num_threads;
+  job.numLevels   = NUM_WAVEFRONT_LEVELS;
+  job.quiet       = 1;
+  job.levelStates = malloc(sizeof(int) * (set.numStates + 1));
+  if (job.levelStates == NULL)
+  {
+    printf("Error allocating wavefront work queues! Aborting!\n");
+    exit(-1);
+  }
+  for (i = 0; i < set.numStates; i++)
+  {
+    job.levelStart[markovStateLevel(set.states[i]) + 1]++;
+  }
+  for (level = 0; level < job.numLevels; level++)
+  {
+    job.levelStart[level + 1] += job.levelStart[level];
+  }
+  for (i = 0; i < set.numStates; i++)
+  {
+    level = markovStateLevel(set.states[i]);
+    job.levelStates[job.levelStart[level]++] = set.states[i];
+  }
+  for (level = job.numLevels; level > 0; level--)
+  {
+    job.levelStart[level] = job.levelStart[level - 1];
+  }
+  job.levelStart[0] = 0;
+
+  if (set.numStates > 0)
+  {
+    runWavefrontJob(&job);
+  }
+
+  free(job.levelStates);
+  free(set.states);
+  free(set.seen);
+
+  return set.numStates;
+}
+
+// Policy table (--export-policy, --policy)
+//
+// For every non-terminal Markov state and every white pair (w1 <= w2), the
+// best action for each of the 6^4 rolls of the colored dice follows from a
+// short list (see StateDecisions): a roll picks the first die face in the list
+// that it shows, or the white-only action if it shows none of them. The list
+// holds the die faces whose best action beats the white-only action, ordered
+// by reward (higher first) and then by color, leaving out faces that can never
+// win because some other die beats them with every face.
+//
+// Most of the time no die beats the white-only action (PENALTY or a white
+// sum), so the lists are short, and many states share the same lists. An entry
+// is 9 bits: the die face (color*6 + face-1) in the low 5 bits, and which of
+// the 10 actions of that color's two groups it picks in the upper 4 (see
+// policyEntry()). Each distinct list is stored once, as a header byte
+// (white-only action in the low 3 bits, length in the upper 5 bits) followed by
+// its entries, bit-packed. The lists are sorted by length, so a list's number
+// (its id) tells where it is.
+//
+// A state's block has a 24-bit slot for each of the 21 white pairs. A list of
+// up to 2 entries is in the slot itself (white-only action in the low 3 bits,
+// length in the next 2, then the entries); otherwise the top bit is set and the
+// rest is the list id. Distinct blocks are stored once too, so all a state
+// needs is the 24-bit number of its block. A lookup is one probe each into the
+// state's block number and its block, one more into the list if it isn't in
+// the slot, and a scan of a few entries.
+#define QWIXX_POLICY_FILENAME "qwixx.policy"
+#define QWIXX_POLICY_MAGIC    "QWIXXPOL"
+#define QWIXX_POLICY_VERSION  3
+
+#define POLICY_NUM_PAIRS     21             // white pairs with w1 <= w2
+#define POLICY_MAX_ENTRIES   (NUM_COLORS * 6)
+#define POLICY_MAX_INLINE    2              // longest list kept in its slot
+#define POLICY_SLOT_LIST     (1 << 23)      // slot bit: the rest is a list id
+#define POLICY_BLOCK_SIZE    (3 * POLICY_NUM_PAIRS)
+#define POLICY_MAX_LIST_SIZE (1 + (9 * POLICY_MAX_ENTRIES + 7) / 8)
+
+typedef struct
+{
+  char     magic[8];        // QWIXX_POLICY_MAGIC (without the terminating 0)
+  uint32_t version;         // QWIXX_POLICY_VERSION
+  uint32_t headerSize;      // sizeof(QwixxPolicyHeader); the list counts start here
+  uint32_t numMarkovStates; // NUM_MARKOV_STATES
+  uint32_t numBlocks;       // distinct blocks, after the state block numbers
+  uint32_t numLists;        // distinct lists (that aren't in a slot), after the blocks
+  uint32_t reserved;
+  uint64_t listsSize;       // bytes of distinct lists
+  uint64_t tableChecksum;   // checksum of the qwixx.bin it was made from (0 for legacy files)
+  char     pad[16];
+} QwixxPolicyHeader;
+
+typedef char QwixxPolicyHeaderIs64Bytes[(sizeof(QwixxPolicyHeader) == 64) ? 1 : -1];
+
+// The file: the header, firstListOfLength[POLICY_MAX_ENTRIES + 2] (the id of
+// the first list of each length; the last one is numLists), the 3 byte block
+// number of each Markov state (0 for game over states), the blocks, and the
+// lists.
+typedef struct
+{
+  const uint32_t      *firstListOfLength;
+  size_t               lengthOffset[POLICY_MAX_ENTRIES + 1]; // where the lists of each length start in lists[]
+  const unsigned char *stateBlock;
+  const unsigned char *blocks;
+  const unsigned char *lists;
+} QwixxPolicy;
+
+// One white pair's list, before it is packed
+typedef struct
+{
+  int      whiteAction;
+  int      numEntries;
+  uint16_t entries[POLICY_MAX_ENTRIES]; // see policyEntry()
+} PolicyList;
+
+// Index of white pair (w1, w2), w1 <= w2, in analyzeMarkovState()'s order
+static inline int policyPairIx(int w1, int w2)
+{
+  return (w1 - 1) * 6 - (w1 - 1) * (w1 - 2) / 2 + (w2 - w1);
+}
+
+// Bytes of a packed list with numEntries entries
+static inline int policyListSize(int numEntries)
+{
+  return 1 + (9 * numEntries + 7) / 8;
+}
+
+static inline uint32_t readPolicy24(const unsigned char *bytes)
+{
+  return bytes[0] | (bytes[1] << 8) | ((uint32_t) bytes[2] << 16);
+}
+
+static inline void writePolicy24(unsigned char *bytes, uint32_t val)
+{
+  bytes[0] = val;
+  bytes[1] = val >> 8;
+  bytes[2] = val >> 16;
+}
+
+// Entry for die face (color*6 + face-1) and action. The best action for a die
+// of color c is in the group that marks c first (1 + c) or second
+// (1 + NUM_COLORS + c), so 0-9 is enough for it: 5 for the second group, plus
+// the "white as" part.
+static inline uint16_t policyEntry(int face, int action)
+{
+  int group = action / 5;
+  int c     = face / 6;
+
+  if (group != 1 + c && group != 1 + NUM_COLORS + c)
+  {
+    printf("Action %d can't be the best for die face %d! Aborting!\n", action, face);
+    exit(-1);
+  }
+  return (uint16_t) (face | (((group > NUM_COLORS) ? 5 : 0) + action % 5) << 5);
+}
+
+// The action of entry (from policyEntry())
+static inline int policyEntryAction(int entry)
+{
+  int c    = (entry & 31) / 6;
+  int code = entry >> 5;
+
+  return 5 * (((code >= 5) ? 1 + NUM_COLORS : 1) + c) + code % 5;
+}
+
+// Work out the list of each white pair of one Markov state into lists[pair],
+// and count the empty lists in *numEmptyLists. Returns the number of entries
+// of all the lists.
+static int buildPolicyLists(const StateDecisions *dec, PolicyList lists[], long long *numEmptyLists)
+{
+  float entryReward[POLICY_MAX_ENTRIES];
+  int   totalEntries = 0;
+  int   pair, c, f, j, g, n;
+
+  for (pair = 0; pair < POLICY_NUM_PAIRS; pair++)
+  {
+    float     white   = dec->whiteReward[pair];
+    uint16_t *entries = lists[pair].entries;
+
+    n = 0;
+    for (c = 0; c < NUM_COLORS; c++)
+    {
+      for (f = 0; f < 6; f++)
+      {
+        float    val = dec->dieBestReward[pair][c][f];
+        int      canWin = (val > white);
+        uint16_t entry;
+
+        // Can some roll of the other dice leave this face on top?
+        for (j = 0; j < NUM_COLORS && canWin; j++)
+        {
+          int numLosingFaces = 0;
+          if (j == c)
+          {
+            continue;
+          }
+          for (g = 0; g < 6; g++)
+          {
+            float other = dec->dieBestReward[pair][j][g];
+            numLosingFaces += (j < c) ? (other < val) : (other <= val);
+          }
+          canWin = (numLosingFaces > 0);
+        }
+        if (! canWin)
+        {
+          continue;
+        }
+
+        // Insert in order: higher reward first, then lower color. Faces are
+        // added in color order, so equal rewards just go after each other.
+        entry = policyEntry(c * 6 + f, dec->dieBestAction[pair][c][f]);
+        for (j = n; j > 0 && entryReward[j - 1] < val; j--)
+        {
+          entries    [j] = entries    [j - 1];
+          entryReward[j] = entryReward[j - 1];
+        }
+        entries    [j] = entry;
+        entryReward[j] = val;
+        n++;
+      }
+    }
+
+    *numEmptyLists          += (n == 0);
+    totalEntries            += n;
+    lists[pair].whiteAction  = dec->whiteAction[pair];
+    lists[pair].numEntries   = n;
+  }
+
+  return totalEntries;
+}
+
+// Pack list into bytes[]. Returns its size.
+static int packPolicyList(const PolicyList *list, unsigned char bytes[])
+{
+  int size = policyListSize(list->numEntries);
+  int i;
+
+  memset(bytes, 0, size);
+  bytes[0] = (unsigned char) (list->whiteAction | (list->numEntries << 3));
+  for (i = 0; i < list->numEntries; i++)
+  {
+    int      bit = 8 + 9 * i;
+    uint16_t val = list->entries[i] << (bit & 7);
+    bytes[bit >> 3]       |= val & 0xff;
+    bytes[(bit >> 3) + 1] |= val >> 8;
+  }
+
+  return size;
+}
+
+// Items stored back to back in data[], each only once, and numbered in the
+// order they were added. slots[] is an open addressing hash table of the
+// items: the upper 32 bits of the item's hash and its number + 1 in the lower
+// 32 bits (0 for an empty slot).
+typedef struct
+{
+  unsigned char *data;
+  size_t         size;
+  size_t         capacity;
+  uint32_t      *itemOffset; // [numItems], into data[]
+  size_t         itemCapacity;
+  uint64_t      *slots;
+  size_t         numSlots;   // a power of 2
+  size_t         numItems;
+} PolicyPool;
+
+static void initPolicyPool(PolicyPool *pool, size_t capacity, size_t numSlots)
+{
+  pool->data         = malloc(capacity);
+  pool->size         = 0;
+  pool->capacity     = capacity;
+  pool->itemOffset   = malloc(sizeof(uint32_t) * numSlots);
+  pool->itemCapacity = numSlots;
+  pool->slots        = calloc(numSlots, sizeof(uint64_t));
+  pool->numSlots     = numSlots;
+  pool->numItems     = 0;
+  if (pool->data == NULL || pool->itemOffset == NULL || pool->slots == NULL)
+  {
+    printf("Error allocating the policy pools! Aborting!\n");
+    exit(-1);
+  }
+}
+
+// Number of the len bytes of item in pool, adding them if they aren't there
+// yet. A stored item equal to the first len bytes of item is the same item:
+// lists start with their length, and blocks are all the same size.
+static uint32_t addToPolicyPool(PolicyPool *pool, const void *item, size_t len)
+{
+  uint32_t hash = (uint32_t) (fnv1a64(item, len) >> 32);
+  size_t   mask = pool->numSlots - 1;
+  size_t   i;
+
+  for (i = hash & mask; pool->slots[i] != 0; i = (i + 1) & mask)
+  {
+    uint32_t ix     = (uint32_t) pool->slots[i] - 1;
+    uint32_t offset = pool->itemOffset[ix];
+    if ((uint32_t) (pool->slots[i] >> 32) == hash && offset + len <= pool->size &&
+        memcmp(pool->data + offset, item, len) == 0)
+    {
+      return ix;
+    }
+  }
+
+  if (pool->size + len > UINT32_MAX)
+  {
+    printf("Policy table too large! Aborting!\n");
+    exit(-1);
+  }
+  if (pool->size + len > pool->capacity)
+  {
+    pool->capacity *= 2;
+    pool->data      = realloc(pool->data, pool->capacity);
+  }
+  if (pool->numItems == pool->itemCapacity)
+  {
+    pool->itemCapacity *= 2;
+    pool->itemOffset    = realloc(pool->itemOffset, sizeof(uint32_t) * pool->itemCapacity);
+  }
+  if (pool->data == NULL || pool->itemOffset == NULL)
+  {
+    printf("Error allocating the policy pools! Aborting!\n");
+    exit(-1);
+  }
+  memcpy(pool->data + pool->size, item, len);
+  pool->itemOffset[pool->numItems] = pool->size;
+  pool->slots[i]                   = ((uint64_t) hash << 32) | (pool->numItems + 1);
+  pool->size                      += len;
+  pool->numItems++;
+
+  // Keep the table at most half full
+  if (2 * pool->numItems > pool->numSlots)
+  {
+    uint64_t *oldSlots    = pool->slots;
+    size_t    oldNumSlots = pool->numSlots;
+    size_t    j;
+
+    pool->numSlots *= 2;
+    pool->slots     = calloc(pool->numSlots, sizeof(uint64_t));
+    if (pool->slots == NULL)
+    {
+      printf("Error allocating the policy pools! Aborting!\n");
+      exit(-1);
+    }
+    mask = pool->numSlots - 1;
+    for (j = 0; j < oldNumSlots; j++)
+    {
+      if (oldSlots[j] != 0)
+      {
+        for (i = (oldSlots[j] >> 32) & mask; pool->slots[i] != 0; i = (i + 1) & mask)
+        {
+        }
+        pool->slots[i] = oldSlots[j];
+      }
+    }
+    free(oldSlots);
+  }
+
+  return (uint32_t) (pool->numItems - 1);
+}
+
+static void freePolicyPool(PolicyPool *pool)
+{
+  free(pool->data);
+  free(pool->itemOffset);
+  free(pool->slots);
+}
+
+// Work out the decision lists of every Markov state from the loaded qwixx.bin
+// and write them to filename.
+static void exportPolicy(const char *filename, uint64_t tableChecksum)
+{
+  QwixxPolicyHeader header;
+  StateDecisions   *dec        = malloc(sizeof(StateDecisions));
+  unsigned char    *stateBlock = calloc(NUM_MARKOV_STATES, 3);
+  PolicyList        lists[POLICY_NUM_PAIRS];
+  unsigned char     packed[POLICY_MAX_LIST_SIZE];
+  unsigned char     block[POLICY_BLOCK_SIZE];
+  uint32_t          firstListOfLength[POLICY_MAX_ENTRIES + 2];
+  size_t            lengthOffset     [POLICY_MAX_ENTRIES + 1];
+  uint32_t          nextListId       [POLICY_MAX_ENTRIES + 1];
+  uint32_t         *listId;
+  unsigned char    *sortedLists;
+  PolicyPool        listPool, blockPool;
+  char              tmpFilename[256];
+  FILE             *fp;
+  long long         numStates      = 0;
+  long long         numEntries     = 0;
+  long long         numEmptyLists  = 0;
+  long long         numInlineSlots = 0;
+  size_t            ix;
+  int               s, pair, n;
+
+  snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+  fp = fopen(tmpFilename, "wb");
+  if (dec == NULL || stateBlock == NULL || fp == NULL)
+  {
+    printf("Error setting up %s! Aborting!\n", filename);
+    exit(-1);
+  }
+  initPolicyPool(&listPool,  1 << 24, 1 << 20);
+  initPolicyPool(&blockPool, 1 << 24, 1 << 20);
+
+  // The slots refer to the lists by the order they were found in for now
+  for (s = 0; s < NUM_MARKOV_STATES; s++)
+  {
+    int numPenalties = s / NUM_FOUR_COLOR_STATES;
+    int rygbState    = s % NUM_FOUR_COLOR_STATES;
+    int colorStates[NUM_COLORS];
+
+    if (numPenalties < NUM_PENALTIES_TO_END)
+    {
+      int ry, gb;
+
+      quadToC12C34(rygbState, &ry, &gb);
+      colorStates[RED   ] = dualToC1[ry];
+      colorStates[YELLOW] = dualToC2[ry];
+      colorStates[GREEN ] = dualToC1[gb];
+      colorStates[BLUE  ] = dualToC2[gb];
+
+      // Game over states don't get a block
+      if (! isGameOverIx(colorStates, numPenalties))
+      {
+        analyzeMarkovState(NULL, s, 0, 0, 0, 0, 0, 0, 0, dec);
+        numEntries += buildPolicyLists(dec, lists, &numEmptyLists);
+        for (pair = 0; pair < POLICY_NUM_PAIRS; pair++)
+        {
+          const PolicyList *list = &lists[pair];
+          uint32_t          slot;
+
+          if (list->numEntries <= POLICY_MAX_INLINE)
+          {
+            slot = list->whiteAction | (list->numEntries << 3);
+            for (n = 0; n < list->numEntries; n++)
+            {
+              slot |= (uint32_t) list->entries[n] << (5 + 9 * n);
+            }
+            numInlineSlots++;
+          }
+          else
+          {
+            slot = addToPolicyPool(&listPool, packed, packPolicyList(list, packed));
+            if (slot >= POLICY_SLOT_LIST)
+            {
+              printf("Too many distinct policy lists! Aborting!\n");
+              exit(-1);
+            }
+            slot |= POLICY_SLOT_LIST;
+          }
+          writePolicy24(&block[3 * pair], slot);
+        }
+        ix = addToPolicyPool(&blockPool, block, sizeof(block));
+        if (ix >= (1 << 24))
+        {
+          printf("Too many distinct policy blocks! Aborting!\n");
+          exit(-1);
+        }
+        writePolicy24(&stateBlock[3 * s], ix);
+        numStates++;
+      }
+    }
+
+    if ((s + 1) % 500000 == 0)
+    {
+      printf("% 8d / % 8d states exported\n", s + 1, NUM_MARKOV_STATES);
+    }
+  }
+
+  // Sort the lists by length, keeping their order otherwise, and renumber
+  // them in the blocks
+  listId      = malloc(sizeof(uint32_t) * (listPool.numItems + 1));
+  sortedLists = malloc(listPool.size + 1);
+  if (listId == NULL || sortedLists == NULL)
+  {
+    printf("Error allocating the policy lists! Aborting!\n");
+    exit(-1);
+  }
+  memset(firstListOfLength, 0, sizeof(firstListOfLength));
+  for (ix = 0; ix < listPool.numItems; ix++)
+  {
+    firstListOfLength[(listPool.data[listPool.itemOffset[ix]] >> 3) + 1]++;
+  }
+  lengthOffset[0] = 0;
+  for (n = 1; n <= POLICY_MAX_ENTRIES; n++)
+  {
+    lengthOffset[n] = lengthOffset[n - 1] + (size_t) firstListOfLength[n] * policyListSize(n - 1);
+  }
+  for (n = 0; n <= POLICY_MAX_ENTRIES; n++)
+  {
+    firstListOfLength[n + 1] += firstListOfLength[n];
+  }
+  memcpy(nextListId, firstListOfLength, sizeof(nextListId));
+  for (ix = 0; ix < listPool.numItems; ix++)
+  {
+    const unsigned char *list = listPool.data + listPool.itemOffset[ix];
+
+    n          = list[0] >> 3;
+    listId[ix] = nextListId[n]++;
+    memcpy(sortedLists + lengthOffset[n] + (size_t) (listId[ix] - firstListOfLength[n]) * policyListSize(n),
+           list, policyListSize(n));
+  }
+  for (ix = 0; ix < blockPool.numItems; ix++)
+  {
+    unsigned char *b = blockPool.data + ix * POLICY_BLOCK_SIZE;
+    for (pair = 0; pair < POLICY_NUM_PAIRS; pair++)
+    {
+      uint32_t slot = readPolicy24(&b[3 * pair]);
+      if (slot & POLICY_SLOT_LIST)
+      {
+        writePolicy24(&b[3 * pair], listId[slot & ~POLICY_SLOT_LIST] | POLICY_SLOT_LIST);
+      }
+    }
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, QWIXX_POLICY_MAGIC, sizeof(header.magic));
+  header.version         = QWIXX_POLICY_VERSION;
+  header.headerSize      = sizeof(header);
+  header.numMarkovStates = NUM_MARKOV_STATES;
+  header.numBlocks       = blockPool.numItems;
+  header.numLists        = listPool.numItems;
+  header.listsSize       = listPool.size;
+  header.tableChecksum   = tableChecksum;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+      fwrite(firstListOfLength, sizeof(firstListOfLength), 1, fp) != 1 ||
+      fwrite(stateBlock, 3, NUM_MARKOV_STATES, fp) != NUM_MARKOV_STATES ||
+      fwrite(blockPool.data, 1, blockPool.size, fp) != blockPool.size ||
+      fwrite(sortedLists, 1, listPool.size, fp) != listPool.size ||
+      fclose(fp) != 0 ||
+      rename(tmpFilename, filename) != 0)
+  {
+    printf("Error writing %s! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  printf("Wrote %s: %.1f MB of state block numbers + %.1f MB of blocks + %.1f MB of lists\n", filename,
+         3.0 * NUM_MARKOV_STATES / 1e6, blockPool.size / 1e6, listPool.size / 1e6);
+  printf("%lld states, %zu distinct blocks, %zu distinct lists, %.1f%% of the lists in their slot\n",
+         numStates, blockPool.numItems, listPool.numItems,
+         100.0 * numInlineSlots / (numStates * POLICY_NUM_PAIRS));
+  printf("%.1f%% of the lists empty, %.2f entries per list on average\n",
+         100.0 * numEmptyLists / (numStates * POLICY_NUM_PAIRS),
+         (double) numEntries / (numStates * POLICY_NUM_PAIRS));
+
+  free(sortedLists);
+  free(listId);
+  freePolicyPool(&blockPool);
+  freePolicyPool(&listPool);
+  free(stateBlock);
+  free(dec);
+}
+
+// Map filename read-only into *policy. Exits on any error.
+static void loadPolicy(const char *filename, QwixxPolicy *policy)
+{
+  struct stat              st;
+  const unsigned char     *map;
+  const QwixxPolicyHeader *header;
+  size_t                   countsSize = sizeof(uint32_t) * (POLICY_MAX_ENTRIES + 2);
+  size_t                   listsSize  = 0;
+  int                      fd = open(filename, O_RDONLY);
+  int                      n;
+
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    printf("Error opening %s! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED)
+  {
+    printf("Error mapping %s! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  header = (const QwixxPolicyHeader *) map;
+  if (st.st_size < (off_t) (sizeof(QwixxPolicyHeader) + countsSize) ||
+      memcmp(header->magic, QWIXX_POLICY_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version         != QWIXX_POLICY_VERSION ||
+      header->numMarkovStates != NUM_MARKOV_STATES    ||
+      st.st_size != (off_t) (header->headerSize + countsSize + 3 * (size_t) NUM_MARKOV_STATES +
+                             (size_t) POLICY_BLOCK_SIZE * header->numBlocks + header->listsSize))
+  {
+    printf("%s is not a usable policy file! Aborting!\n", filename);
+    exit(-1);
+  }
+
+  policy->firstListOfLength = (const uint32_t *) (map + header->headerSize);
+  for (n = 0; n <= POLICY_MAX_ENTRIES; n++)
+  {
+    policy->lengthOffset[n] = listsSize;
+    listsSize += (size_t) (policy->firstListOfLength[n + 1] - policy->firstListOfLength[n]) * policyListSize(n);
+  }
+  if (listsSize != header->listsSize || policy->firstListOfLength[POLICY_MAX_ENTRIES + 1] != header->numLists)
+  {
+    printf("%s is not a usable policy file! Aborting!\n", filename);
+    exit(-1);
+  }
+  policy->stateBlock = map + header->headerSize + countsSize;
+  policy->blocks     = policy->stateBlock + 3 * (size_t) NUM_MARKOV_STATES;
+  policy->lists      = policy->blocks + (size_t) POLICY_BLOCK_SIZE * header->numBlocks;
+}
+
+// Apply action (as picked for white dice w1 <= w2 and colored dice dice[]) to
+// the 0-61 color states colorStates[] and *numPenalties, in place. Returns 0
+// if the dice don't allow the action.
+static int applyActionIx(int colorStates[], int *numPenalties, int action, int w1, int w2, const int dice[])
+{
+  // Color of each group's die (-1: no die), and whether it tries the w1 sum first
+  static const int groupColor   [NUM_ACTIONS / 5] = {-1, RED, YELLOW, GREEN, BLUE, RED, YELLOW, GREEN, BLUE};
+  static const int groupLowFirst[NUM_ACTIONS / 5] = { 0,   1,      1,     0,    0,   0,      0,     1,    1};
+  int group    = action / 5;
+  int wasColor = action % 5 - 1;
+  int c, sum1, sum2;
+
+  if (action == PENALTY)
+  {
+    (*numPenalties)++;
+    return 1;
+  }
+
+#define MARK_COLOR(color, diceSum) \
+  ((colorLegalSums[colorDirection[color]][colorStates[color]] >> (diceSum)) & 1 ? \
+   (colorStates[color] = colorNext62[colorDirection[color]][colorStates[color]][diceSum], 1) : 0)
+
+  if (wasColor >= 0 && ! MARK_COLOR(wasColor, w1 + w2))
+  {
+    return 0;
+  }
+  if (group > 0)
+  {
+    c    = groupColor[group];
+    sum1 = (groupLowFirst[group] ? w1 : w2) + dice[c];
+    sum2 = (groupLowFirst[group] ? w2 : w1) + dice[c];
+    if (! MARK_COLOR(c, sum1) && ! MARK_COLOR(c, sum2))
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Same as applyActionIx(), for a QwixxState. The result goes to *next (which
+// may be state).
+static int applyAction(const QwixxState *state, int action, int w1, int w2, int r, int y, int g, int b,
+                       QwixxState *next)
+{
+  int colorStates[NUM_COLORS];
+  int dice[NUM_COLORS];
+  int p = state->numPenalties;
+  int c;
+
+  if (w2 < w1)
+  {
+    SWAP_INT(w1, w2);
+  }
+  dice[RED   ] = r;
+  dice[YELLOW] = y;
+  dice[GREEN ] = g;
+  dice[BLUE  ] = b;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    colorStates[c] = colorStateTo62State((QColorState *) &state->color[c]);
+  }
+
+  if (! applyActionIx(colorStates, &p, action, w1, w2, dice))
+  {
+    return 0;
+  }
+
+  if (next != state)
+  {
+    *next = *state;
+  }
+  constructStateFromIx(p              * ROW_STATES_4   +
+                       colorStates[0] * ROW_STATES_3   +
+                       colorStates[1] * ROW_STATES_2   +
+                       colorStates[2] * NUM_ROW_STATES +
+                       colorStates[3], next);
+  return 1;
+}
+
+// Policy table version of qwixx_decide() (without the reward output).
+//
+// The table is indexed by Markov state, whose colors are in a canonical
+// order: the lower of red/yellow first, then the lower of green/blue, with the
+// two pairs swapped if red/yellow is the higher pair (see
+// convertClipped5tupleToIx()). Swapping the pairs puts the UP colors where the
+// DOWN colors were, which works out the same once all the dice are mirrored
+// (d -> 7 - d). So the dice are put in the same order as the colors before the
+// lookup, and the action is mapped back to the actual colors after it. Exact
+// ties between colors are then broken in the canonical order, which can
+// differ from qwixx_decide() (but never in the expected score).
+static int policyDecide(const QwixxPolicy *policy, const QwixxState *state, int w1, int w2,
+                        int r, int y, int g, int b, QwixxState *next)
+{
+  const unsigned char *block;
+  uint32_t             slot;
+  int                  clipped[NUM_COLORS];
+  int                  slotColor[NUM_COLORS] = {RED, YELLOW, GREEN, BLUE}; // actual color in each canonical slot
+  int                  dice[NUM_COLORS];
+  int                  dieFace[NUM_COLORS];
+  int                  slotW1, slotW2, ry, gb, mirror;
+  int                  c, i, numEntries, action, group, wasSlot;
+
+  if (isGameOver((QwixxState *) state))
+  {
+    return -1;
+  }
+
+  if (w2 < w1)
+  {
+    SWAP_INT(w1, w2);
+  }
+  dice[RED   ] = r;
+  dice[YELLOW] = y;
+  dice[GREEN ] = g;
+  dice[BLUE  ] = b;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    clipped[c] = colorStateTo62State((QColorState *) &state->color[c]);
+    if (clipped[c] > 56)
+    {
+      clipped[c] = 56;
+    }
+  }
+
+  // Canonical color order, same as convertClipped5tupleToIx()
+  if (clipped[RED] > clipped[YELLOW])
+  {
+    SWAP_INT(slotColor[0], slotColor[1]);
+  }
+  if (clipped[GREEN] > clipped[BLUE])
+  {
+    SWAP_INT(slotColor[2], slotColor[3]);
+  }
+  ry     = c1c2ToCombined[clipped[slotColor[0]]][clipped[slotColor[1]]];
+  gb     = c1c2ToCombined[clipped[slotColor[2]]][clipped[slotColor[3]]];
+  mirror = (ry > gb);
+  if (mirror)
+  {
+    SWAP_INT(ry, gb);
+    SWAP_INT(slotColor[0], slotColor[2]);
+    SWAP_INT(slotColor[1], slotColor[3]);
+  }
+
+  slotW1 = mirror ? 7 - w2 : w1;
+  slotW2 = mirror ? 7 - w1 : w2;
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    int d = dice[slotColor[c]];
+    dieFace[c] = c * 6 + (mirror ? 7 - d : d) - 1;
+  }
+
+  block = policy->blocks + (size_t) POLICY_BLOCK_SIZE *
+          readPolicy24(&policy->stateBlock[3 * (state->numPenalties * NUM_FOUR_COLOR_STATES + c12c34ToCombined(ry, gb))]);
+  slot  = readPolicy24(&block[3 * policyPairIx(slotW1, slotW2)]);
+
+  if (slot & POLICY_SLOT_LIST)
+  {
+    // Find the list's length from its id, then the list
+    const unsigned char *list;
+    uint32_t             id = slot & ~POLICY_SLOT_LIST;
+
+    for (numEntries = POLICY_MAX_INLINE + 1; id >= policy->firstListOfLength[numEntries + 1]; numEntries++)
+    {
+    }
+    list   = policy->lists + policy->lengthOffset[numEntries] +
+             (size_t) (id - policy->firstListOfLength[numEntries]) * policyListSize(numEntries);
+    action = list[0] & 7;
+    for (i = 0; i < numEntries; i++)
+    {
+      int bit   = 8 + 9 * i;
+      int entry = ((list[bit >> 3] | (list[(bit >> 3) + 1] << 8)) >> (bit & 7)) & 0x1ff;
+      int face  = entry & 31;
+      if (face == dieFace[face / 6])
+      {
+        action = policyEntryAction(entry);
+        break;
+      }
+    }
+  }
+  else
+  {
+    action     = slot & 7;
+    numEntries = (slot >> 3) & 3;
+    for (i = 0; i < numEntries; i++)
+    {
+      int entry = (slot >> (5 + 9 * i)) & 0x1ff;
+      int face  = entry & 31;
+      if (face == dieFace[face / 6])
+      {
+        action = policyEntryAction(entry);
+        break;
+      }
+    }
+  }
+
+  // Back to the actual colors. The groups after the first are one per color,
+  // first the normal ones and then the lock ones, and the "white as" actions
+  // of each group are in color order too.
+  group   = action / 5;
+  wasSlot = action % 5 - 1;
+  if (group > 0)
+  {
+    group = ((group <= NUM_COLORS) ? 1 : 1 + NUM_COLORS) + slotColor[(group - 1) % NUM_COLORS];
+  }
+  action = 5 * group + ((wasSlot >= 0) ? 1 + slotColor[wasSlot] : 0);
+
+  applyAction(state, action, w1, w2, r, y, g, b, next);
+  return action;
+}
+
+// Policy table the sim modes use instead of qwixx_decide(), if any (--policy)
+static const QwixxPolicy *simPolicy = NULL;
+
+// Parallel simulation (--fast-sim)
+//
+// Each game gets its own xoshiro256** generator, seeded from (seed, game
+// index) through splitmix64, so a game plays out the same no matter which
+// thread runs it, and the totals don't depend on the number of threads. Dice
+// are rolled from 8 random bits at a time; values 252-255 are thrown away so
+// that all 6 faces are equally likely.
+#define SIM_CHUNK      1024                                   // games claimed at a time
+#define SIM_MIN_SCORE  (-NUM_PENALTIES_TO_END * PENALTY_POINTS)
+#define SIM_MAX_SCORE  (NUM_COLORS * ROW_MAX_POINTS)         // 12 marks in every color
+#define SIM_NUM_SCORES (SIM_MAX_SCORE - SIM_MIN_SCORE + 1)
+
+typedef struct
+{
+  uint64_t s[4];
+  uint64_t bits;    // unused random bits, used up 8 at a time
+  int      numBits;
+} SimRng;
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t xoshiro256ss(SimRng *rng)
+{
+  uint64_t *s      = rng->s;
+  uint64_t  result = rotl64(s[1] * 5, 7) * 9;
+  uint64_t  t      = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3]  = rotl64(s[3], 45);
+
+  return result;
+}
+
+static void seedSimRng(SimRng *rng, int seed, uint64_t gameIx)
+{
+  uint64_t x = ((uint64_t) (uint32_t) seed << 40) ^ gameIx;
+  int      i;
+
+  for (i = 0; i < 4; i++)
+  {
+    rng->s[i] = splitmix64(&x);
+  }
+  rng->bits    = 0;
+  rng->numBits = 0;
+}
+
+static inline int simRollDie(SimRng *rng)
+{
+  for (;;)
+  {
+    unsigned v;
+    if (rng->numBits == 0)
+    {
+      rng->bits    = xoshiro256ss(rng);
+      rng->numBits = 64;
+    }
+    v = (unsigned) (rng->bits & 0xff);
+    rng->bits    >>= 8;
+    rng->numBits  -= 8;
+    if (v < 252)
+    {
+      return (int) (v % 6) + 1;
+    }
+  }
+}
+
+// qwixx_decide() *state in place, for the modes that play games with the
+// table. A table with no W for a successor (from a cut short run) can't play
+// them, so give up.
+static void simDecide(QwixxState *state, int w1, int w2, int r, int y, int g, int b)
+{
+  if (qwixx_decide(state, w1, w2, r, y, g, b, state, NULL) < 0)
+  {
+    printf("The table has no W for a successor of a state the game reached (a cut short run?)\n");
+    exit(-1);
+  }
+}
+
+// Each worker's totals. Integer sums, so that adding them up gives the same
+// result in any order.
+typedef struct
+{
+  long long numGames;
+  long long sumScores;
+  long long sumSquares;
+  long long scoreCounts[SIM_NUM_SCORES];
+} SimTotals;
+
+typedef struct
+{
+  long long  numGames;
+  int        seed;
+  long long  next;    // next unclaimed game index (updated atomically)
+  SimTotals *totals;  // [numThreads]
+} SimJob;
+
+typedef struct
+{
+  SimJob *job;
+  int     threadIx;
+} SimWorkerArgs;
+
+static void *simWorker(void *arg)
+{
+  SimWorkerArgs *args   = (SimWorkerArgs *) arg;
+  SimJob        *job    = args->job;
+  SimTotals     *totals = &job->totals[args->threadIx];
+
+  for (;;)
+  {
+    long long gameIx = __atomic_fetch_add(&job->next, SIM_CHUNK, __ATOMIC_RELAXED);
+    long long gameStop;
+
+    if (gameIx >= job->numGames)
+    {
+      break;
+    }
+    gameStop = gameIx + SIM_CHUNK;
+    if (gameStop > job->numGames)
+    {
+      gameStop = job->numGames;
+    }
+
+    for (; gameIx < gameStop; gameIx++)
+    {
+      QwixxState state;
+      SimRng     rng;
+      int        score;
+
+      initialize_qwixx_state(&state);
+      seedSimRng(&rng, job->seed, (uint64_t) gameIx);
+      while ( ! isGameOver(&state) )
+      {
+        int w1 = simRollDie(&rng);
+        int w2 = simRollDie(&rng);
+        int r  = simRollDie(&rng);
+        int y  = simRollDie(&rng);
+        int g  = simRollDie(&rng);
+        int b  = simRollDie(&rng);
+
+        if (simPolicy)
+        {
+          policyDecide(simPolicy, &state, w1, w2, r, y, g, b, &state);
+        }
+        else
+        {
+          simDecide(&state, w1, w2, r, y, g, b);
+        }
+      }
+
+      score = getScore(&state);
+      totals->numGames++;
+      totals->sumScores  += score;
+      totals->sumSquares += (long long) score * score;
+      totals->scoreCounts[score - SIM_MIN_SCORE]++;
+    }
+  }
+
+  return NULL;
+}
+
+// Score at fraction q of the way through the sorted scores of numGames games
+static int simScoreQuantile(const long long *scoreCounts, long long numGames, double q)
+{
+  long long rank = (long long) (q * (numGames - 1));
+  long long seen = 0;
+  int       i;
+
+  for (i = 0; i < SIM_NUM_SCORES; i++)
+  {
+    seen += scoreCounts[i];
+    if (seen > rank)
+    {
+      return i + SIM_MIN_SCORE;
+    }
+  }
+  return SIM_MAX_SCORE;
+}
+
+// Simulate num_games games on num_threads threads and add up their scores in
+// *all. Returns the wall time in seconds.
+static double runSimGames(long long num_games, int seed, int num_threads, SimTotals *all)
+{
+  SimJob           job;
+  pthread_t       *threads = malloc(sizeof(pthread_t) * num_threads);
+  SimWorkerArgs   *args    = malloc(sizeof(SimWorkerArgs) * num_threads);
+  struct timespec  start, stop;
+  double           seconds;
+  int              t, i;
+
+  job.numGames = num_games;
+  job.seed     = seed;
+  job.next     = 0;
+  job.totals   = calloc(num_threads, sizeof(SimTotals));
+  if (threads == NULL || args == NULL || job.totals == NULL)
+  {
+    printf("Error allocating simulation buffers! Aborting!\n");
+    exit(-1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (t = 0; t < num_threads; t++)
+  {
+    args[t].job      = &job;
+    args[t].threadIx = t;
+    if (pthread_create(&threads[t], NULL, simWorker, &args[t]) != 0)
+    {
+      printf("Error creating simulation thread %d! Aborting!\n", t);
+      exit(-1);
+    }
+  }
+  for (t = 0; t < num_threads; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  seconds = (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+
+  memset(all, 0, sizeof(*all));
+  for (t = 0; t < num_threads; t++)
+  {
+    all->numGames   += job.totals[t].numGames;
+    all->sumScores  += job.totals[t].sumScores;
+    all->sumSquares += job.totals[t].sumSquares;
+    for (i = 0; i < SIM_NUM_SCORES; i++)
+    {
+      all->scoreCounts[i] += job.totals[t].scoreCounts[i];
+    }
+  }
+
+  free(job.totals);
+  free(args);
+  free(threads);
+  return seconds;
+}
+
+// Simulate num_games games on num_threads threads and print summary
+// statistics of the scores.
+static void simulateGamesThreaded(long long num_games, int seed, int num_threads)
+{
+  SimTotals all;
+  double    seconds = runSimGames(num_games, seed, num_threads, &all);
+  double    mean, variance;
+  int       minScore, maxScore;
+
+  if (all.numGames > 0)
+  {
+    minScore = SIM_MIN_SCORE;
+    while (all.scoreCounts[minScore - SIM_MIN_SCORE] == 0)
+    {
+      minScore++;
+    }
+    maxScore = SIM_MAX_SCORE;
+    while (all.scoreCounts[maxScore - SIM_MIN_SCORE] == 0)
+    {
+      maxScore--;
+    }
+    mean     = (double) all.sumScores / all.numGames;
+    variance = (double) all.sumSquares / all.numGames - mean * mean;
+
+    printf("Games:     %lld (seed %d)\n", all.numGames, seed);
+    printf("Mean:      %.4f (+/- %.4f)\n", mean, sqrt(variance / all.numGames));
+    printf("Std dev:   %.4f\n", sqrt(variance));
+    printf("Min:       %d\n", minScore);
+    printf("10%%/50%%/90%%: %d / %d / %d\n",
+           simScoreQuantile(all.scoreCounts, all.numGames, 0.1),
+           simScoreQuantile(all.scoreCounts, all.numGames, 0.5),
+           simScoreQuantile(all.scoreCounts, all.numGames, 0.9));
+    printf("Max:       %d\n", maxScore);
+  }
+  printf("%.2f seconds, %.0f games/sec on %d threads\n",
+         seconds, seconds > 0 ? all.numGames / seconds : 0.0, num_threads);
+}
+
+// Differential verification (--verify, --verify-kernels)
+//
+// A faster kernel or engine has to produce the same table as the reference.
+// --verify compares two qwixx.bin files; --verify-kernels generates the table
+// twice in this process with two setups, e.g. "nested" and "factored:lanes",
+// and compares the results. Both go through compareDecisions(): the largest
+// and mean W difference over the states, and the states where the tables pick
+// a different action for some roll. If the tables are complete, each one's
+// Wvec[0] is also checked against the mean score of verifyNumGames games
+// simulated with it (as in --fast-sim). The expected score of the games a
+// table plays is its Wvec[0], so that should be inside the simulation's
+// confidence interval.
+//
+// With num_states, only the last num_states states are generated and
+// compared and the simulation is skipped, which makes a quick check before a
+// merge.
+#define VERIFY_MAX_Z 3.29 // 99.9% confidence interval
+
+static long long verifyNumGames  = 1000000; // --verify-games
+static double    verifyTolerance = 1e-3;    // --verify-tolerance, in points
+
+// One --verify-kernels setup: "kernel[:option...]", with kernel nested,
+// factored, reference or check and the options wavefront and lanes (see
+// --kernel, --threads and --penalty-lanes)
+typedef struct
+{
+  GenerateKernel kernel;
+  int            wavefront;
+  int            lanes;
+} VerifySetup;
+
+static void parseVerifySetup(const char *spec, VerifySetup *setup)
+{
+  char  buf[128];
+  char *token, *save;
+
+  memset(setup, 0, sizeof(*setup));
+  snprintf(buf, sizeof(buf), "%s", spec);
+  token = strtok_r(buf, ":", &save);
+  if (token && strcmp(token, "nested") == 0)
+  {
+    setup->kernel = KERNEL_NESTED;
+  }
+  else if (token && strcmp(token, "factored") == 0)
+  {
+    setup->kernel = KERNEL_FACTORED;
+  }
+  else if (token && strcmp(token, "check") == 0)
+  {
+    setup->kernel = KERNEL_CHECK;
+  }
+  else if (token && strcmp(token, "reference") == 0)
+  {
+    setup->kernel = KERNEL_REFERENCE;
+  }
+  else
+  {
+    printf("Unknown kernel in %s (expected nested, factored, reference or check)! Exiting!\n", spec);
+    exit(-1);
+  }
+
+  while ((token = strtok_r(NULL, ":", &save)) != NULL)
+  {
+    if (strcmp(token, "wavefront") == 0)
+    {
+      setup->wavefront = 1;
+    }
+    else if (strcmp(token, "lanes") == 0)
+    {
+      setup->lanes = 1;
+    }
+    else
+    {
+      printf("Unknown option %s in %s (expected wavefront or lanes)! Exiting!\n", token, spec);
+      exit(-1);
+    }
+  }
+  if (setup->lanes && setup->kernel != KERNEL_NESTED && setup->kernel != KERNEL_FACTORED)
+  {
+    printf("%s: lanes only works with the nested and factored kernels! Exiting!\n", spec);
+    exit(-1);
+  }
+}
+
+// Generate Wvec[] (or the last num_iterations states of it) with setup (from
+// spec), and return it for the caller to free
+static float *generateForVerify(const char *spec, const VerifySetup *setup, int num_iterations, int num_threads)
+{
+  struct timespec start, stop;
+  float          *W;
+
+  // The lanes cut a run short in every penalty layer (see
+  // generateWvecThreaded()), the other setups only in the last layer. So the
+  // lanes do num_iterations color states of every layer, which covers all the
+  // states the others do.
+  if (setup->lanes && num_iterations > 0)
+  {
+    num_iterations = NUM_PENALTIES_TO_END * ((num_iterations < NUM_FOUR_COLOR_STATES) ? num_iterations : NUM_FOUR_COLOR_STATES);
+  }
+
+  generateKernel = setup->kernel;
+  allocWvec();
+
+  printf("Generating with %s ...\n", spec);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (setup->wavefront || setup->lanes)
+  {
+    generateWvecThreaded(num_iterations, num_threads, setup->lanes);
+  }
+  else
+  {
+    analyzeState(NULL, num_iterations, 0, 0, 0, 0, 0, 0, 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  printf("%s: %.2f seconds\n", spec, (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec));
+
+  W    = Wvec;
+  Wvec = NULL;
+  return W;
+}
+
+// Check table's Wvec[0] against verifyNumGames games simulated with it.
+// Returns 0 if it is outside the confidence interval.
+static int verifyAgainstSim(const char *name, const QwixxTable *table, int num_threads)
+{
+  QwixxState state;
+  SimTotals  all;
+  double     W0, mean, stdErr, z;
+
+  initialize_qwixx_state(&state);
+  useQwixxTable(table);
+  if (table->W && ! isfinite(table->W[0]))
+  {
+    printf("%s: no Wvec[0] (a cut short run), simulation skipped\n", name);
+    return 1;
+  }
+  W0 = getWforState(&state, NULL);
+
+  runSimGames(verifyNumGames, 0, num_threads, &all);
+  mean   = (double) all.sumScores / all.numGames;
+  stdErr = sqrt(((double) all.sumSquares / all.numGames - mean * mean) / all.numGames);
+  z      = (stdErr > 0.0) ? (W0 - mean) / stdErr : 0.0;
+  printf("%s: Wvec[0] %.4f, %lld games %.4f +/- %.4f (99.9%% CI %.4f to %.4f), z = %.2f: %s\n",
+         name, W0, all.numGames, mean, stdErr, mean - VERIFY_MAX_Z * stdErr, mean + VERIFY_MAX_Z * stdErr, z,
+         fabs(z) <= VERIFY_MAX_Z ? "OK" : "FAIL");
+  return fabs(z) <= VERIFY_MAX_Z;
+}
+
+// Compare tables a and b (see above), on the last num_states states if
+// num_states > 0. Returns whether they pass: every state compared (none
+// missing from either table), no W difference above verifyTolerance and both
+// Wvec[0]s inside their simulation's confidence interval. Different actions
+// for a roll are reported but don't fail the check by themselves: float
+// rounding can flip near-ties.
+static int verifyTables(const char *nameA, const QwixxTable *a, const char *nameB, const QwixxTable *b,
+                        int num_states, int num_threads)
+{
+  DecisionComparison cmp;
+  int                ok;
+
+  printf("Comparing %s and %s ...\n", nameA, nameB);
+  compareDecisions(a, b, num_states, 20, &cmp);
+  ok = cmp.numStates > 0 && cmp.numMissing == 0;
+  printf("Coverage: %s (%d states compared, %d missing from a table)\n",
+         ok ? "OK" : "FAIL", cmp.numStates, cmp.numMissing);
+  if (cmp.maxWdiff > verifyTolerance)
+  {
+    ok = 0;
+  }
+  printf("W differences: %s (largest %.3g, tolerance %.3g)\n",
+         (cmp.maxWdiff <= verifyTolerance) ? "OK" : "FAIL", cmp.maxWdiff, verifyTolerance);
+
+  if (num_states <= 0 && verifyNumGames > 0)
+  {
+    ok = verifyAgainstSim(nameA, a, num_threads) && ok;
+    ok = verifyAgainstSim(nameB, b, num_threads) && ok;
+  }
+
+  printf("Verification %s\n", ok ? "PASSED" : "FAILED");
+  return ok;
+}
+
+// Exact score distribution (--score-distribution)
+//
+// Instead of simulating games, the probability of reaching each Markov state
+// is pushed forward through the best action of every roll, level by level in
+// the opposite order of generate mode's wavefront (see markovStateLevel()):
+// every successor of a state is on a later level, so the states of one level
+// can be worked on in parallel, with atomic adds for the successors' mass. The
+// mass that reaches the end of the game is collected per final score.
+//
+// Markov states forget how far past state 56 a locked color is (see
+// clippedStateOffset[]). Only one color can be locked before the game ends, so
+// each state's mass is split in NUM_LOCK_BUCKETS: bucket 0 for no extra
+// points, 1-5 for a locked color in state 57-61. (With rules that need more
+// than 2 locks to end the game, more colors can be locked at once, which the
+// buckets can't keep track of, so those rules don't have this mode.)
+//
+// Rolls are counted per white pair and winning die face as in
+// countSameDecisions(), using the decisions of the Markov state. Exact ties
+// between colors are broken in the Markov state's canonical color order,
+// which doesn't change the expected score, but can move a little mass between
+// scores compared to the sim modes.
+#define NUM_LOCK_BUCKETS (NUM_ROW_STATES - FIRST_LOCKED_ROW_STATE)
+
+typedef struct
+{
+  int               numThreads;
+  int              *levelStates;                          // state indices, grouped by level
+  int               levelStart[NUM_WAVEFRONT_LEVELS + 1];  // levelStates[] range of each level
+  int               levelNext [NUM_WAVEFRONT_LEVELS];      // next unclaimed position of each level (atomic)
+  double           *mass;                                 // [NUM_MARKOV_STATES][NUM_LOCK_BUCKETS]
+  double           *scoreProb;                            // [numThreads][SIM_NUM_SCORES]
+  pthread_barrier_t levelDone;
+} ScoreDistJob;
+
+typedef struct
+{
+  ScoreDistJob *job;
+  int           threadIx;
+} ScoreDistWorkerArgs;
+
+static inline void atomicAddDouble(double *target, double val)
+{
+  double oldVal, newVal;
+
+  __atomic_load(target, &oldVal, __ATOMIC_RELAXED);
+  do
+  {
+    newVal = oldVal + val;
+  } while (! __atomic_compare_exchange(target, &oldVal, &newVal, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Move prob of the mass of a state (clipped color states colorStates[], p
+// penalties, mass[] per lock bucket) to the state after action.
+static void pushActionMass(ScoreDistJob *job, double *scoreProb, const int colorStates[], int p,
+                           const double mass[], int action, int w1, int w2, const int dice[], double prob)
+{
+  int newStates[NUM_COLORS];
+  int newP      = p;
+  int newBucket = 0;
+  int c, bucket;
+
+  memcpy(newStates, colorStates, sizeof(newStates));
+  if (! applyActionIx(newStates, &newP, action, w1, w2, dice))
+  {
+    printf("Illegal action %d in the score distribution! Aborting!\n", action);
+    exit(-1);
+  }
+
+  if (isGameOverIx(newStates, newP))
+  {
+    // The game is over: all of it goes to the final scores
+    int score = getScoreFromIx(newStates, newP) - SIM_MIN_SCORE;
+    for (bucket = 0; bucket < NUM_LOCK_BUCKETS; bucket++)
+    {
+      if (mass[bucket] > 0.0)
+      {
+        scoreProb[score + ((bucket > 0) ? (int) clippedStateOffset[bucket - 1] : 0)] += mass[bucket] * prob;
+      }
+    }
+    return;
+  }
+
+  // A newly locked color sets the bucket; there can't have been another one
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    if (newStates[c] > 56)
+    {
+      newBucket    = newStates[c] - 56;
+      newStates[c] = 56;
+    }
+  }
+
+  {
+    double *newMass = &job->mass[(size_t) convertClipped5tupleToIx(newStates[RED], newStates[YELLOW],
+                                                                   newStates[GREEN], newStates[BLUE],
+                                                                   newP) * NUM_LOCK_BUCKETS];
+    for (bucket = 0; bucket < NUM_LOCK_BUCKETS; bucket++)
+    {
+      if (mass[bucket] > 0.0)
+      {
+        atomicAddDouble(&newMass[newBucket ? newBucket : bucket], mass[bucket] * prob);
+      }
+    }
+  }
+}
+
+// Push the mass of Markov state s to its successors
+static void pushStateMass(ScoreDistJob *job, double *scoreProb, StateDecisions *dec, int s)
+{
+  const double *mass        = &job->mass[(size_t) s * NUM_LOCK_BUCKETS];
+  int           p           = s / NUM_FOUR_COLOR_STATES;
+  int           rygbState   = s % NUM_FOUR_COLOR_STATES;
+  int           ry, gb;
+  int           colorStates[NUM_COLORS];
+  int           dice[NUM_COLORS] = {1, 1, 1, 1};
+  int           bucket, pair, w1, w2, c, f, j, g, count;
+
+  for (bucket = 0; bucket < NUM_LOCK_BUCKETS && mass[bucket] == 0.0; bucket++)
+    ;
+  if (bucket == NUM_LOCK_BUCKETS)
+  {
+    return; // can't be reached
+  }
+
+  quadToC12C34(rygbState, &ry, &gb);
+  colorStates[RED   ] = dualToC1[ry];
+  colorStates[YELLOW] = dualToC2[ry];
+  colorStates[GREEN ] = dualToC1[gb];
+  colorStates[BLUE  ] = dualToC2[gb];
+  analyzeMarkovState(NULL, s, 0, 0, 0, 0, 0, 0, 0, dec);
+
+  pair = 0;
+  for (w1 = 1; w1 <= 6; w1++)
+  {
+    for (w2 = w1; w2 <= 6; w2++, pair++)
+    {
+      double pairProb = ((w1 == w2) ? 1.0 : 2.0) / (36 * 6*6*6*6);
+      float  white    = dec->whiteReward[pair];
+
+      // No die beats the white-only action
+      count = 1;
+      for (j = 0; j < NUM_COLORS; j++)
+      {
+        int numFaces = 0;
+        for (g = 0; g < 6; g++)
+        {
+          numFaces += (dec->dieBestReward[pair][j][g] <= white);
+        }
+        count *= numFaces;
+      }
+      if (count > 0)
+      {
+        pushActionMass(job, scoreProb, colorStates, p, mass, dec->whiteAction[pair], w1, w2, dice, pairProb * count);
+      }
+
+      // Die c showing f + 1 wins
+      for (c = 0; c < NUM_COLORS; c++)
+      {
+        for (f = 0; f < 6; f++)
+        {
+          float val = dec->dieBestReward[pair][c][f];
+          if (! (val > white))
+          {
+            continue;
+          }
+
+          count = 1;
+          for (j = 0; j < NUM_COLORS && count > 0; j++)
+          {
+            int numFaces = 0;
+            if (j == c)
+            {
+              continue;
+            }
+            for (g = 0; g < 6; g++)
+            {
+              float other = dec->dieBestReward[pair][j][g];
+              numFaces += (j < c) ? (other < val) : (other <= val);
+            }
+            count *= numFaces;
+          }
+          if (count > 0)
+          {
+            dice[c] = f + 1;
+            pushActionMass(job, scoreProb, colorStates, p, mass, dec->dieBestAction[pair][c][f], w1, w2, dice, pairProb * count);
+            dice[c] = 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void *scoreDistWorker(void *arg)
+{
+  ScoreDistWorkerArgs *args      = (ScoreDistWorkerArgs *) arg;
+  ScoreDistJob        *job       = args->job;
+  double              *scoreProb = &job->scoreProb[args->threadIx * SIM_NUM_SCORES];
+  StateDecisions      *dec       = malloc(sizeof(StateDecisions));
+  int                  level;
+
+  if (dec == NULL)
+  {
+    printf("Error allocating decision buffer! Aborting!\n");
+    exit(-1);
+  }
+
+  // The start of the game is on the last level
+  for (level = NUM_WAVEFRONT_LEVELS - 1; level >= 0; level--)
+  {
+    for (;;)
+    {
+      int ix     = __atomic_fetch_add(&job->levelNext[level], WAVEFRONT_CHUNK, __ATOMIC_RELAXED);
+      int ixStop = ix + WAVEFRONT_CHUNK;
+      if (ix >= job->levelStart[level + 1])
+      {
+        break;
+      }
+      if (ixStop > job->levelStart[level + 1])
+      {
+        ixStop = job->levelStart[level + 1];
+      }
+      for (; ix < ixStop; ix++)
+      {
+        pushStateMass(job, scoreProb, dec, job->levelStates[ix]);
+      }
+    }
+
+    // Successor mass of this level must be complete before the next level starts
+    if (pthread_barrier_wait(&job->levelDone) == PTHREAD_BARRIER_SERIAL_THREAD &&
+        level % NUM_COLOR_SUM_LEVELS == 0)
+    {
+      printf("Done with the states with %d penalties\n", NUM_PENALTIES_TO_END - 1 - level / NUM_COLOR_SUM_LEVELS);
+    }
+  }
+
+  free(dec);
+  return NULL;
+}
+
+// Work out the exact distribution of final scores under the loaded qwixx.bin
+// on num_threads threads and print it.
+static void printScoreDistribution(int num_threads)
+{
+  ScoreDistJob         job;
+  pthread_t           *threads = malloc(sizeof(pthread_t) * num_threads);
+  ScoreDistWorkerArgs *args    = malloc(sizeof(ScoreDistWorkerArgs) * num_threads);
+  double               scoreProb[SIM_NUM_SCORES] = {0.0};
+  double               total = 0.0, mean = 0.0, meanSquares = 0.0, atLeast;
+  QwixxState           start;
+  struct timespec      startTime, stopTime;
+  int                  s, level, t, i, startIx;
+
+  if (NUM_LOCKS_TO_END > 2)
+  {
+    printf("--score-distribution needs rules that end the game with at most 2 locked colors! Exiting!\n");
+    exit(-1);
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.numThreads  = num_threads;
+  job.levelStates = malloc(sizeof(int) * NUM_MARKOV_STATES);
+  job.mass        = calloc((size_t) NUM_MARKOV_STATES * NUM_LOCK_BUCKETS, sizeof(double));
+  job.scoreProb   = calloc((size_t) num_threads * SIM_NUM_SCORES, sizeof(double));
+  if (threads == NULL || args == NULL || job.levelStates == NULL || job.mass == NULL || job.scoreProb == NULL)
+  {
+    printf("Error allocating score distribution buffers! Aborting!\n");
+    exit(-1);
+  }
+
+  // Bucket the non-terminal states by level (counting sort)
+  for (s = 0; s < NUM_MARKOV_STATES - 1; s++)
+  {
+    job.levelStart[markovStateLevel(s) + 1]++;
+  }
+  for (level = 0; level < NUM_WAVEFRONT_LEVELS; level++)
+  {
+    job.levelStart[level + 1] += job.levelStart[level];
+  }
+  for (s = 0; s < NUM_MARKOV_STATES - 1; s++)
+  {
+    job.levelStates[job.levelStart[markovStateLevel(s)]++] = s;
+  }
+  for (level = NUM_WAVEFRONT_LEVELS; level > 0; level--)
+  {
+    job.levelStart[level] = job.levelStart[level - 1];
+  }
+  job.levelStart[0] = 0;
+  for (level = 0; level < NUM_WAVEFRONT_LEVELS; level++)
+  {
+    job.levelNext[level] = job.levelStart[level];
+  }
+
+  // All the mass starts in the empty score sheet
+  initialize_qwixx_state(&start);
+  getWforState(&start, &startIx);
+  job.mass[(size_t) startIx * NUM_LOCK_BUCKETS] = 1.0;
+
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  pthread_barrier_init(&job.levelDone, NULL, num_threads);
+  for (t = 0; t < num_threads; t++)
+  {
+    args[t].job      = &job;
+    args[t].threadIx = t;
+    if (pthread_create(&threads[t], NULL, scoreDistWorker, &args[t]) != 0)
+    {
+      printf("Error creating score distribution thread %d! Aborting!\n", t);
+      exit(-1);
+    }
+  }
+  for (t = 0; t < num_threads; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  pthread_barrier_destroy(&job.levelDone);
+  clock_gettime(CLOCK_MONOTONIC, &stopTime);
+
+  for (t = 0; t < num_threads; t++)
+  {
+    for (i = 0; i < SIM_NUM_SCORES; i++)
+    {
+      scoreProb[i] += job.scoreProb[t * SIM_NUM_SCORES + i];
+    }
+  }
+  for (i = 0; i < SIM_NUM_SCORES; i++)
+  {
+    int score    = i + SIM_MIN_SCORE;
+    total       += scoreProb[i];
+    mean        += scoreProb[i] * score;
+    meanSquares += scoreProb[i] * score * score;
+  }
+
+  printf("Total probability: %.12f\n", total);
+  printf("Mean:              %.6f (qwixx.bin: %.6f)\n", mean, getWforState(&start, NULL));
+  printf("Std dev:           %.6f\n", sqrt(meanSquares - mean * mean));
+  printf("%.1f seconds on %d threads\n",
+         (stopTime.tv_sec - startTime.tv_sec) + 1e-9 * (stopTime.tv_nsec - startTime.tv_nsec), num_threads);
+  printf("Score  P(score)        P(score >= X)\n");
+  atLeast = total;
+  for (i = 0; i < SIM_NUM_SCORES; i++)
+  {
+    if (scoreProb[i] > 0.0)
+    {
+      printf("%5d  %.12f  %.12f\n", i + SIM_MIN_SCORE, scoreProb[i], atLeast);
+    }
+    atLeast -= scoreProb[i];
+  }
+
+  free(job.scoreProb);
+  free(job.mass);
+  free(job.levelStates);
+  free(args);
+  free(threads);
+}
+
+// --policy-latency: time qwixx_decide() against policyDecide() on num_samples
+// (state, roll) pairs taken from simulated games, and count the decisions the
+// two disagree on.
+static void measurePolicyLatency(const QwixxPolicy *policy, int num_samples)
+{
+  typedef struct
+  {
+    QwixxState state;
+    int        dice[6]; // w1 w2 r y g b
+  } DecisionSample;
+
+  DecisionSample  *samples = malloc(sizeof(DecisionSample) * num_samples);
+  int             *actions = malloc(sizeof(int) * num_samples);
+  struct timespec  start, stop;
+  double           decideNs, policyNs;
+  long long        checksum = 0;
+  int              n = 0, i, numDiffs = 0, numStateDiffs = 0, numWorse = 0;
+  uint64_t         gameIx = 0;
+
+  if (samples == NULL || actions == NULL)
+  {
+    printf("Error allocating samples! Aborting!\n");
+    exit(-1);
+  }
+
+  // Collect the states and rolls of whole games
+  while (n < num_samples)
+  {
+    QwixxState state;
+    SimRng     rng;
+
+    initialize_qwixx_state(&state);
+    seedSimRng(&rng, 0, gameIx++);
+    while (n < num_samples && ! isGameOver(&state))
+    {
+      samples[n].state = state;
+      for (i = 0; i < 6; i++)
+      {
+        samples[n].dice[i] = simRollDie(&rng);
+      }
+      simDecide(&state, samples[n].dice[0], samples[n].dice[1], samples[n].dice[2],
+                samples[n].dice[3], samples[n].dice[4], samples[n].dice[5]);
+      n++;
+    }
+  }
+
+  // Different actions can still lead to the same state (e.g. the same mark
+  // through a different group), so check the states as well, and whether a
+  // different state is actually worse
+  for (i = 0; i < num_samples; i++)
+  {
+    QwixxState a, b;
+    const int *d = samples[i].dice;
+    float      rewardA = 0.0f;
+    qwixx_decide(&samples[i].state, d[0], d[1], d[2], d[3], d[4], d[5], &a, &rewardA);
+    policyDecide(policy, &samples[i].state, d[0], d[1], d[2], d[3], d[4], d[5], &b);
+    if (memcmp(&a, &b, sizeof(a)) != 0)
+    {
+      numStateDiffs++;
+      numWorse += (getWforState(&b, NULL) != rewardA);
+    }
+  }
+
+#define TIME_DECISIONS(ns, DECIDE)                                                   \
+  clock_gettime(CLOCK_MONOTONIC, &start);                                            \
+  for (i = 0; i < num_samples; i++)                                                  \
+  {                                                                                  \
+    QwixxState next;                                                                 \
+    const int *d = samples[i].dice;                                                  \
+    DECIDE;                                                                          \
+    checksum += next.numPenalties;                                                   \
+  }                                                                                  \
+  clock_gettime(CLOCK_MONOTONIC, &stop);                                             \
+  ns = ((stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec)) / num_samples;
+
+  // Both are timed after the checks above, so the pages they use are mapped in
+  TIME_DECISIONS(decideNs, actions[i] = qwixx_decide(&samples[i].state, d[0], d[1], d[2], d[3], d[4], d[5], &next, NULL))
+  TIME_DECISIONS(policyNs, numDiffs += (policyDecide(policy, &samples[i].state, d[0], d[1], d[2], d[3], d[4], d[5], &next) != actions[i]))
+
+  printf("%d decisions from %llu games (checksum %lld)\n", num_samples, (unsigned long long) gameIx, checksum);
+  printf("qwixx_decide():  %.1f ns per decision\n", decideNs);
+  printf("policyDecide():  %.1f ns per decision\n", policyNs);
+  printf("Different actions: %d, different next states: %d (%d with a different expected score)\n",
+         numDiffs, numStateDiffs, numWorse);
+
+  free(actions);
+  free(samples);
+}
+
+// --bench: time the parts of the solver and the end-to-end modes on fixed
+// samples, and print the results as one JSON object so that runs of two
+// builds can be compared. Every benchmark runs once to warm up and then
+// numReps times; the statistics are over those repetitions. All samples come
+// from SimRng with fixed seeds, so every build times the same work.
+#define BENCH_NUM_LOOKUPS         (1 << 20)
+#define BENCH_NUM_DECISIONS       200000
+#define BENCH_NUM_SIM_GAMES       20000
+#define BENCH_NUM_STATES_NESTED   20     // per state sample set
+#define BENCH_NUM_STATES_FACTORED 1000
+
+enum {BENCH_EARLY_GAME, BENCH_LOCKED_COLOR, BENCH_HIGH_PENALTY, BENCH_NUM_STATE_SETS};
+
+static const char *benchStateSetNames[BENCH_NUM_STATE_SETS] = {"early_game", "locked_color", "high_penalty"};
+
+typedef struct
+{
+  int colorStates[NUM_COLORS]; // 0-61, not game over
+  int numPenalties;
+  int color;                   // mark tried by the canTakeMark() benchmark
+  int diceVal;
+} BenchLookup;
+
+typedef struct
+{
+  QwixxState state;
+  int        dice[6]; // w1 w2 r y g b
+} BenchDecision;
+
+typedef struct
+{
+  BenchLookup   *lookups;
+  BenchDecision *decisions;
+  int           *states[BENCH_NUM_STATE_SETS]; // Markov state indices
+  int            numStates;
+  int            stateSet;   // set used by benchMarkovStates()
+  int            verify;     // benchTableLoad() checks the checksum
+  long long      sink;       // results are added here so none of the work can be dropped
+} BenchData;
+
+// One repetition of a benchmark; returns the number of operations it did
+typedef long long (*BenchFn)(BenchData *data);
+
+static long long benchTableLoad(BenchData *data)
+{
+  QwixxTable table;
+  loadQwixxBin(QWIXX_BIN_FILENAME, data->verify, &table);
+  data->sink += (long long) table.checksum;
+  unloadQwixxBin(&table);
+  return 1;
+}
+
+static long long benchConvertIx(BenchData *data)
+{
+  int i;
+  for (i = 0; i < BENCH_NUM_LOOKUPS; i++)
+  {
+    const int *c = data->lookups[i].colorStates;
+    data->sink += convertClipped5tupleToIx(c[0] > 56 ? 56 : c[0], c[1] > 56 ? 56 : c[1],
+                                           c[2] > 56 ? 56 : c[2], c[3] > 56 ? 56 : c[3],
+                                           data->lookups[i].numPenalties);
+  }
+  return BENCH_NUM_LOOKUPS;
+}
+
+static long long benchGetW(BenchData *data)
+{
+  float sum = 0.0f;
+  int   i;
+  for (i = 0; i < BENCH_NUM_LOOKUPS; i++)
+  {
+    const int *c = data->lookups[i].colorStates;
+    sum += getWforStateOpt(data->lookups[i].numPenalties, c[0], c[1], c[2], c[3], NULL);
+  }
+  data->sink += (long long) sum;
+  return BENCH_NUM_LOOKUPS;
+}
+
+static long long benchCanTakeMark(BenchData *data)
+{
+  float sum = 0.0f;
+  int   i;
+  for (i = 0; i < BENCH_NUM_LOOKUPS; i++)
+  {
+    BenchLookup *l = &data->lookups[i];
+    int          newIx, newStates[NUM_COLORS];
+    float        newW = 0.0f;
+    if (canTakeMark(l->color, l->diceVal, l->numPenalties, l->colorStates, &newIx, newStates, &newW))
+    {
+      sum += newW;
+    }
+  }
+  data->sink += (long long) sum;
+  return BENCH_NUM_LOOKUPS;
+}
+
+// Generate mode's work for one state, with the current generateKernel
+static long long benchMarkovStates(BenchData *data)
+{
+  int i;
+  for (i = 0; i < data->numStates; i++)
+  {
+    int s = data->states[data->stateSet][i];
+    analyzeMarkovState(NULL, s, 0, 0, 0, 0, 0, 0, 0, NULL);
+    data->sink += (long long) Wvec[s];
+  }
+  return data->numStates;
+}
+
+static long long benchDecide(BenchData *data)
+{
+  int i;
+  for (i = 0; i < BENCH_NUM_DECISIONS; i++)
+  {
+    QwixxState next;
+    const int *d = data->decisions[i].dice;
+    data->sink += qwixx_decide(&data->decisions[i].state, d[0], d[1], d[2], d[3], d[4], d[5], &next, NULL);
+  }
+  return BENCH_NUM_DECISIONS;
+}
+
+// The fast sim path on one thread
+static long long benchSimGames(BenchData *data)
+{
+  static SimTotals totals; // too big for the stack
+  SimJob           job;
+  SimWorkerArgs    args;
+
+  memset(&totals, 0, sizeof(totals));
+  job.numGames  = BENCH_NUM_SIM_GAMES;
+  job.seed      = 0;
+  job.next      = 0;
+  job.totals    = &totals;
+  args.job      = &job;
+  args.threadIx = 0;
+  simWorker(&args);
+  data->sink += totals.sumScores;
+  return BENCH_NUM_SIM_GAMES;
+}
+
+static void runBenchmark(const char *name, BenchFn fn, BenchData *data, int numReps, int *numPrinted)
+{
+  double          *nsPerOp = malloc(sizeof(double) * numReps);
+  double           mean = 0.0, var = 0.0, minNs, maxNs;
+  long long        ops = 0;
+  struct timespec  start, stop;
+  int              rep;
+
+  if (nsPerOp == NULL)
+  {
+    printf("Error allocating benchmark results! Aborting!\n");
+    exit(-1);
+  }
+
+  fn(data); // warmup
+  nsPerOp[0] = 0.0;
+  for (rep = 0; rep < numReps; rep++)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ops = fn(data);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    nsPerOp[rep] = ((stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec)) / ops;
+  }
 
-                    // Note that since this is the inner-most loop, this is
-                    // where a vast majority of the program's time is spent.
-                    CHECK_HI_C1_ONLY(BLUE, b)
-                    CHECK_W_AS_C1_THEN_C2_HI(RED   , BLUE, b)
-                    CHECK_W_AS_C1_THEN_C2_HI(YELLOW, BLUE, b)
-                    CHECK_W_AS_C1_THEN_C2_HI(GREEN , BLUE, b)
-                    CHECK_W_AS_C1_THEN_C2_HI(BLUE  , BLUE, b)
-                    // End of section where vast majority of the program's time is spent
+  minNs = maxNs = nsPerOp[0];
+  for (rep = 0; rep < numReps; rep++)
+  {
+    mean  += nsPerOp[rep] / numReps;
+    minNs  = (nsPerOp[rep] < minNs) ? nsPerOp[rep] : minNs;
+    maxNs  = (nsPerOp[rep] > maxNs) ? nsPerOp[rep] : maxNs;
+  }
+  for (rep = 0; rep < numReps; rep++)
+  {
+    var += (nsPerOp[rep] - mean) * (nsPerOp[rep] - mean);
+  }
+  var = (numReps > 1) ? var / (numReps - 1) : 0.0;
+
+  printf("%s    {\"name\": \"%s\", \"ops_per_rep\": %lld, \"ns_per_op\": "
+         "{\"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"max\": %.3f}, \"ops_per_sec\": %.1f}",
+         (*numPrinted > 0) ? ",\n" : "", name, ops, mean, sqrt(var), minNs, maxNs, 1e9 / mean);
+  fflush(stdout);
+  (*numPrinted)++;
+  free(nsPerOp);
+}
 
-                    int bestThruBlue = pickBestAction(actionReward,
-                                HI_BLUE_ONLY, WHITE_AS_BLUE_THEN_HI_BLUE, bestThruGreen);
+// Whether Markov state s (not game over) belongs to sample set set
+static int inBenchStateSet(int s, int set)
+{
+  int p         = s / NUM_FOUR_COLOR_STATES;
+  int rygbState = s % NUM_FOUR_COLOR_STATES;
+  int ry, gb, colors[NUM_COLORS];
+  int numMarks  = 0, numLocked = 0, c;
+
+  quadToC12C34(rygbState, &ry, &gb);
+  colors[RED   ] = dualToC1[ry];
+  colors[YELLOW] = dualToC2[ry];
+  colors[GREEN ] = dualToC1[gb];
+  colors[BLUE  ] = dualToC2[gb];
+
+  for (c = 0; c < NUM_COLORS; c++)
+  {
+    numMarks  += color62ToMarks[colors[c]];
+    numLocked += (colors[c] >= 56);
+  }
+  if (isGameOverIx(colors, p))
+  {
+    return 0;
+  }
+  switch (set)
+  {
+    case BENCH_EARLY_GAME:   return p == 0 && numMarks <= 6;
+    case BENCH_LOCKED_COLOR: return numLocked == 1;
+    default:                 return p == NUM_PENALTIES_TO_END - 1 && numLocked == 0;
+  }
+}
 
-                    // If it is possible to lock blue, then check the low blue, too
-                    if (b == 1 && w1 == 1)
-                    {
-                      CHECK_LOW_C1_ONLY(BLUE, b);
-                      CHECK_W_AS_C1_THEN_C2_LOW(RED   , BLUE, b)
-                      CHECK_W_AS_C1_THEN_C2_LOW(YELLOW, BLUE, b)
-                      CHECK_W_AS_C1_THEN_C2_LOW(GREEN , BLUE, b)
-                      CHECK_W_AS_C1_THEN_C2_LOW(BLUE  , BLUE, b)
-                      bestThruBlue = pickBestAction(actionReward,
-                                LOW_BLUE_ONLY, WHITE_AS_BLUE_THEN_LOW_BLUE, bestThruBlue);
-                    }
+static void runBenchmarks(int numReps)
+{
+  BenchData  data;
+  QwixxTable table;
+  SimRng     rng;
+  float     *Wcopy = NULL;
+  uint64_t   gameIx = 0;
+  int        numPrinted = 0;
+  int        i, n, set;
+  char       name[64];
+  GenerateKernel savedKernel = generateKernel;
+
+  memset(&data, 0, sizeof(data));
+  data.lookups   = malloc(sizeof(BenchLookup) * BENCH_NUM_LOOKUPS);
+  data.decisions = malloc(sizeof(BenchDecision) * BENCH_NUM_DECISIONS);
+  if (data.lookups == NULL || data.decisions == NULL)
+  {
+    printf("Error allocating benchmark samples! Aborting!\n");
+    exit(-1);
+  }
+  for (set = 0; set < BENCH_NUM_STATE_SETS; set++)
+  {
+    data.states[set] = malloc(sizeof(int) * BENCH_NUM_STATES_FACTORED);
+    if (data.states[set] == NULL)
+    {
+      printf("Error allocating benchmark samples! Aborting!\n");
+      exit(-1);
+    }
+  }
 
-                    theWnext += actionReward[bestThruBlue] * pScale;
+  loadQwixxBin(QWIXX_BIN_FILENAME, 0, &table);
+  useQwixxTable(&table);
 
-                    bestChoice = bestThruBlue;
+  // Random 0-61 states that aren't game over, for the lookup benchmarks
+  seedSimRng(&rng, 0, 0);
+  for (i = 0; i < BENCH_NUM_LOOKUPS; i++)
+  {
+    BenchLookup *l = &data.lookups[i];
+    do
+    {
+      int c;
+      for (c = 0; c < NUM_COLORS; c++)
+      {
+        l->colorStates[c] = (int) (xoshiro256ss(&rng) % NUM_ROW_STATES);
+      }
+      l->numPenalties = (int) (xoshiro256ss(&rng) % NUM_PENALTIES_TO_END);
+    } while (isGameOverIx(l->colorStates, l->numPenalties));
+    l->color   = (int) (xoshiro256ss(&rng) % NUM_COLORS);
+    l->diceVal = simRollDie(&rng) + simRollDie(&rng);
+  }
 
-                    if (0)//actionReward[bestThruBlue] > 0.0 && bestThruBlue != PENALTY)
-                    {
-                      printf("State %d [%d R:%d/%d Y:%d/%d G:%d/%d B:%d/%d], "
-                             "Dice [W:%d %d R:%d Y:%d G:%d B:%d] Action %d Reward %.1f "
-                             "Rewards: %.1f %.1f %.1f %.1f %.1f\n",
-                             s, p,
-                             state.color[0].numMarks, state.color[0].rightMark,
-                             state.color[1].numMarks, state.color[1].rightMark,
-                             state.color[2].numMarks, state.color[2].rightMark,
-                             state.color[3].numMarks, state.color[3].rightMark,
-                             w1, w2, r, y, g, b, bestThruBlue, actionReward[bestThruBlue],
-                             actionReward[0],
-                             actionReward[1],
-                             actionReward[2],
-                             actionReward[3],
-                             actionReward[4]);
-                    }
-                  } // b
-                } //g
-              } // y
-            } // r
-          } // w2
-        } // w1
+  // Markov states for generate mode, by rejection from the whole state space
+  seedSimRng(&rng, 0, 1);
+  for (set = 0; set < BENCH_NUM_STATE_SETS; set++)
+  {
+    n = 0;
+    while (n < BENCH_NUM_STATES_FACTORED)
+    {
+      int s = (int) (xoshiro256ss(&rng) % (NUM_MARKOV_STATES - 1));
+      if (inBenchStateSet(s, set))
+      {
+        data.states[set][n++] = s;
+      }
+    }
+  }
 
-        if ( do_one_state )
-        {
-          // Update the state according to the best choice
-          constructStateFromIx(stateForAction[bestChoice], pState);
+  // The states and rolls of whole simulated games, for qwixx_decide()
+  n = 0;
+  while (n < BENCH_NUM_DECISIONS)
+  {
+    QwixxState state;
+    initialize_qwixx_state(&state);
+    seedSimRng(&rng, 1, gameIx++);
+    while (n < BENCH_NUM_DECISIONS && ! isGameOver(&state))
+    {
+      BenchDecision *d = &data.decisions[n++];
+      d->state = state;
+      for (i = 0; i < 6; i++)
+      {
+        d->dice[i] = simRollDie(&rng);
+      }
+      simDecide(&state, d->dice[0], d->dice[1], d->dice[2], d->dice[3], d->dice[4], d->dice[5]);
+    }
+  }
 
-          if ( print_actions )
-          {
-            printf("Before the dice, your expected score was %.3f\n", getWforState(&state, NULL));
-            printf("After  the dice, your expected score is  %.3f, if you take choice %d\n",
-                          actionReward[bestChoice], bestChoice);
-            printf("Here are the expected scores for all choices:\n");
-            printf("  00 - PENALTY:                          %.3f\n", actionReward[ 0]);
-            printf("  01 - WHITE_AS_RED:                     %.3f\n", actionReward[ 1]);
-            printf("  02 - WHITE_AS_YELLOW:                  %.3f\n", actionReward[ 2]);
-            printf("  03 - WHITE_AS_GREEN:                   %.3f\n", actionReward[ 3]);
-            printf("  04 - WHITE_AS_BLUE:                    %.3f\n", actionReward[ 4]);
-            printf("  05 - LOW_RED_ONLY:                     %.3f\n", actionReward[ 5]);
-            printf("  06 - WHITE_AS_RED_THEN_LOW_RED:        %.3f\n", actionReward[ 6]);
-            printf("  07 - WHITE_AS_YELLOW_THEN_LOW_RED:     %.3f\n", actionReward[ 7]);
-            printf("  08 - WHITE_AS_GREEN_THEN_LOW_RED:      %.3f\n", actionReward[ 8]);
-            printf("  09 - WHITE_AS_BLUE_THEN_LOW_RED:       %.3f\n", actionReward[ 9]);
-            printf("  10 - LOW_YELLOW_ONLY:                  %.3f\n", actionReward[10]);
-            printf("  11 - WHITE_AS_RED_THEN_LOW_YELLOW:     %.3f\n", actionReward[11]);
-            printf("  12 - WHITE_AS_YELLOW_THEN_LOW_YELLOW:  %.3f\n", actionReward[12]);
-            printf("  13 - WHITE_AS_GREEN_THEN_LOW_YELLOW:   %.3f\n", actionReward[13]);
-            printf("  14 - WHITE_AS_BLUE_THEN_LOW_YELLOW:    %.3f\n", actionReward[14]);
-            printf("  15 - HI_GREEN_ONLY:                    %.3f\n", actionReward[15]);
-            printf("  16 - WHITE_AS_RED_THEN_HI_GREEN:       %.3f\n", actionReward[16]);
-            printf("  17 - WHITE_AS_YELLOW_THEN_HI_GREEN:    %.3f\n", actionReward[17]);
-            printf("  18 - WHITE_AS_GREEN_THEN_HI_GREEN:     %.3f\n", actionReward[18]);
-            printf("  19 - WHITE_AS_BLUE_THEN_HI_GREEN:      %.3f\n", actionReward[19]);
-            printf("  20 - HI_BLUE_ONLY:                     %.3f\n", actionReward[20]);
-            printf("  21 - WHITE_AS_RED_THEN_HI_BLUE:        %.3f\n", actionReward[21]);
-            printf("  22 - WHITE_AS_YELLOW_THEN_HI_BLUE:     %.3f\n", actionReward[22]);
-            printf("  23 - WHITE_AS_GREEN_THEN_HI_BLUE:      %.3f\n", actionReward[23]);
-            printf("  24 - WHITE_AS_BLUE_THEN_HI_BLUE:       %.3f\n", actionReward[24]);
-
-            // If it was possible to lock a color, then evaluate/print the additional options
-            if (w2_roll == 6 && r_roll == 6 && state.color[RED   ].numMarks >= 5)
-            {
-              printf("  25 - HI_RED_ONLY:                      %.3f\n", actionReward[25]);
-              printf("  26 - WHITE_AS_RED_THEN_HI_RED:         %.3f\n", actionReward[26]);
-              printf("  27 - WHITE_AS_YELLOW_THEN_HI_RED:      %.3f\n", actionReward[27]);
-              printf("  28 - WHITE_AS_GREEN_THEN_HI_RED:       %.3f\n", actionReward[28]);
-              printf("  29 - WHITE_AS_BLUE_THEN_HI_RED:        %.3f\n", actionReward[29]);
-            }
-            if (w2_roll == 6 && y_roll == 6 && state.color[YELLOW].numMarks >= 5)
-            {
-              printf("  30 - HI_YELLOW_ONLY:                   %.3f\n", actionReward[30]);
-              printf("  31 - WHITE_AS_RED_THEN_HI_YELLOW:      %.3f\n", actionReward[31]);
-              printf("  32 - WHITE_AS_YELLOW_THEN_HI_YELLOW:   %.3f\n", actionReward[32]);
-              printf("  33 - WHITE_AS_GREEN_THEN_HI_YELLOW:    %.3f\n", actionReward[33]);
-              printf("  34 - WHITE_AS_BLUE_THEN_HI_YELLOW:     %.3f\n", actionReward[34]);
-            }
-            if (w1_roll == 1 && g_roll == 1 && state.color[GREEN ].numMarks >= 5)
-            {
-              printf("  35 - LOW_GREEN_ONLY:                   %.3f\n", actionReward[35]);
-              printf("  36 - WHITE_AS_RED_THEN_LOW_GREEN:      %.3f\n", actionReward[36]);
-              printf("  37 - WHITE_AS_YELLOW_THEN_LOW_GREEN:   %.3f\n", actionReward[37]);
-              printf("  38 - WHITE_AS_GREEN_THEN_LOW_GREEN:    %.3f\n", actionReward[38]);
-              printf("  39 - WHITE_AS_BLUE_THEN_LOW_GREEN:     %.3f\n", actionReward[39]);
-            }
-            if (w1_roll == 1 && b_roll == 1 && state.color[BLUE  ].numMarks >= 5)
-            {
-              printf("  40 - LOW_BLUE_ONLY:                    %.3f\n", actionReward[40]);
-              printf("  41 - WHITE_AS_RED_THEN_LOW_BLUE:       %.3f\n", actionReward[41]);
-              printf("  42 - WHITE_AS_YELLOW_THEN_LOW_BLUE:    %.3f\n", actionReward[42]);
-              printf("  43 - WHITE_AS_GREEN_THEN_LOW_BLUE:     %.3f\n", actionReward[43]);
-              printf("  44 - WHITE_AS_BLUE_THEN_LOW_BLUE:      %.3f\n", actionReward[44]);
-            }
-          } // end if print_actions
-        }
-        else // Only save the best if we're running multiple states (i.e. generating the Wvec)
-        {
-          Wvec[s] = theWnext;
-        }
-      } // end else game not over
-    } // end else numPenalties < 4
-    if (do_one_state == 0 && ((NUM_MARKOV_STATES - s) % 1000 == 0))
+  printf("{\n  \"benchmark\": \"single_player_opt\",\n  \"table\": \"%s\",\n  \"value_type\": \"%s\",\n"
+         "  \"warmup_reps\": 1,\n  \"reps\": %d,\n  \"results\": [\n",
+         QWIXX_BIN_FILENAME, table.W ? "float32" : "fixed16", numReps);
+
+  data.verify = 0;
+  runBenchmark("table_load", benchTableLoad, &data, numReps, &numPrinted);
+  data.verify = 1;
+  runBenchmark("table_load_verify_checksum", benchTableLoad, &data, numReps, &numPrinted);
+  runBenchmark("convertClipped5tupleToIx", benchConvertIx, &data, numReps, &numPrinted);
+  runBenchmark("getWforStateOpt", benchGetW, &data, numReps, &numPrinted);
+  runBenchmark("canTakeMark", benchCanTakeMark, &data, numReps, &numPrinted);
+
+  // Generate mode writes Wvec[s], so it works on a private copy of the table.
+  // Its values are already final, so rewriting them changes nothing that
+  // matters for the timing.
+  if (table.W)
+  {
+    Wcopy = malloc(sizeof(float) * NUM_MARKOV_STATES);
+    if (Wcopy == NULL)
     {
-      printf("% 8d / % 8d states complete\n", NUM_MARKOV_STATES - s, NUM_MARKOV_STATES);
+      printf("Error allocating Wvec copy! Aborting!\n");
+      exit(-1);
     }
-  } // end s loop
-} // end analyzeState()
+    memcpy(Wcopy, table.W, sizeof(float) * NUM_MARKOV_STATES);
+    Wvec = Wcopy;
+    for (set = 0; set < BENCH_NUM_STATE_SETS; set++)
+    {
+      data.stateSet = set;
+
+      generateKernel = KERNEL_NESTED;
+      data.numStates = BENCH_NUM_STATES_NESTED;
+      snprintf(name, sizeof(name), "analyzeMarkovState_nested_%s", benchStateSetNames[set]);
+      runBenchmark(name, benchMarkovStates, &data, numReps, &numPrinted);
+
+      generateKernel = KERNEL_FACTORED;
+      data.numStates = BENCH_NUM_STATES_FACTORED;
+      snprintf(name, sizeof(name), "analyzeMarkovState_factored_%s", benchStateSetNames[set]);
+      runBenchmark(name, benchMarkovStates, &data, numReps, &numPrinted);
+    }
+    generateKernel = savedKernel;
+    useQwixxTable(&table);
+  }
+
+  runBenchmark("qwixx_decide", benchDecide, &data, numReps, &numPrinted);
+  runBenchmark("sim_games", benchSimGames, &data, numReps, &numPrinted);
+
+  printf("\n  ],\n  \"sink\": %lld\n}\n", data.sink);
+
+  free(Wcopy);
+  for (set = 0; set < BENCH_NUM_STATE_SETS; set++)
+  {
+    free(data.states[set]);
+  }
+  free(data.decisions);
+  free(data.lookups);
+}
 
 int main(int argc, char *argv[])
 {
-    FILE *fp = NULL;
     char filenameBuf[128];
     int num_iterations = -1; // -1 means do all of them
     int num_sim_games  = 0;
     int start_seed     = 0;
     int print_actions  = 0;
+    int num_threads    = 1;
+    int penalty_lanes  = 0;
+    int num_shards     = 0;
+    int resume         = 0;
+    int verify_checksum = 0;
+    int save_fixed16    = 0;
+    int fast_sim        = 0;
+    int policy_latency  = 0;
+    int score_dist      = 0;
+    int bench           = 0;
+    int solve           = 0;
+    const char *export_policy   = NULL; // --export-policy
+    const char *policy_file     = NULL; // --policy
+    const char *convert_in      = NULL; // --convert-fixed16
+    const char *convert_out     = NULL;
+    const char *compare_a       = NULL; // --compare-decisions
+    const char *compare_b       = NULL;
+    const char *verify_a        = NULL; // --verify or --verify-kernels
+    const char *verify_b        = NULL;
+    int verify_kernels          = 0;
 
     typedef enum
     {
@@ -1185,19 +6233,273 @@ int main(int argc, char *argv[])
 
     RUN_MODE_TYPE run_type = (RUN_MODE_TYPE) -1;
 
+    // Pull the "--option value" flags out of argv, leaving the positional
+    // arguments in place for the mode selection below
+    int num_args = 1;
+    int argIx;
+    for (argIx = 1; argIx < argc; argIx++)
+    {
+      if (strcmp(argv[argIx], "--threads") == 0 && argIx + 1 < argc)
+      {
+        num_threads = atoi(argv[++argIx]);
+        if (num_threads < 1)
+        {
+          printf("Invalid number of threads (%s)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--kernel") == 0 && argIx + 1 < argc)
+      {
+        argIx++;
+        if (strcmp(argv[argIx], "nested") == 0)
+        {
+          generateKernel = KERNEL_NESTED;
+        }
+        else if (strcmp(argv[argIx], "factored") == 0)
+        {
+          generateKernel = KERNEL_FACTORED;
+        }
+        else if (strcmp(argv[argIx], "check") == 0)
+        {
+          generateKernel = KERNEL_CHECK;
+        }
+        else if (strcmp(argv[argIx], "reference") == 0)
+        {
+          generateKernel = KERNEL_REFERENCE;
+        }
+        else
+        {
+          printf("Unknown kernel %s (expected nested, factored, reference or check)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--penalty-lanes") == 0)
+      {
+        penalty_lanes = 1;
+      }
+      else if (strcmp(argv[argIx], "--shards") == 0 && argIx + 1 < argc)
+      {
+        num_shards = atoi(argv[++argIx]);
+        if (num_shards < 1)
+        {
+          printf("Invalid number of shards (%s)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--checkpoint-interval") == 0 && argIx + 1 < argc)
+      {
+        checkpointIntervalSec = atoi(argv[++argIx]);
+        if (checkpointIntervalSec < 0)
+        {
+          printf("Invalid checkpoint interval (%s)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--progress-interval") == 0 && argIx + 1 < argc)
+      {
+        progressIntervalSec = atoi(argv[++argIx]);
+        if (progressIntervalSec < 0)
+        {
+          printf("Invalid progress interval (%s)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--progress-file") == 0 && argIx + 1 < argc)
+      {
+        progressFile = argv[++argIx];
+      }
+      else if (strcmp(argv[argIx], "--resume") == 0)
+      {
+        resume = 1;
+      }
+      else if (strcmp(argv[argIx], "--verify-checksum") == 0)
+      {
+        verify_checksum = 1;
+      }
+      else if (strcmp(argv[argIx], "--fast-sim") == 0)
+      {
+        fast_sim = 1;
+      }
+      else if (strcmp(argv[argIx], "--export-policy") == 0 && argIx + 1 < argc)
+      {
+        export_policy = argv[++argIx];
+      }
+      else if (strcmp(argv[argIx], "--policy") == 0 && argIx + 1 < argc)
+      {
+        policy_file = argv[++argIx];
+      }
+      else if (strcmp(argv[argIx], "--score-distribution") == 0)
+      {
+        score_dist = 1;
+      }
+      else if (strcmp(argv[argIx], "--policy-latency") == 0)
+      {
+        policy_latency = 1;
+      }
+      else if (strcmp(argv[argIx], "--bench") == 0)
+      {
+        bench = 1;
+      }
+      else if (strcmp(argv[argIx], "--solve") == 0)
+      {
+        solve = 1;
+      }
+      else if (strcmp(argv[argIx], "--fixed16") == 0)
+      {
+        save_fixed16 = 1;
+      }
+      else if (strcmp(argv[argIx], "--convert-fixed16") == 0 && argIx + 2 < argc)
+      {
+        convert_in  = argv[++argIx];
+        convert_out = argv[++argIx];
+      }
+      else if (strcmp(argv[argIx], "--compare-decisions") == 0 && argIx + 2 < argc)
+      {
+        compare_a = argv[++argIx];
+        compare_b = argv[++argIx];
+      }
+      else if ((strcmp(argv[argIx], "--verify") == 0 || strcmp(argv[argIx], "--verify-kernels") == 0) &&
+               argIx + 2 < argc)
+      {
+        verify_kernels = (strcmp(argv[argIx], "--verify-kernels") == 0);
+        verify_a       = argv[++argIx];
+        verify_b       = argv[++argIx];
+      }
+      else if (strcmp(argv[argIx], "--verify-games") == 0 && argIx + 1 < argc)
+      {
+        verifyNumGames = atoll(argv[++argIx]);
+        if (verifyNumGames < 0)
+        {
+          printf("Invalid number of games (%s)! Exiting!\n", argv[argIx]);
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[argIx], "--verify-tolerance") == 0 && argIx + 1 < argc)
+      {
+        verifyTolerance = atof(argv[++argIx]);
+      }
+      else if (strncmp(argv[argIx], "--", 2) == 0)
+      {
+        printf("Unknown or incomplete option %s! Exiting!\n", argv[argIx]);
+        exit(-1);
+      }
+      else
+      {
+        argv[num_args++] = argv[argIx];
+      }
+    }
+    argc = num_args;
+
+    // A status file without an interval gets the default one
+    if (progressFile && progressIntervalSec == 0)
+    {
+      progressIntervalSec = 10;
+    }
+
+    // Penalty lanes only have the nested and factored kernels
+    if (penalty_lanes && generateKernel != KERNEL_NESTED && generateKernel != KERNEL_FACTORED)
+    {
+      printf("--penalty-lanes only works with --kernel nested or factored! Exiting!\n");
+      exit(-1);
+    }
+
+    // Every shard is a single threaded worker process, and there is no
+    // checkpoint of a sharded run
+    if (num_shards && (num_threads > 1 || penalty_lanes || checkpointIntervalSec > 0 || resume))
+    {
+      printf("--shards doesn't go with --threads, --penalty-lanes or checkpoints! Exiting!\n");
+      exit(-1);
+    }
+
     initLookupTables();
 
-    // Initialize Wvec[]
-    Wvec = malloc(sizeof(float)*NUM_MARKOV_STATES);
-    int i;
-    for (i = 0; i < NUM_MARKOV_STATES; i++)
+    // Stand-alone qwixx.bin tools
+    if (convert_in)
+    {
+      QwixxTable table;
+      loadQwixxBin(convert_in, verify_checksum, &table);
+      if (table.W == NULL)
+      {
+        printf("%s is already in the 16-bit format! Exiting!\n", convert_in);
+        exit(-1);
+      }
+      if (! saveQwixxBin(convert_out, table.W, QWIXX_BIN_VALUES_FIXED16))
+      {
+        printf("Error saving %s! Exiting!\n", convert_out);
+        exit(-1);
+      }
+      printf("Wrote %s\n", convert_out);
+      return 0;
+    }
+    if (compare_a)
+    {
+      QwixxTable tableA, tableB;
+      loadQwixxBin(compare_a, verify_checksum, &tableA);
+      loadQwixxBin(compare_b, verify_checksum, &tableB);
+      compareDecisions(&tableA, &tableB, (argc > 1) ? atoi(argv[1]) : 0, 0, NULL);
+      return 0;
+    }
+    if (verify_a)
+    {
+      int        num_states = (argc > 1) ? atoi(argv[1]) : 0;
+      QwixxTable tableA, tableB;
+
+      if (verify_kernels)
+      {
+        VerifySetup setupA, setupB;
+        parseVerifySetup(verify_a, &setupA);
+        parseVerifySetup(verify_b, &setupB);
+        if (checkpointIntervalSec > 0 || resume)
+        {
+          printf("--verify-kernels doesn't take checkpoints! Exiting!\n");
+          exit(-1);
+        }
+        memset(&tableA, 0, sizeof(tableA));
+        memset(&tableB, 0, sizeof(tableB));
+        tableA.W = generateForVerify(verify_a, &setupA, num_states, num_threads);
+        tableB.W = generateForVerify(verify_b, &setupB, num_states, num_threads);
+      }
+      else
+      {
+        loadQwixxBin(verify_a, verify_checksum, &tableA);
+        loadQwixxBin(verify_b, verify_checksum, &tableB);
+      }
+      return verifyTables(verify_a, &tableA, verify_b, &tableB, num_states, num_threads) ? 0 : 1;
+    }
+    if (bench)
+    {
+      runBenchmarks((argc > 1 && atoi(argv[1]) > 0) ? atoi(argv[1]) : 5);
+      return 0;
+    }
+    if (export_policy || policy_latency || score_dist)
     {
-      // Initialize to "end of game" values
-      Wvec[i] = WVEC_END_OF_GAME;
+      QwixxTable table;
+      loadQwixxBin(QWIXX_BIN_FILENAME, verify_checksum, &table);
+      useQwixxTable(&table);
+      if (export_policy)
+      {
+        exportPolicy(export_policy, table.checksum);
+      }
+      else if (score_dist)
+      {
+        printScoreDistribution(num_threads);
+      }
+      else
+      {
+        QwixxPolicy policy;
+        loadPolicy(policy_file ? policy_file : QWIXX_POLICY_FILENAME, &policy);
+        measurePolicyLatency(&policy, (argc > 1) ? atoi(argv[1]) : 1000000);
+      }
+      return 0;
     }
 
     // Decide which mode we're running in: CHECKER_MODE or GENERATE_MODE
-    if (access("qwixx.bin", R_OK) == 0)
+    if (solve)
+    {
+      printf("Solving the board state on demand, so entering 'play/check' mode without qwixx.bin.\n");
+      run_type = CHECKER_MODE;
+    }
+    else if (access("qwixx.bin", R_OK) == 0)
     {
       if (argc > 2)
       {
@@ -1228,26 +6530,24 @@ int main(int argc, char *argv[])
 
     }
 
-    if (run_type == CHECKER_MODE || run_type == SIM_MODE)
+    if ((run_type == CHECKER_MODE || run_type == SIM_MODE) && ! solve)
     {
-      // Load Wvec from qwixx.bin
-      FILE *fp = fopen("qwixx.bin", "rb");
-      if (fp != NULL)
-      {
-        int num_items_read = fread(Wvec, sizeof(float), NUM_MARKOV_STATES, fp);
-        if (num_items_read != NUM_MARKOV_STATES)
-        {
-          printf("Error reading qwixx.bin (num_items_read = %d)! Aborting!\n", num_items_read);
-          exit(-1);
-        }
-        fclose(fp);
-      }
-      else
+      // Map Wvec from qwixx.bin
+      QwixxTable table;
+      loadQwixxBin(QWIXX_BIN_FILENAME, verify_checksum, &table);
+      useQwixxTable(&table);
+
+      if (policy_file)
       {
-        printf("Error opening qwixx.bin! Aborting!\n");
-        exit(-1);
+        static QwixxPolicy policy;
+        loadPolicy(policy_file, &policy);
+        simPolicy = &policy;
       }
     }
+    else
+    {
+      allocWvec();
+    }
 
     if (run_type == CHECKER_MODE)
     {
@@ -1270,6 +6570,18 @@ int main(int argc, char *argv[])
         exit(-1);
       }
 
+      if (solve)
+      {
+        struct timespec start, stop;
+        int             numSolved;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        numSolved = solveReachable(&state, num_threads);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        printf("Solved %d reachable states in %.1f ms\n", numSolved,
+               (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6);
+      }
+
       int w1, w2, r, y, g, b;
       printf("Now enter the 6 dice like this: W1 W2 R Y G B\n");
       scanf_return = scanf("%d %d %d %d %d %d", &w1, &w2, &r, &y, &g, &b);
@@ -1305,6 +6617,10 @@ int main(int argc, char *argv[])
         }
       }
     }
+    else if (run_type == SIM_MODE && fast_sim)
+    {
+      simulateGamesThreaded(num_sim_games, start_seed, num_threads);
+    }
     else if (run_type == SIM_MODE)
     {
       int game_ix = 0;
@@ -1331,25 +6647,71 @@ int main(int argc, char *argv[])
             SWAP_INT(w1, w2);
           }
 
-          analyzeState(&state, 0, w1, w2, r, y, g, b, print_actions);
+          if (print_actions)
+          {
+            analyzeState(&state, 0, w1, w2, r, y, g, b, print_actions);
+          }
+          else if (simPolicy)
+          {
+            policyDecide(simPolicy, &state, w1, w2, r, y, g, b, &state);
+          }
+          else
+          {
+            simDecide(&state, w1, w2, r, y, g, b);
+          }
         }
         printf("Game %d got %d points\n", game_ix, getScore(&state));
       } // end game_ix loop
     }
     else // run_type == GENERATE_MODE
     {
-      analyzeState(NULL, num_iterations, 0, 0, 0, 0, 0, 0, print_actions);
+      CheckpointEngine engine = penalty_lanes   ? CHECKPOINT_PENALTY_LANES :
+                                num_threads > 1 ? CHECKPOINT_WAVEFRONT     : CHECKPOINT_SERIAL;
+
+      if (resume)
+      {
+        loadCheckpoint(engine, num_iterations);
+      }
+      checkpointLastTime = time(NULL);
+
+      if (num_shards)
+      {
+        printf("Using %d shards\n", num_shards);
+        generateWvecSharded(num_iterations, num_shards);
+      }
+      else if (num_threads > 1 || penalty_lanes)
+      {
+        printf("Using %d threads%s\n", num_threads, penalty_lanes ? " (penalty lanes)" : "");
+        generateWvecThreaded(num_iterations, num_threads, penalty_lanes);
+      }
+      else
+      {
+        analyzeState(NULL, num_iterations, 0, 0, 0, 0, 0, 0, print_actions);
+      }
+
+      finishCheckpoints();
 
-      snprintf(filenameBuf, sizeof(filenameBuf), "qwixx.bin");
+      snprintf(filenameBuf, sizeof(filenameBuf), QWIXX_BIN_FILENAME);
       printf("Saving results to %s ...\n", filenameBuf);
-      fp = fopen(filenameBuf,"wb");
-      if (fp)
+      if (saveQwixxBin(filenameBuf, Wvec, save_fixed16 ? QWIXX_BIN_VALUES_FIXED16 : QWIXX_BIN_VALUES_FLOAT32))
       {
-        fwrite(Wvec, sizeof(float)*NUM_MARKOV_STATES, 1, fp);
-        fclose(fp);
+        // The checkpoint is no longer needed once qwixx.bin is written
+        if (checkpointIntervalSec > 0 || resume)
+        {
+          remove(CHECKPOINT_FILENAME);
+        }
+      }
+      else
+      {
+        printf("Error saving %s!\n", filenameBuf);
       }
 
       printf("Wvec[0] = %.2f\n", Wvec[0]);
+
+      if (generateKernel == KERNEL_CHECK)
+      {
+        printKernelCheck("");
+      }
     }
 
     return 0;